@@ -22,6 +22,9 @@ CCommandLineInterpreter::CCommandLineInterpreter() {
     verbose   = CMDL_VERBOSE_YES;                          // How much diagnostics to print on screen
     optiLevel = 2;                                         // Optimization level
     maxErrors = 50;                                        // Maximum number of errors before assembler aborts
+    cacheConfig[0] = 32768;  cacheConfig[1] = 8;           // Simulated level 1 cache: 32 kB, 8 ways
+    cacheConfig[2] = 1048576;  cacheConfig[3] = 16;        // Simulated level 2 cache: 1 MB, 16 ways
+    cacheConfig[4] = 64;                                   // Cache line size
     fileNameBuffer.pushString("");                         // make first entry zero
     instructionListFile = fileNameBuffer.pushString("instruction_list.csv");  // Filename of list of instructions (default name)
 }
@@ -290,6 +293,7 @@ void CCommandLineInterpreter::interpretCommandOption(char * string) {
             if (job) err.submit(ERR_MULTIPLE_COMMANDS, string);     // More than one job specified
             job = CMDL_JOB_EMU;
             emumode = 1;
+            if (string[3] == '=') interpretDispatchOption(string+4);  // -emu=threaded, -emu=blocks
         }
         else {
             interpretErrorOption(string);
@@ -402,12 +406,86 @@ void CCommandLineInterpreter::interpretEmulateOption(char * string) {
     }
     // Detect option type
     switch(string[0] | 0x20) {
+    case 'b':   // batch option
+        if (strncasecmp_(string, "batch=", 6) == 0) {
+            batchFile = fileNameBuffer.pushString(string+6);  break;
+        }
+        if (strncasecmp_(string, "batchjobs", 9) == 0) {
+            interpretBatchJobsOption(string+9);  break;
+        }
+        err.submit(ERR_UNKNOWN_OPTION, string-1);  // Unknown option
+        break;
+    case 'c':   // cache option
+#ifdef CACHE_SIMULATION
+        if (strncasecmp_(string, "cache=", 6) == 0) {
+            cacheFile = fileNameBuffer.pushString(string+6);  break;
+        }
+        if (strncasecmp_(string, "cacheconfig=", 12) == 0) {
+            interpretCacheConfigOption(string+12);  break;
+        }
+#endif
+        if (strncasecmp_(string, "checkpoint=", 11) == 0) {
+            checkpointFile = fileNameBuffer.pushString(string+11);  break;
+        }
+        err.submit(ERR_UNKNOWN_OPTION, string-1);  // Unknown option
+        break;
+    case 'd':   // dispatch option
+        if (strncasecmp_(string, "dispatch=", 9) == 0) {
+            interpretDispatchOption(string+9);  break;
+        }
+        err.submit(ERR_UNKNOWN_OPTION, string-1);  // Unknown option
+        break;
+    case 'h':   // heapsize option
+        if (strncasecmp_(string, "heapsize=", 9) == 0) {
+            interpretMemorySizeOption(string+9, heapSize);  break;
+        }
+        err.submit(ERR_UNKNOWN_OPTION, string-1);  // Unknown option
+        break;
+    case 'j':   // jit option
+        if (strncasecmp_(string, "jit", 3) == 0) {
+            interpretJitOption(string+3);  break;
+        }
+        err.submit(ERR_UNKNOWN_OPTION, string-1);  // Unknown option
+        break;
     case 'l':   // list option
         if (strncasecmp_(string, "list=", 5) == 0) {
             interpretListOption(string+5);  break;
         }
         err.submit(ERR_UNKNOWN_OPTION, string-1);  // Unknown option
         break;
+    case 'p':   // profile option
+        if (strncasecmp_(string, "profile=", 8) == 0) {
+            profileFile = fileNameBuffer.pushString(string+8);  break;
+        }
+        err.submit(ERR_UNKNOWN_OPTION, string-1);  // Unknown option
+        break;
+    case 'r':   // readtrace option
+        if (strncasecmp_(string, "readtrace=", 10) == 0) {
+            readTraceFile = fileNameBuffer.pushString(string+10);  break;
+        }
+        if (strncasecmp_(string, "restore=", 8) == 0) {
+            restoreFile = fileNameBuffer.pushString(string+8);  break;
+        }
+        if (strncasecmp_(string, "record=", 7) == 0) {
+            recordFile = fileNameBuffer.pushString(string+7);  break;
+        }
+        if (strncasecmp_(string, "replay=", 7) == 0) {
+            replayFile = fileNameBuffer.pushString(string+7);  break;
+        }
+        err.submit(ERR_UNKNOWN_OPTION, string-1);  // Unknown option
+        break;
+    case 's':   // stacksize option
+        if (strncasecmp_(string, "stacksize=", 10) == 0) {
+            interpretMemorySizeOption(string+10, stackSize);  break;
+        }
+        err.submit(ERR_UNKNOWN_OPTION, string-1);  // Unknown option
+        break;
+    case 't':   // trace option
+        if (strncasecmp_(string, "trace=", 6) == 0) {
+            interpretTraceOption(string+6);  break;
+        }
+        err.submit(ERR_UNKNOWN_OPTION, string-1);  // Unknown option
+        break;
     case 'm':
         if (strncasecmp_(string, "maxerrors", 9) == 0) {
             interpretMaxErrorsOption(string + 9);  break;
@@ -415,6 +493,15 @@ void CCommandLineInterpreter::interpretEmulateOption(char * string) {
         if (strncasecmp_(string, "maxlines", 8) == 0) {
             interpretMaxLinesOption(string + 8);  break;
         }        
+        if (strncasecmp_(string, "maxvectorlength", 15) == 0) {
+            interpretMaxVectorLengthOption(string + 15);  break;
+        }        
+        if (strncasecmp_(string, "maxthreads", 10) == 0) {
+            interpretMaxThreadsOption(string + 10);  break;
+        }        
+        if (strncasecmp_(string, "mapsize=", 8) == 0) {
+            interpretMemorySizeOption(string + 8, mapSize);  break;
+        }
         err.submit(ERR_UNKNOWN_OPTION, string);     // Unknown option
         break;
     }
@@ -599,6 +686,12 @@ void CCommandLineInterpreter::interpretListOption(char * string) {
     if (maxLines == 0) maxLines = 1000;
 }
 
+void CCommandLineInterpreter::interpretTraceOption(char * string) {
+    // Interpret binary trace file option for emulator
+    traceFile = fileNameBuffer.pushString(string);
+    if (maxLines == 0) maxLines = 1000;
+}
+
 void CCommandLineInterpreter::interpretStackOption(char * string) {
     // Interpret stack size option for linker
     // stack=number1,number2,number3
@@ -757,6 +850,104 @@ void CCommandLineInterpreter::interpretMaxLinesOption(char * string) {
 }
 
 
+void CCommandLineInterpreter::interpretMaxVectorLengthOption(char * string) {
+    // Interpret maxvectorlength option for emulator. Must be a power of 2 from 16 to 0x10000 bytes
+    if (string[0] == '=') string++;
+    uint32_t error = 0;
+    uint64_t length = interpretNumber(string, 99, &error);
+    if (error || length < 16 || length > 0x10000 || (length & (length - 1))) {
+        err.submit(ERR_VECTOR_LENGTH_OPTION, string);  return;
+    }
+    maxVectorLength = (uint32_t)length;
+}
+
+void CCommandLineInterpreter::interpretMaxThreadsOption(char * string) {
+    // Interpret maxthreads option for emulator
+    if (string[0] == '=') string++;
+    uint32_t error = 0;
+    uint64_t n = interpretNumber(string, 99, &error);
+    if (error || n < 1 || n > 256) {
+        err.submit(ERR_UNKNOWN_OPTION, string);  return;
+    }
+    maxThreads = (uint32_t)n;
+}
+
+void CCommandLineInterpreter::interpretBatchJobsOption(char * string) {
+    // Interpret batchjobs option for emulator
+    if (string[0] == '=') string++;
+    uint32_t error = 0;
+    uint64_t n = interpretNumber(string, 99, &error);
+    if (error || n < 1 || n > 1024) {
+        err.submit(ERR_UNKNOWN_OPTION, string);  return;
+    }
+    batchJobs = (uint32_t)n;
+}
+
+void CCommandLineInterpreter::interpretMemorySizeOption(char * string, uint64_t & size) {
+    // Interpret stacksize or heapsize option for emulator. size in bytes
+    uint32_t error = 0;
+    uint64_t n = interpretNumber(string, 99, &error);
+    if (error || n == 0 || n >> 48) {
+        err.submit(ERR_UNKNOWN_OPTION, string);  return;
+    }
+    size = n;
+}
+
+void CCommandLineInterpreter::interpretCacheConfigOption(char * string) {
+    // Interpret cacheconfig option for emulator
+    // cacheconfig=L1 size,L1 ways,L2 size,L2 ways,line size
+    uint32_t e = 0;          // return code from interpretNumber
+    char * s = string;
+    for (int i = 0; i < 5; i++) {
+        if (i > 0) {
+            if (!(e & 0x1000)) {err.submit(ERR_UNKNOWN_OPTION, string);  return;}  // too few numbers
+            s += (e & 0xFFF) + 1;
+        }
+        uint64_t n = interpretNumber(s, 32, &e);
+        if ((e && !(e & 0x1000)) || n == 0 || n > 0x40000000) {err.submit(ERR_UNKNOWN_OPTION, string);  return;}
+        cacheConfig[i] = (uint32_t)n;
+    }
+    if (e) {err.submit(ERR_UNKNOWN_OPTION, string);  return;}    // too many numbers
+    // line size and number of sets must be powers of 2
+    uint32_t line = cacheConfig[4];
+    for (int i = 0; i < 4; i += 2) {
+        uint32_t setSize = cacheConfig[i+1] * line;
+        uint32_t sets = cacheConfig[i] / setSize;
+        if ((line & (line - 1)) || cacheConfig[i] % setSize || sets == 0 || (sets & (sets - 1))) {
+            err.submit(ERR_UNKNOWN_OPTION, string);  return;
+        }
+    }
+}
+
+void CCommandLineInterpreter::interpretDispatchOption(char * string) {
+    // Interpret dispatch option for emulator: -emu=loop, -emu=threaded, or -emu=blocks.
+    // -dispatch=loop etc. is the same as an emulate option after -emu
+    if (strncasecmp_(string, "loop", 5) == 0) {
+        emulateOptions &= ~(CMDL_EMU_THREADED | CMDL_EMU_BLOCKS);
+    }
+    else if (strncasecmp_(string, "threaded", 9) == 0) {
+        emulateOptions = (emulateOptions & ~CMDL_EMU_BLOCKS) | CMDL_EMU_THREADED;
+    }
+    else if (strncasecmp_(string, "blocks", 7) == 0) {
+        emulateOptions |= CMDL_EMU_THREADED | CMDL_EMU_BLOCKS;
+    }
+    else err.submit(ERR_UNKNOWN_OPTION, string);
+}
+
+
+void CCommandLineInterpreter::interpretJitOption(char * string) {
+    // Interpret jit option for emulator: -jit or -jit=verify
+    // The jit uses threaded dispatch of basic blocks for code that is not compiled
+    if (string[0] == 0) {
+        emulateOptions |= CMDL_EMU_THREADED | CMDL_EMU_BLOCKS | CMDL_EMU_JIT;
+    }
+    else if (strncasecmp_(string, "=verify", 8) == 0) {
+        emulateOptions |= CMDL_EMU_THREADED | CMDL_EMU_BLOCKS | CMDL_EMU_JIT | CMDL_EMU_JIT_VERIFY;
+    }
+    else err.submit(ERR_UNKNOWN_OPTION, string);
+}
+
+
 void CCommandLineInterpreter::reportStatistics() {
     // Report statistics about name changes etc.
 }
@@ -838,6 +1029,8 @@ void CCommandLineInterpreter::help() {
     printf("\n-relink    Relink and modify executable file\n");
     printf("\n-lib       Build or manage library file\n");
     printf("\n-emu       Emulate and debug executable file\n");
+    printf("\n-emu=threaded Emulate with faster execution of pre-decoded instructions. Not used with -list.");
+    printf("\n-emu=blocks Emulate with translated basic blocks and fused instruction pairs. Not used with -list.\n");
     printf("\n-dump-XXX  Dump file contents to console.");
     printf("\n           Values of XXX (can be combined):");
     printf("\n           f: File header, h: section Headers, s: Symbol table,");
@@ -848,6 +1041,31 @@ void CCommandLineInterpreter::help() {
     printf("\n-list=filename Specify file for output listing.");
     printf("\n-ON        Optimization level. N = 0-2.");
 
+    printf("\n\nEmulate options:");
+    printf("\n-list=filename Specify file for debug output listing.");
+    printf("\n-maxlines=N Maximum number of lines in debug output listing.");
+    printf("\n-trace=filename Write debug output as compact binary trace instead of -list.");
+    printf("\n-readtrace=filename Make debug output listing (-list) from binary trace without running.");
+    printf("\n-maxvectorlength=N Maximum vector length in bytes. Power of 2 from 16 to 65536. Default = 128.");
+    printf("\n-maxthreads=N Maximum number of threads, including the main thread. Default = 1.");
+    printf("\n-stacksize=N Data stack size for the main thread, bytes. Default = 0x100000.");
+    printf("\n-heapsize=N Heap size, bytes. Memory is used only when touched. Default = 0.");
+    printf("\n-mapsize=N Address space for files mapped by system function mmap_file, bytes. Default = 0.");
+    printf("\n-dispatch=threaded Same as -emu=threaded. -dispatch=blocks is the same as -emu=blocks.");
+    printf("\n-jit       Compile frequently used code to native x86-64 code. Not used with -list.");
+    printf("\n-jit=verify Compare results of native code with interpreter.");
+    printf("\n-profile=filename Write instruction counts and call graph for each function. Not used with -jit.");
+#ifdef CACHE_SIMULATION
+    printf("\n-cache=filename Simulate data caches and write miss rates for each function and data symbol.");
+    printf("\n-cacheconfig=L1size,L1ways,L2size,L2ways,linesize Simulated caches. Default = 32768,8,1048576,16,64.");
+#endif
+    printf("\n-checkpoint=filename File for system function checkpoint to save the program state in.");
+    printf("\n-restore=filename Continue from checkpoint file instead of starting the program.");
+    printf("\n-record=filename Write results of time, file and stdin input functions to log file.");
+    printf("\n-replay=filename Take results of the same functions from log file instead of the host.");
+    printf("\n-batch=filename Run the program once for each input file listed, with stdin from the input file.");
+    printf("\n-batchjobs=N Number of batch runs in parallel. Default = number of processors.");
+
     printf("\n\nGeneral options:");
     printf("\n-ilist=filename Specify instruction list file.");
     printf("\n-wdNNN     Disable Warning NNN.");
@@ -46,6 +46,12 @@ const int DUMP_STRINGTB =          0x0040;     // Dump string table
 const int DUMP_COMMENT =           0x0080;     // Dump comment records
 const int DUMP_RELINKABLE =        0x0100;     // Show names of relinkable modules and libraries
 
+// Constants for emulate options
+const int CMDL_EMU_THREADED =      0x0001;     // Threaded dispatch of pre-decoded instructions
+const int CMDL_EMU_BLOCKS =        0x0002;     // Threaded dispatch of translated basic blocks
+const int CMDL_EMU_JIT =           0x0004;     // Compile hot basic blocks to native x86-64 code
+const int CMDL_EMU_JIT_VERIFY =    0x0008;     // Run native code and interpreter in lockstep and compare results
+
 // Constants for file input/output options
 const int CMDL_FILE_INPUT =             1;     // Input file required
 const int CMDL_FILE_SEARCH_PATH =       2;     // Search for file in path
@@ -98,6 +104,16 @@ public:
     uint32_t outputFile;                      // Output file name. index into fileNameBuffer
     uint32_t instructionListFile;             // File name of instruction list. index into fileNameBuffer
     uint32_t outputListFile;                  // File name of assembler or emulator output list file. index into fileNameBuffer
+    uint32_t traceFile;                       // File name of binary trace output from emulator. index into fileNameBuffer
+    uint32_t readTraceFile;                   // File name of binary trace input to make emulator output list. index into fileNameBuffer
+    uint32_t profileFile;                     // File name of function profile output from emulator. index into fileNameBuffer
+    uint32_t cacheFile;                       // File name of cache simulation report from emulator. index into fileNameBuffer
+    uint32_t cacheConfig[5];                  // Simulated cache: L1 size, L1 ways, L2 size, L2 ways, line size
+    uint32_t checkpointFile;                  // File name of checkpoint written by emulated program. index into fileNameBuffer
+    uint32_t restoreFile;                     // File name of checkpoint to continue from. index into fileNameBuffer
+    uint32_t recordFile;                      // File name of system call log written by emulator. index into fileNameBuffer
+    uint32_t replayFile;                      // File name of system call log to replay. index into fileNameBuffer
+    uint32_t batchFile;                       // File with list of input files for emulator batch mode. index into fileNameBuffer
     int  job;                                 // Job to do: ass, dis, dump, link, lib, emu
     int  inputType;                           // Input file type (detected from file)
     int  outputType;                          // Output type (file type or dump)
@@ -106,6 +122,13 @@ public:
     uint32_t maxLines;                        // Maximum number of lines in emulator output list
     uint32_t verbose;                         // How much diagnostics to print on screen
     uint32_t dumpOptions;                     // Options for dumping file
+    uint32_t emulateOptions;                  // Options for emulator
+    uint32_t maxVectorLength;                 // Maximum vector length in bytes for emulator. 0 = default
+    uint32_t maxThreads;                      // Maximum number of threads for emulator. 0 = default
+    uint32_t batchJobs;                       // Number of emulator batch runs in parallel. 0 = number of host cores
+    uint64_t stackSize;                       // Data stack size for emulator main thread. 0 = default
+    uint64_t heapSize;                        // Heap size for emulator. 0 = default
+    uint64_t mapSize;                         // Address space for files mapped by emulated program. 0 = none
     uint32_t fileOptions;                     // Options for input and output files
     uint32_t libraryOptions;                  // Options for library operations
     uint32_t linkOptions;                     // Options for linking
@@ -133,6 +156,8 @@ protected:
     void interpretLinkOption(char * string);  // Interpret linking option from command line
     void interpretEmulateOption(char *);      // Interpret emulate option from command line
     void interpretMaxErrorsOption(char * string); // Interpret maxerrors option from command line    
+    void interpretDispatchOption(char * string);  // Interpret dispatch option for emulator
+    void interpretJitOption(char * string);   // Interpret jit option for emulator
     void interpretCodeSizeOption(char * string);  // Interpret codesize option from command line
     void interpretDataSizeOption(char * string);  // Interpret datasize option from command line
     void interpretIlistOption(char *);        // Interpret instruction list file option
@@ -145,6 +170,12 @@ protected:
     void interpretDumpOption(char *);         // Interpret dump option from command line
     void interpretErrorOption(char *);        // Interpret error option from command line
     void interpretMaxLinesOption(char * string);// Interpret maxlines option from command line
+    void interpretMaxVectorLengthOption(char * string);// Interpret maxvectorlength option from command line
+    void interpretMaxThreadsOption(char * string);// Interpret maxthreads option from command line
+    void interpretBatchJobsOption(char * string);// Interpret batchjobs option from command line
+    void interpretMemorySizeOption(char * string, uint64_t & size);// Interpret stacksize or heapsize option for emulator
+    void interpretTraceOption(char * string); // Interpret trace option from command line
+    void interpretCacheConfigOption(char * string); // Interpret cacheconfig option from command line
     void checkOutputFileName();               // Make output file name or check that requested name is valid
     uint32_t setFileNameExtension(uint32_t fn, int filetype);   // Set file name extension according to FileType
     void help();                              // Print help message
@@ -183,6 +183,40 @@ void CMemoryBuffer::copy(CMemoryBuffer const & b) {
     data_size = b.dataSize();                    // size used
 }
 
+// Members of class CAlignedBuffer
+CAlignedBuffer::CAlignedBuffer() {
+    allocated = buffer = 0;
+    data_size = 0;
+}
+
+CAlignedBuffer::~CAlignedBuffer() {
+    clear();
+}
+
+// De-allocate buffer
+void CAlignedBuffer::clear() {
+    if (allocated) delete[] allocated;
+    allocated = buffer = 0;
+    data_size = 0;
+}
+
+// Set data size. Contents are preserved. New data are zero
+void CAlignedBuffer::setDataSize(uint32_t size) {
+    if (size <= data_size) {
+        data_size = size;  return;
+    }
+    // allocate new block with space for alignment
+    int8_t * allocated2 = new int8_t[size + ALIGNED_BUFFER_ALIGN - 1];
+    if (allocated2 == 0) {err.submit(ERR_MEMORY_ALLOCATION); return;} // Error can't allocate
+    int8_t * buffer2 = (int8_t*)(((uintptr_t)allocated2 + ALIGNED_BUFFER_ALIGN - 1) & ~(uintptr_t)(ALIGNED_BUFFER_ALIGN - 1));
+    memset(buffer2, 0, size);
+    if (buffer) memcpy(buffer2, buffer, data_size);   // copy old contents
+    if (allocated) delete[] allocated;
+    allocated = allocated2;
+    buffer = buffer2;
+    data_size = size;
+}
+
 // Members of class CFileBuffer
 CFileBuffer::CFileBuffer() : CMemoryBuffer() {  
     // Default constructor
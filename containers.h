@@ -302,6 +302,31 @@ public:
 };
 
 
+// Class CAlignedBuffer is a buffer with fixed size and alignment, used for data that are
+// accessed with SIMD instructions. The interface is a subset of CMemoryBuffer.
+// The buffer is aligned by ALIGNED_BUFFER_ALIGN.
+const uint32_t ALIGNED_BUFFER_ALIGN = 64;
+class CAlignedBuffer {
+public:
+   CAlignedBuffer();                             // Constructor
+   ~CAlignedBuffer();                            // Destructor
+   void setDataSize(uint32_t size);              // Set data size. Contents are preserved. New data are zero
+   void clear();                                 // De-allocate buffer
+   uint32_t dataSize() const {return data_size;};// Get data size
+   int8_t * buf() {return buffer;};              // Access to buffer
+   int8_t const * buf() const {return buffer;};  // Access to buffer, const
+   template <class TX> TX & get(uint32_t offset) { // Get object of arbitrary type from buffer
+      if (offset >= data_size) {
+          err.submit(ERR_CONTAINER_INDEX); offset = 0;} // Offset out of range
+      return *(TX*)(buffer + offset);}
+private:
+   CAlignedBuffer(CAlignedBuffer&);              // Make private copy constructor to prevent simple copying
+   CAlignedBuffer & operator = (CAlignedBuffer const&);// Make assignment operator to prevent simple copying
+   int8_t * allocated;                           // Memory block allocated with new
+   int8_t * buffer;                              // Aligned buffer inside allocated block
+   uint32_t data_size;                           // Size of data
+};
+
 // CMetaBuffer is a buffer of buffers. The size can be set only once, it cannot be resized
 // The elements of type B may have constructors and destructors
 template <class B>
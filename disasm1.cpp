@@ -1108,3 +1108,102 @@ void CDisassembler::getOutFile(CTextFileBuffer & buffer) {
     buffer.copy(outFile);
 }
 
+void CDisassembler::debugStart() {
+    // Prepare for disassembly on demand by debugger. 
+    // Nothing is disassembled until debugDisassemble is called
+    debugMode = 1;
+    setTabStops();
+    isExecutable = fileHeader.e_type == ET_EXEC;
+    outFile.setFileType(FILETYPE_ASM);
+}
+
+bool CDisassembler::debugDisassemble(uint64_t address, CDynamicArray<SLineRef> & list, CTextFileBuffer & text) {
+    // Disassemble the function containing code address for debugger.
+    // The lines are appended to text with linefeeds replaced by end of string.
+    // Cross references are appended to list, which must be sorted afterwards.
+    // Returns false if address is not in a code section or has been disassembled before
+    if (pass != 0x100) {
+        // First call. Pass 1 must cover all code to find jump targets and data types, but it writes nothing
+        sortSymbolsAndRelocations();
+        pass = 1;
+        pass1();
+        if (pass & 0x10) {
+            pass = 2;
+            pass1();
+        }
+        joinSymbolTables();
+        assignSymbolNames();
+        pass = 0x100;
+    }
+    // Find code section containing address
+    for (section = 1; section < sectionHeaders.numEntries(); section++) {
+        if ((sectionHeaders[section].sh_flags & SHF_EXEC) && sectionHeaders[section].sh_type != SHT_NOBITS
+        && address >= sectionHeaders[section].sh_addr 
+        && address < sectionHeaders[section].sh_addr + sectionHeaders[section].sh_size) break;
+    }
+    if (section >= sectionHeaders.numEntries()) return false;
+    codeMode = 1;
+    sectionBuffer = dataBuffer.buf() + sectionHeaders[section].sh_offset;
+    sectionEnd = (uint32_t)sectionHeaders[section].sh_size;
+    sectionAddress = sectionHeaders[section].sh_addr;
+
+    // The function extends from the nearest function symbol at or before address to the next function symbol
+    ElfFwcSym position;
+    zeroAllMembers(position);
+    position.st_section = section;
+    position.st_value = address - sectionAddress;
+    symbolExeAddress(position);
+    uint32_t first = (uint32_t)symbols.findFirst(position) & 0x7FFFFFFF; // first symbol at or after address
+    uint32_t start = 0, end = sectionEnd;        // code range relative to section
+    uint32_t s;
+    for (s = first; s < symbols.numEntries() && symbols[s] == position; s++) {
+        if (symbols[s].st_type == STT_FUNC) start = uint32_t(address - sectionAddress);
+    }
+    for (uint32_t t = first; start == 0 && t > 0; t--) {
+        ElfFwcSym & sym = symbols[t-1];
+        if (sym.st_section != position.st_section || sym.st_value < sectionAddress) break;
+        if (sym.st_type == STT_FUNC) start = uint32_t(sym.st_value - sectionAddress);
+    }
+    for (; s < symbols.numEntries() && symbols[s].st_section == position.st_section; s++) {
+        if (symbols[s].st_value >= sectionAddress + sectionEnd) break;
+        if (symbols[s].st_type == STT_FUNC) {
+            end = uint32_t(symbols[s].st_value - sectionAddress);  break;
+        }
+    }
+    // Don't disassemble the same function twice
+    uint32_t numDone = debugDone.numEntries();
+    debugDone.addUnique(sectionAddress + start);
+    if (debugDone.numEntries() == numDone) return false;
+
+    // Find first symbol in function, for writeLabels
+    position.st_section = section;
+    position.st_value = start;
+    symbolExeAddress(position);
+    nextSymbol = (uint32_t)symbols.findFirst(position) & 0x7FFFFFFF;
+    currentFunction = 0;  currentFunctionEnd = 0;
+    outFile.setSize(0);
+    lineList.setNum(0);
+
+    // Loop through instructions, as in pass 2
+    iInstr = start;
+    while (iInstr < end) {
+        SLineRef xref = { iInstr + sectionAddress, 1, outFile.dataSize() };
+        lineList.push(xref);
+        writeAddress();
+        writeLabels();                             // Find any label here
+        parseInstruction();                        // Parse instruction
+        writeInstruction();                        // Write instruction
+        iInstr += instrLength * 4;                 // Next instruction
+    }
+    // Transfer to debugger
+    uint32_t textStart = text.push(outFile.buf(), outFile.dataSize());
+    for (uint32_t i = textStart; i < text.dataSize(); i++) {
+        if ((uint8_t)text.buf()[i] < ' ') text.buf()[i] = 0;
+    }
+    for (uint32_t i = 0; i < lineList.numEntries(); i++) {
+        lineList[i].textPos += textStart;
+        list.push(lineList[i]);
+    }
+    return true;
+}
+
@@ -191,6 +191,8 @@ public:
     void go();                                   // Disassemble
     void getLineList(CDynamicArray<SLineRef> & list); // transfer lineList to debugger
     void getOutFile(CTextFileBuffer & buffer);   // transfer outFile to debugger
+    void debugStart();                           // prepare for disassembly on demand by debugger
+    bool debugDisassemble(uint64_t address, CDynamicArray<SLineRef> & list, CTextFileBuffer & text); // disassemble function containing address for debugger
     uint32_t outputFile;                         // Output file name, as index into cmd.fileNameBuffer
     uint8_t  debugMode;                          // produce disassembly for emulator/debugger
     uint8_t asmTab0;                             // Column for operand type
@@ -221,6 +223,7 @@ protected:
     CDynamicArray<ElfFwcSym> newSymbols;         // List of new symbols added during pass 1
     CDynamicArray<SLineRef> lineList;            // Cross reference of code addresses to lines in outFile (used by debugger)
     CTextFileBuffer outFile;                     // Output file
+    CDynamicArray<uint64_t> debugDone;           // Start addresses of code disassembled by debugDisassemble
     bool isExecutable;                           // Disassembling executable file
     void feedBackText1();                        // Write feedback text on stdout
     void parseInstruction();                     // Parse current instruction
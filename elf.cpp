@@ -1130,6 +1130,10 @@ int CELF::join(ElfFwcEhdr * header) {
                     }
                 }
             }
+            if (hasProgHead && sc == pHfistSection && programHeaders[progheadi].p_align >= FILE_PAGE_ALIGN) {
+                // page-aligned segment. give it the same alignment in the file, so that it can be mapped from the file
+                align(1 << FILE_PAGE_ALIGN);
+            }
             // error check
             os = sectionHeader.sh_offset;
             size = (uint32_t)sectionHeader.sh_size;
@@ -546,6 +546,7 @@ struct Elf64_Nhdr {
 
 // Memory map definitions
 #define MEMORY_MAP_ALIGN          3  // align memory map entries by 1 << MEMORY_MAP_ALIGN
+#define FILE_PAGE_ALIGN          12  // align read-only segments in executable files by 1 << FILE_PAGE_ALIGN, in memory and in the file
 #define DATA_EXTRA_SPACE      0x100  // extra space after const data section and last data section
 
 
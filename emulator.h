@@ -33,13 +33,300 @@ union SNum {
 };
 
 class CEmulator;                                 // preliminary declaration
+class CThread;                                   // preliminary declaration
+
+// universal function type for execution function
+// all operands and option bits are accessed via *thread
+typedef uint64_t (*PFunc)(CThread * thread);
+
+// pre-decoded instruction, stored in the decode cache of CThread
+struct SDecodedInstr {
+    SFormat  format;                             // copy of format record. cat is changed for single format instructions with E template
+    PFunc    function;                           // execution function. 0 if unknown instruction
+    SNum     immediate;                          // immediate operand, sign extended, shifted or converted. goes to parm[2]
+    SNum     immediateRaw;                       // immediate operand without shift or conversion. goes to parm[4]
+    int64_t  addrOperand;                        // relative jump address
+    uint8_t  operands[6];                        // operand list, as in CThread::operands
+    uint8_t  op;                                 // operation code
+    uint8_t  rs;                                 // register rs
+    uint8_t  operandType;                        // operand type
+    uint8_t  nOperands;                          // number of source operands, without flag bits
+    uint8_t  vect;                               // instruction uses vector registers
+    uint8_t  flags;                              // DECODED_* flags defined below
+    uint8_t  length;                             // number of bytes to add to ip after this instruction
+    uint8_t  listOffset;                         // address offset for debug listing. 1 for second tiny instruction
+    uint8_t  handler;                            // DECODED_HANDLER_*: handler used by threaded dispatch
+    uint8_t  formatIndex;                        // index into formatList. used by performance counters
+    uint32_t blockOffset;                        // address relative to start of basic block, when copied into a basic block
+    uint32_t jitSegment;                         // index+1 into CThread::jitSegments when handler is DECODED_HANDLER_JIT
+};
+
+// basic block of pre-decoded instructions, ending with a control transfer
+struct SBasicBlock {
+    uint32_t first;                              // index of first instruction in CThread::blockCode
+    uint32_t num;                                // number of instructions
+    uint32_t count;                              // number of times executed. used for finding hot blocks to compile
+};
+
+// sequence of instructions in a basic block compiled to native code
+struct SJitSegment {
+    uint32_t codeOffset;                         // offset of native code in CThread::jitBuffer
+    uint32_t num;                                // number of instructions covered
+    uint32_t first;                              // index of first instruction in CThread::blockCode
+    uint8_t  handler;                            // original handler of first instruction. used when native code cannot be used
+    uint8_t  endsWithJump;                       // last instruction is a jump
+    uint64_t ipNext;                             // address after last instruction. a jump is taken if the native code returns another address
+    uint64_t count;                              // number of times executed, not yet added to performance counters
+};
+
+// performance counters of a thread, read by the read_perf instruction.
+// Instructions executed as native code are added by CThread::jitCountPerf()
+struct SPerfCounters {
+    uint64_t format[256];                        // instructions executed, by index into formatList
+    uint64_t category[8];                        // instructions executed, by category: 1 = single format, 2 = tiny, 3 = multi-format, 4 = jump
+    uint64_t jumpsTaken;                         // jump, call and return instructions that did not continue with the next instruction
+    uint64_t vectorInstructions;                 // vector instructions executed
+    uint64_t vectorElements;                     // vector elements processed
+    uint64_t memoryReads;                        // memory operands read. vectors count one for each element
+    uint64_t memoryWrites;                       // memory operands written. vectors count one for each element
+};
+
+// profile counts for one 32-bit word of code. Made with option -profile
+struct SProfileCount {
+    uint64_t instructions;                       // instructions executed
+    uint64_t memoryReads;                        // memory operands read. vectors count one for each element
+    uint64_t memoryWrites;                       // memory operands written
+    uint64_t cacheAccesses;                      // memory operands in simulated caches. option -cache
+    uint64_t l1Misses;                           // simulated level 1 cache misses
+    uint64_t l2Misses;                           // simulated level 2 cache misses
+    uint32_t edge;                               // index+1 into profileEdges of last call from this address
+};
+
+// function in profile
+struct SProfileFunction {
+    uint64_t address;                            // start address
+    uint32_t name;                               // name as index into CEmulator::stringBuffer. 0 for code outside any function
+    uint64_t instructions;                       // instructions executed in this function
+    uint64_t memoryReads;                        // memory operands read
+    uint64_t memoryWrites;                       // memory operands written
+    uint64_t inclusive;                          // instructions executed in this function and functions called from it
+    uint64_t calls;                              // number of times called
+    uint64_t cacheAccesses;                      // memory operands in simulated caches
+    uint64_t l1Misses;                           // simulated level 1 cache misses
+    uint64_t l2Misses;                           // simulated level 2 cache misses
+};
+
+// edge in call graph
+struct SProfileEdge {
+    uint32_t caller;                             // index into profileFunctions
+    uint32_t callee;                             // index into profileFunctions
+    uint64_t calls;                              // number of calls
+    uint64_t inclusive;                          // instructions executed in callee and its children during these calls
+};
+
+// active call, parallel to CThread::callStack
+struct SProfileFrame {
+    uint32_t edge;                               // index into CThread::profileEdges
+    uint64_t start;                              // value of CThread::profileTotal at time of call
+};
+
+// data symbol with counts of simulated cache accesses. Made with option -cache
+struct SCacheSymbol {
+    uint64_t address;                            // start address
+    uint64_t end;                                // end address. 0 if unknown: the symbol extends to the next symbol
+    uint32_t name;                               // name as index into CEmulator::stringBuffer. 0 for memory outside any data symbol
+    uint64_t accesses;                           // memory operands read or written
+    uint64_t l1Misses;                           // level 1 cache misses
+    uint64_t l2Misses;                           // level 2 cache misses
+};
+
+// one level of a simulated set-associative cache with LRU replacement
+class CCacheLevel {
+public:
+    void init(uint32_t size, uint32_t ways, uint32_t lineSize); // set size and associativity. all lines empty
+    bool access(uint64_t line) {                 // access cache line number. returns true if hit. the line is loaded if miss
+        uint64_t * set = (uint64_t *)tags.buf() + (line & (numSets - 1)) * ways;
+        uint64_t tag = line + 1;
+        uint32_t i;
+        for (i = 0; i < ways && set[i] != tag; i++) {}
+        bool hit = i < ways;
+        if (!hit) i = ways - 1;                  // replace least recently used
+        memmove(set + 1, set, i * sizeof(uint64_t));
+        set[0] = tag;                            // most recently used first
+        return hit;
+    }
+protected:
+    CDynamicArray<uint64_t> tags;                // line number + 1 for each way of each set, most recently used first. 0 = empty
+    uint32_t numSets;                            // number of sets. power of 2
+    uint32_t ways;                               // associativity
+};
+
+// The simulated caches of option -cache need a test in each memory access.
+// Compile with -DNO_CACHE_SIMULATION to remove this test. Option -cache is then not available
+#ifndef NO_CACHE_SIMULATION
+#define CACHE_SIMULATION  1
+#endif
+
+// simulated level 1 and level 2 data cache of a thread
+class CCacheModel {
+public:
+    void init(uint32_t const config[5], uint32_t numSymbols); // set cache sizes from cmd.cacheConfig
+    CCacheLevel l1;                              // level 1 data cache
+    CCacheLevel l2;                              // level 2 cache. accessed only on level 1 misses
+    uint32_t lineBits;                           // log2(line size)
+    CDynamicArray<SCacheSymbol> symbols;         // counts for each entry in CEmulator::cacheSymbols
+    uint32_t lastSymbol;                         // index of symbol found last time
+};
+
+// native code for a sequence of instructions. Parameter is CThread::registers. returns new value of ip
+typedef uint64_t (*PJitCode)(uint64_t * registers);
+
+// bit values for SDecodedInstr::flags
+const uint8_t DECODED_IGNORE_MASK  = 0x01;       // call execution function even if mask is zero
+const uint8_t DECODED_NO_VECLENGTH = 0x02;       // vector length determined by execution function
+const uint8_t DECODED_DOUBLE_STEP  = 0x04;       // execution function will process two vector elements at a time
+const uint8_t DECODED_DONT_READ    = 0x08;       // don't read source operand before execution
+const uint8_t DECODED_TINY         = 0x10;       // tiny instruction
+const uint8_t DECODED_TINY_PENDING = 0x20;       // second tiny instruction of pair is pending after this one
+const uint8_t DECODED_LIST         = 0x40;       // write instruction to debug listing
+
+// values for SDecodedInstr::handler
+const uint8_t DECODED_HANDLER_GENERIC = 0;       // general case: decode operands and execute with masks and vectors
+const uint8_t DECODED_HANDLER_SCALAR  = 1;       // general purpose registers and immediates only, no mask, no memory operand
+const uint8_t DECODED_HANDLER_JUMP    = 2;       // jump with self-relative address, general purpose registers only
+const uint8_t DECODED_HANDLER_COMPARE_JUMP = 3;  // integer compare and conditional jump, done without calling execution function
+const uint8_t DECODED_HANDLER_ADD_COMPARE_JUMP = 4; // add immediate followed by compare and jump. used only inside basic blocks
+const uint8_t DECODED_HANDLER_JIT     = 5;       // first instruction of a sequence compiled to native code
+
+// performance counter numbers for the read_perf instruction. The counter number is the RS field,
+// the immediate operand is an index for counters that have more than one value
+const uint32_t PERF_RESET        = 0;            // reset all counters of the thread. returns 0
+const uint32_t PERF_TIME         = 1;            // host time in nanoseconds since counters were reset
+const uint32_t PERF_INSTRUCTIONS = 2;            // instructions executed
+const uint32_t PERF_CATEGORY     = 3;            // instructions executed by category. index = SFormat::cat
+const uint32_t PERF_FORMAT       = 4;            // instructions executed by format. index into formatList
+const uint32_t PERF_JUMPS        = 5;            // index 0: jumps taken, 1: jumps not taken
+const uint32_t PERF_MEMORY       = 6;            // index 0: memory operands read, 1: memory operands written
+const uint32_t PERF_VECTOR       = 7;            // index 0: vector instructions, 1: vector elements processed
+const uint32_t PERF_CALL_DEPTH   = 8;            // index 0: current call depth, 1: maximum call depth
+
+// binary trace file made with option -trace. All numbers are little endian.
+// The file starts with TRACE_SIGNATURE, a 32-bit version and a 64-bit start time,
+// followed by records. Each record starts with a byte indicating the type:
+// TRACE_INSTRUCTION: 32-bit address relative to ip0, 32-bit first word of instruction
+// TRACE_RESULT: 8-bit destination register, 16-bit returnType, 32-bit size n, n bytes of result data
+// TRACE_INTERRUPT: 32-bit interrupt number, 8-bit terminate
+// TRACE_SYSTEM_CALL: 32-bit module, 32-bit function id
+#define TRACE_SIGNATURE  "FWCTRACE"
+const uint32_t TRACE_VERSION      = 1;
+const uint8_t TRACE_INSTRUCTION   = 1;
+const uint8_t TRACE_RESULT        = 2;
+const uint8_t TRACE_INTERRUPT     = 3;
+const uint8_t TRACE_SYSTEM_CALL   = 4;
+const uint32_t TRACE_RING_SIZE    = 0x100000;    // size of ring buffer for trace. must be a power of 2
+
+// Class for writing a binary trace file through a ring buffer.
+// A background thread writes the data to the file while the emulator is running,
+// so that memory use is bounded and the trace is not lost if the emulator is aborted
+class CTraceWriter {
+public:
+    CTraceWriter();                              // constructor
+    ~CTraceWriter();                             // destructor. calls close()
+    bool open(const char * filename);            // create file and start writer thread. returns false if failed
+    void close();                                // write remaining data, stop writer thread and close file
+    void putHeader(uint64_t startTime);          // write file header
+    void putInstruction(uint32_t address, uint32_t instructionWord); // write TRACE_INSTRUCTION record
+    void putResult(uint8_t reg, uint16_t returnType, const void * data, uint32_t size); // write TRACE_RESULT record
+    void putInterrupt(uint32_t n, bool terminate);  // write TRACE_INTERRUPT record
+    void putSystemCall(uint32_t mod, uint32_t funcid); // write TRACE_SYSTEM_CALL record
+protected:
+    void put(const void * data, uint32_t size);  // put data into ring buffer. waits if the buffer is full
+    void writerLoop();                           // writer thread
+    FILE * file;                                 // output file
+    uint8_t * ring;                              // ring buffer of TRACE_RING_SIZE bytes
+    std::atomic<uint64_t> head;                  // total number of bytes put into ring buffer
+    std::atomic<uint64_t> tail;                  // total number of bytes written to file
+    uint64_t notified;                           // value of head when writer thread was last notified
+    bool closing;                                // tell writer thread to finish
+    std::mutex mutex;                            // protects closing and waiting
+    std::condition_variable dataReady;           // writer thread waits for data
+    std::condition_variable spaceReady;          // emulator thread waits for free space
+    std::thread writer;                          // writer thread
+};
+
+// request for asynchronous input/output
+struct SAsyncJob {
+    FILE *   file;                               // host file
+    int8_t * buffer;                             // data in program memory
+    uint64_t size;                               // number of bytes to read or write
+    int64_t  offset;                             // position in file
+    int64_t * result;                            // result field of request block in program memory
+    bool     write;                              // write to file, otherwise read
+};
+
+const uint32_t ASYNC_IO_WORKERS = 4;             // number of host threads for asynchronous input/output
+
+// Class for asynchronous input/output system functions.
+// A pool of host threads reads and writes files while the emulated program is running
+class CAsyncIO {
+public:
+    CAsyncIO();                                  // constructor. starts worker threads
+    ~CAsyncIO();                                 // destructor. finishes all requests and stops worker threads
+    void submit(SAsyncJob const & job);          // queue request
+    int64_t wait(int64_t * result);              // wait until request is finished. returns result
+    static int64_t perform(SAsyncJob const & job); // read or write file. returns result
+protected:
+    void workerLoop();                           // worker thread
+    bool inFlight(int64_t const * result);       // check if request is queued or in progress
+    CDynamicArray<SAsyncJob> queue;              // requests not yet started
+    CDynamicArray<int64_t *> submitted;          // result fields of requests not yet finished
+    uint32_t queueHead;                          // index of next request in queue
+    bool closing;                                // tell worker threads to finish
+    std::mutex mutex;                            // protects queue, submitted and closing
+    std::condition_variable jobReady;            // worker threads wait for requests
+    std::condition_variable jobDone;             // emulator threads wait for results
+    CMetaBuffer<std::thread> workers;            // worker threads
+};
+
+// page size for the table of memory access permissions
+const uint32_t MEMORY_PAGE_BITS = 12;            // log2(page size)
+
+// alignment of files mapped into memory by system function mmap_file
+const uint64_t MAP_FILE_ALIGN = 0x10000;
+
+// substring of a format string for printf, with at most one format specifier
+struct SFormatPart {
+    uint32_t text;                               // offset of zero-terminated substring in CThread::formatText
+    char     type;                               // format character, lower case. 0 if no format specifier
+    uint8_t  isString;                           // format specifier is %s
+    uint8_t  asterisks;                          // number of * in format specifier
+};
+
+// format string for printf split into substrings
+struct SFormatCache {
+    uint64_t address;                            // address of format string in program memory. 0 if unused
+    uint32_t firstPart;                          // index of first substring in CThread::formatParts
+    uint32_t numParts;                           // number of substrings
+};
+
+// number of entries in cache of format strings. must be a power of 2
+const uint32_t FORMAT_CACHE_SIZE = 64;
+
+// heap allocation by system function malloc
+const uint32_t HEAP_NUM_CLASSES = 23;            // number of size classes for small blocks, 16 bytes to 32 kB
+const uint32_t HEAP_CACHE_SIZE  = 32;            // maximum number of free blocks of each size class cached by a thread
 
 // Class for a thread or CPU core in the emulator
 class CThread {
 public:
     CThread();                                   // constructor
+    ~CThread();                                  // destructor
     void run();                                  // start running
     void setRegisters(CEmulator * emulator);     // initialize registers etc.
+    void setChildRegisters(CEmulator * emulator, uint32_t number, uint64_t entry, uint64_t argument); // initialize additional thread
+    void decodeTrace(const char * filename);     // make debug output list from binary trace file
+    void profileMerge();                         // add profile counts of this thread to CEmulator
+    uint32_t threadNumber;                       // thread number. 0 = main thread
     uint64_t ip;                                 // instruction pointer
     uint64_t ip0;                                // address base for code and read-only data
     uint64_t datap;                              // base pointer for writeable data
@@ -50,6 +337,8 @@ public:
     uint32_t exception;                          // exception or jump caused by current instruction
     STemplate const * pInstr;                    // current instruction code
     SFormat  const * fInstr;                     // format of current instruction
+    SFormat  formatCopy;                         // copy of format of current instruction. fInstr points here, because decodeCache and blockCode may be reallocated
+    PFunc    functionPointer;                    // execution function of current instruction
     SNum     parm[6];                            // parm[0] = value of first operand if 3 operands
                                                  // parm[1] = value of first operand if 2 operands or second operand if 3 operands
                                                  // parm[2] = value of last operand
@@ -75,7 +364,7 @@ public:
     bool     noVectorLength;                     // RS is not a vector register, or vector length is determined by execution function
     bool     dontRead;                           // don't read source operand before execution
     bool     terminate;                          // stop execution
-    CMemoryBuffer vectors;                       // vector register i is at offset i*MaxVectorLength
+    CAlignedBuffer vectors;                      // vector register i is at offset i*MaxVectorLength. aligned by 64
     uint64_t registers[32];                      // value of register r0 - r31
     uint32_t vectorLength[32];                   // length of vector registers v0 - v31
     uint32_t vectorLengthM;                      // vector length of memory operand
@@ -92,9 +381,11 @@ public:
     uint64_t getMemoryAddress();                 // get address of a memory operand
     uint64_t readMemoryOperand(uint64_t address);// read a memory operand
     void writeMemoryOperand(uint64_t val, uint64_t address);  // write a memory operand
+    uint64_t compareSwapMemory(uint64_t address, uint64_t expected, uint64_t newValue); // atomic compare and exchange of a memory operand
+    uint64_t readPerf(uint32_t counter, uint32_t index); // read performance counter
     void interrupt(uint32_t n);                  // interrupt or trap
     uint64_t checkSysMemAccess(uint64_t address, uint64_t size, uint8_t rd, uint8_t rs, uint8_t mode);
-    int fprintfEmulated(FILE * stream, const char * format, uint64_t * argumentList); // emulate fprintf with ForwardCom argument list
+    int fprintfEmulated(FILE * stream, uint64_t format, uint64_t * argumentList); // emulate fprintf with ForwardCom argument list
     // check if system function has access to a particular address
     void systemCall(uint32_t mod, uint32_t funcid, uint8_t rd, uint8_t rs); // entry for system calls
     CDynamicArray<uint64_t> callStack;           // stack of return addresses
@@ -106,15 +397,105 @@ protected:
     uint32_t mapIndex3;                          // last memory map index for writeable data
     CEmulator * emulator;                        // pointer to owner
     CDynamicArray<SMemoryMap> memoryMap;         // memory map
+    CDynamicArray<uint8_t> pageAccess;           // access permissions for each memory page. 0 if page spans a memory map boundary
+    uint64_t numPages;                           // number of entries in pageAccess
+    CDynamicArray<SDecodedInstr> decodeCache;    // pre-decoded instructions
+    CDynamicArray<uint32_t> decodeIndex;         // index+1 into decodeCache for each code address. two entries per 32-bit word
+    CDynamicArray<uint32_t> decodeFree;          // indexes of decodeCache records discarded by invalidateDecodeCache, for reuse
+    uint64_t decodeStart;                        // start of code range covered by decodeIndex
+    uint64_t decodeEnd;                          // end of code range covered by decodeIndex
+    SDecodedInstr decodeScratch;                 // decoded instruction outside cached range
+    CDynamicArray<SDecodedInstr> blockCode;      // instructions of translated basic blocks
+    CDynamicArray<SBasicBlock> blockList;        // translated basic blocks
+    CDynamicArray<uint32_t> blockIndex;          // index+1 into blockList for each 32-bit word of code
+    bool     blockBreak;                         // basic blocks have been discarded. stop executing current block
+    bool     codeModified;                       // this thread has modified code. the other threads must be told
+    uint32_t codeGeneration;                     // value of emulator->codeGeneration that the decode cache is valid for
+    uint32_t mapGeneration;                      // value of emulator->mapGeneration that memoryMap is a copy of
+    uint8_t * jitBuffer;                         // executable memory for native code
+    uint32_t jitBufferUsed;                      // number of bytes used in jitBuffer
+    CDynamicArray<SJitSegment> jitSegments;      // instruction sequences compiled to native code
+    uint64_t jitSaved[32];                       // register values before native code, for verification
+    uint64_t jitExpected[32];                    // register values after native code, for verification
+    uint64_t jitExpectedIp;                      // ip after native code, for verification
+    uint64_t jitVerifyIp;                        // address of instruction sequence being verified
+    uint32_t jitVerifyCount;                     // instructions left to interpret before comparing with native code
+    SPerfCounters perf;                          // performance counters
+    uint64_t perfStartTime;                      // host time in nanoseconds when performance counters were reset
+    bool     profiling;                          // make function profile
+    SProfileCount * profileCurrent;              // profile counts of current instruction. points to profileOutside if not profiling
+    SProfileCount profileOutside;                // profile counts of instructions outside code range
+    CDynamicArray<SProfileCount> profileCounts;  // profile counts for each 32-bit word of code, from CEmulator::profileStart
+    CDynamicArray<SProfileEdge> profileEdges;    // call graph of this thread
+    CDynamicArray<SProfileFrame> profileStack;   // calls that have not returned yet
+    CDynamicArray<uint32_t> profileActive;       // number of active calls of each function. recursive calls count only once
+    CDynamicArray<uint64_t> profileInclusive;    // instructions executed in each function and its children
+    uint64_t profileTotal;                       // instructions executed by this thread
+    uint32_t profileRoot;                        // function where the thread started
+    CCacheModel * cacheModel;                    // simulated data caches. 0 if not option -cache
+    SFormatCache formatCache[FORMAT_CACHE_SIZE]; // format strings for printf in read-only memory, by address
+    CDynamicArray<SFormatPart> formatParts;      // substrings of format strings
+    CMemoryBuffer formatText;                    // text of substrings of format strings
+    uint64_t heapCache[HEAP_NUM_CLASSES][HEAP_CACHE_SIZE]; // free heap blocks of each size class owned by this thread
+    uint32_t heapCacheNum[HEAP_NUM_CLASSES];     // number of blocks in heapCache of each size class
+    uint32_t replayPos;                          // position of next record in replay log. 0 before first
     CTextFileBuffer listOut;                     // output debug listing
-    uint32_t listFileName;                       // file name for listOut (index into cmd.fileNameBuffer)
+    uint32_t listFileName;                       // file name for listOut or binary trace (index into cmd.fileNameBuffer)
+    CTraceWriter * trace;                        // binary trace output. 0 if output is text
+    CMemoryBuffer listData;                      // result data for debug listing
     uint32_t listLines;                          // line counter
     void fetch();                                // fetch next instruction
     void decode();                               // decode current instruction
+    void loadDecoded(SDecodedInstr * d);         // copy pre-decoded instruction into thread state and read operands
+    void predecode(SDecodedInstr & d);           // decode the parts of current instruction that do not depend on register values
+    void initPageAccess();                       // make table of access permissions for each memory page
+    void initDecodeCache();                      // set up decode cache for executable memory
+    void invalidateDecodeCache(uint64_t address, uint64_t size); // discard decoded instructions when code is modified
+    void checkCodeGeneration();                  // tell other threads about modified code, or discard code modified by other threads
+    void checkMapGeneration();                   // copy memory map changed by another thread
     void execute();                              // execute current instruction
+    bool executeVectorKernel(uint8_t lastOpType);// execute current vector instruction on all elements at once
+    void runThreaded();                          // run with threaded dispatch of pre-decoded instructions
+    uint32_t makeBasicBlock();                   // translate basic block starting at ip
+    void jitCompileBlock(SBasicBlock & block, uint64_t blockIp); // compile basic block to native code
+    void jitReset();                             // discard all native code
+    void jitVerify();                            // compare interpreter results with native code results
+    void jitCountPerf();                         // add instructions executed as native code to performance counters
+    void perfCount(SDecodedInstr const * d) {    // count instruction in performance counters
+        perf.format[d->formatIndex]++;
+        perf.category[d->format.cat & 7]++;
+        if (profiling) profileInstruction();
+    }
+    void profileInit();                          // prepare profile counts
+    void profileInstruction();                   // count current instruction in profile
+    void profileCallReturn(uint32_t depth);      // update call graph when callStack has changed
+    void cacheAccess(uint64_t address, uint32_t size); // access memory operand in simulated caches
+    void formatSplit(uint64_t format, SFormatCache & entry); // split format string for printf
+    uint64_t mapFile(const char * filename, bool writeable, uint64_t & size); // map file into memory
+    uint64_t asyncRequest(uint64_t request, uint32_t funcid, uint8_t rd, uint8_t rs); // asynchronous input/output system functions
+    uint64_t heapAllocate(uint64_t size, uint64_t alignment); // allocate heap block. returns 0 if failed
+    bool heapFree(uint64_t address);             // free heap block. returns false if not an allocated block
+    uint64_t heapReallocate(uint64_t address, uint64_t size); // change size of heap block
+    uint64_t heapBlockSize(uint64_t address);    // size of allocated heap block. 0 if not an allocated block
+    static bool replayFunction(uint32_t funcid); // system function is recorded by option -record
+    void recordCall(uint32_t funcid, uint64_t const * args, uint8_t rd, uint8_t rs); // write system call to log file
+    void replayCall(uint32_t funcid, uint8_t rd, uint8_t rs); // take result of system call from log file
     void listStart();                            // start writing debug list
+    void listHeader(uint64_t startTime);         // write heading of debug list as text
     void listInstruction(uint64_t address);      // write current instruction to debug list
+    void listInstructionText(uint64_t address);  // write instruction to debug list as text
     void listResult(uint64_t result);            // write result of current instruction to debug list
+    void listResultText(uint32_t returnType, const uint8_t * data, uint32_t size); // write result to debug list as text
+    void listInterruptText(uint32_t n, bool terminate);  // write interrupt to debug list as text
+    void listSystemCallText(uint32_t mod, uint32_t funcid); // write system call to debug list as text
+    bool pageAccessible(uint64_t address, uint32_t size, uint8_t mode) { // fast check of memory access permission
+        // true if first and last byte are in pages entirely covered by memory map entries with permission mode
+        uint64_t page1 = address >> MEMORY_PAGE_BITS;
+        uint64_t page2 = (address + size - 1) >> MEMORY_PAGE_BITS;
+        if (page1 >= numPages || page2 >= numPages) return false;
+        const uint8_t * access = (const uint8_t *)pageAccess.buf();
+        return (access[page1] & access[page2] & mode) != 0;
+    }
 public:
     uint64_t readRegister(uint8_t reg) {         // read register value
         if (vect) {                              // this function is inlined for performance reasons
@@ -140,30 +521,101 @@ public:
 protected:
     void load();                                 // load executable file into memory
     void relocate();                             // relocate any absolute addresses and system function id's
-    void disassemble();                          // make disassembly listing for debug output
+    void disassemble();                          // prepare disassembly listing for debug output
+    bool disassembleFunction(uint64_t address);  // disassemble function containing address for debug output
+    void profileFunctionList();                  // make list of functions for profile
+    uint32_t profileFunction(uint64_t address) { // find function containing address. 0 if none
+        uint64_t word = (address - profileStart) >> 2;
+        return word < profileIndex.numEntries() ? profileIndex[(uint32_t)word] : 0;
+    }
+    void profileWrite();                         // write profile file
+    void cacheSymbolList();                      // make list of data symbols for cache report
+    uint32_t cacheSymbol(uint64_t address, uint32_t guess); // find data symbol containing address. 0 if none
+    void cacheWrite();                           // write cache report
+    uint64_t checkpointChecksum();               // checksum identifying the executable file
+    uint64_t checkpointSave(CThread * t);        // save state in checkpoint file
+    void restoreMemory();                        // map memory image from checkpoint file
+    void allocateMemory();                       // reserve program memory. zero pages are not allocated before they are used
+    void loadSegment(uint32_t ph, uint64_t address); // put program header data into memory
+    void commitMemory(uint64_t address, uint64_t size); // commit memory before the host operating system accesses it
+    bool memoryUntouched(uint64_t address, uint64_t size); // check if memory has never been touched
+    void releaseMemory();                        // free program memory
+    void restoreState(CThread * t);              // restore state of main thread from checkpoint file
+    bool batchRun();                             // run once for each input file in child processes. returns true in child
+    void bufferOutput();                         // use large buffer for stdout if not a terminal
+    void replayStart();                          // open or read log file for option -record or -replay
+    void replayFinish();                         // close log file
+    void heapInit();                             // initialize heap allocator the first time it is used
+    uint32_t heapTake(uint32_t c, uint64_t * blocks, uint32_t n); // take free blocks of size class c
+    void heapGive(uint32_t c, uint64_t const * blocks, uint32_t n); // return free blocks of size class c
+    uint64_t heapSpans(uint64_t n, uint64_t alignment);  // allocate n spans for a large block
+    void heapFreeSpans(uint64_t address, uint64_t n);    // free n spans
+    uint32_t * heapSpanEntry(uint64_t address);  // span table entry for address. 0 if outside heap
+    uint64_t * heapAllocatedBits(uint64_t address, uint64_t size, uint64_t & bit); // word of allocated bits for small block
+    void heapUnlinkRun(uint64_t run);            // remove free run from list of free runs
+    uint64_t heapBlock(uint64_t address);        // size of allocated heap block. heapMutex must be locked
+    bool heapFreeBlock(uint64_t block, uint32_t c); // check that a free list link points to a free block of size class c
+    void heapLayout();                           // find addresses of span table, bitmaps and spans
     uint32_t MaxVectorLength;                    // maximum vector length
     int8_t * memory;                             // program memory
     uint64_t memsize;                            // total allocated memory size
+    bool     memoryRestored;                     // memory is mapped from checkpoint file
+    uint64_t fileChecksum;                       // checksum of executable file, from checkpointChecksum
     uint32_t maxNumThreads;                      // maximum number of threads
+    uint64_t threadBlocks;                       // address of stack and thread-local data for threads other than the main thread
+    uint64_t threadBlockSize;                    // size of stack and thread-local data for each additional thread
+    uint64_t threadStackSize;                    // data stack size for each additional thread
+    uint64_t threadLocalSize;                    // size of thread-local data (threadp sections)
+    uint64_t threadLocalOffset;                  // offset of thread-local data within thread block
+    CMemoryBuffer threadLocalInit;               // initial contents of thread-local data
     uint64_t ip0;                                // address base for code and read-only data
     uint64_t datap0;                             // address base for writeable data
     uint64_t threadp0;                           // address base for thread data of main thread
     uint64_t stackp;                             // pointer to stack
     uint64_t stackSize;                          // data stack size for main thread
     uint64_t callStackSize;                      // call stack size for main thread
-    uint64_t heapSize;                           // heap size for main thread
+    uint64_t heapSize;                           // heap size. used by system functions malloc etc.
+    uint64_t heapStart;                          // address of heap. 0 if no heap
+    uint64_t heapTable;                          // address of span table of heap allocator
+    uint64_t heapBitmaps;                        // address of bitmaps of allocated small heap blocks
+    uint64_t heapSpanBase;                       // address of first heap span
+    uint64_t heapSpanEnd;                        // end of last heap span
+    uint64_t guardSize;                          // size of inaccessible region below each data stack
+    uint64_t mapArea;                            // address of space for files mapped by system function mmap_file
+    uint64_t mapAreaSize;                        // size of space for mapped files
+    uint64_t mapAreaUsed;                        // part of mapArea used
+    CAsyncIO * asyncIO;                          // worker threads for asynchronous input/output. 0 until first used
+    FILE *   recordFile;                         // log file for option -record. 0 if not recording
+    CFileBuffer replayLog;                       // contents of log file for option -replay
+    std::mutex recordMutex;                      // protects recordFile
     uint32_t environmentSize;                    // maximum size of environment and command line data
     CMetaBuffer<CThread> threads;                // one or more threads
+    CMetaBuffer<std::thread> hostThreads;        // host threads running threads[1..]
+    CDynamicArray<uint8_t> threadState;          // THREAD_FREE, THREAD_USED or THREAD_JOINING for each thread
+    std::mutex threadMutex;                      // protects threadState
+    std::mutex heapMutex;                        // protects free lists of heap allocator
+    std::atomic<bool> stopAllThreads;            // tell all threads to stop
+    std::atomic<uint32_t> codeGeneration;        // incremented each time a thread has modified code
+    std::atomic<uint32_t> mapGeneration;         // incremented each time memoryMap is changed. changed only under threadMutex
+    uint32_t startThread(uint64_t entry, uint64_t argument); // start an additional thread
+    uint64_t joinThread(uint64_t number, uint32_t caller);   // wait for a thread to finish
+    void stopThreads();                          // stop and wait for all additional threads
     CDynamicArray<SMemoryMap> memoryMap;         // main memory map
     CDynamicArray<SLineRef> lineList;            // Cross reference of code addresses to lines in dissassembler output
     CTextFileBuffer disassemOut;                 // Output file from disassembler
+    CDynamicArray<SProfileFunction> profileFunctions; // functions sorted by address, with profile counts of all threads. entry 0 is code outside any function
+    CDynamicArray<uint32_t> profileIndex;        // index into profileFunctions for each 32-bit word of code
+    CDynamicArray<SProfileEdge> profileEdges;    // call graph of all threads
+    uint64_t profileStart;                       // start of code range covered by profileIndex
+    CDynamicArray<SCacheSymbol> cacheSymbols;    // data symbols sorted by address, with cache counts of all threads. entry 0 is memory outside any symbol
     CDisassembler disassembler;                  // disassembler for producing output list
     friend class CThread;
 };
 
-// universal function type for execution function
-// all operands and option bits are accessed via *thread
-typedef uint64_t (*PFunc)(CThread * thread);
+// state of each thread in CEmulator::threadState
+const uint8_t THREAD_FREE    = 0;                // not running and not started
+const uint8_t THREAD_USED    = 1;                // started and not yet joined
+const uint8_t THREAD_JOINING = 2;                // another thread is waiting for it to finish
 
 // Tables of execution functions
 extern PFunc funcTab1[32];                       // tiny instructions
@@ -200,6 +652,7 @@ uint64_t f_mul(CThread * thread);
 uint64_t f_div(CThread * thread);
 uint64_t f_mul_add(CThread * thread);
 uint64_t f_add_h(CThread * thread);
+uint64_t f_sub_h(CThread * thread);
 uint64_t f_mul_h(CThread * thread);
 
 // constants and functions for detecting NAN and infinity
@@ -11,42 +11,213 @@
 *****************************************************************************/
 
 #include "stdafx.h"
+#ifdef _MSC_VER
+#include <intrin.h>                              // _InterlockedCompareExchange
+#endif
 
+// host time in nanoseconds. used by performance counters
+static uint64_t hostTimeNs() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
 
 // constructor
 CEmulator::CEmulator() {
     memory = 0;                                  // initialize
     memsize = 0;
+    memoryRestored = false;
     stackp = 0;
     // set defaults. may be changed by command line or file header:
     MaxVectorLength = 0x80;                      // 128 bytes = 1024 bits
-    maxNumThreads = 1;                           // multithreading not supported yet
+    maxNumThreads = 1;                           // one thread unless option -maxthreads is used
     stackSize = 0x100000;                        // 1 MB. data stack size for main thread
+    threadStackSize = 0x40000;                   // 256 kB. data stack size for each additional thread
+    threadBlocks = threadBlockSize = threadLocalSize = threadLocalOffset = 0;
+    stopAllThreads = false;
+    codeGeneration = 0;
+    mapGeneration = 0;
     callStackSize = 0x800;                       // call stack size for main thread
     heapSize = 0;                                // heap size for main thread
+    heapStart = 0;
+    heapTable = heapBitmaps = heapSpanBase = heapSpanEnd = 0;
+    guardSize = 0x10000;                         // 64 kB. stack overflow gives access violation
+    mapArea = mapAreaSize = mapAreaUsed = 0;     // no space for mapped files unless option -mapsize
+    asyncIO = 0;                                 // started by first asynchronous input/output request
+    recordFile = 0;                              // opened by option -record
     environmentSize = 0x100;                     // maximum size of environment and command line data
+    fileChecksum = 0;
 }
 
 // destructor
 CEmulator::~CEmulator() {
-    if (memory) delete[] memory;                 // free allocated program memory
+    if (asyncIO) delete asyncIO;                 // finish pending transfers before memory is freed
+    if (memory) releaseMemory();                 // free program memory
 }
 
 // start
 void CEmulator::go() {
+    if (cmd.maxVectorLength) MaxVectorLength = cmd.maxVectorLength;  // vector length from command line
+    if (cmd.maxThreads) maxNumThreads = cmd.maxThreads;              // number of threads from command line
+    const uint64_t pageSize = (uint64_t)1 << MEMORY_PAGE_BITS;
+    if (cmd.stackSize) stackSize = (cmd.stackSize + pageSize - 1) & -(int64_t)pageSize; // stack size from command line
+    if (cmd.heapSize) heapSize = (cmd.heapSize + pageSize - 1) & -(int64_t)pageSize;    // heap size from command line
+    if (cmd.mapSize) mapAreaSize = (cmd.mapSize + MAP_FILE_ALIGN - 1) & -(int64_t)MAP_FILE_ALIGN; // space for mapped files
     threads.setSize(maxNumThreads);              // initialize threads
+    if (maxNumThreads > 1) {
+        hostThreads.setSize(maxNumThreads);      // hostThreads[0] is not used
+        threadState.setNum(maxNumThreads);
+        threadState.zero();
+    }
     load();                                      // load executable file
     if (err.number()) return;
-    if (fileHeader.e_flags & EF_RELOCATE) relocate();
+    // a restored memory image is already relocated
+    if ((fileHeader.e_flags & EF_RELOCATE) && !memoryRestored) relocate();
     if (err.number()) return;
+    // save initial thread-local data for additional threads
+    if (maxNumThreads > 1 && threadLocalSize) {
+        threadLocalInit.push(memory + threadp0, (uint32_t)threadLocalSize);
+    }
+
+    if (cmd.readTraceFile) {
+        // make debug output list from a binary trace file without running the program
+        if (!cmd.outputListFile) {
+            err.submit(ERR_EMU_TRACE_LIST);  return;
+        }
+        disassemble();
+        if (err.number()) return;
+        threads[0].setRegisters(this);
+        threads[0].decodeTrace(cmd.getFilename(cmd.readTraceFile));
+        return;
+    }
 
-    // set up disassembler for output list
-    if (cmd.outputListFile) disassemble();
+    // set up disassembler for output list. not needed for binary trace
+    if (cmd.outputListFile && !cmd.traceFile) disassemble();
+    if (cmd.profileFile || cmd.cacheFile) {
+        profileFunctionList();                   // find functions for profile and cache report
+        if (cmd.cacheFile) cacheSymbolList();    // find data symbols for cache report
+        if (cmd.profileFile) cmd.emulateOptions &= ~CMDL_EMU_JIT; // native code is not profiled
+    }
+    // the executable file is no longer needed. the segments are in memory and the disassembler has its own copy
+    dataBuffer.clear();
+    clear();
+
+    // batch mode: the parent process returns when all runs are finished. each child continues here
+    if (cmd.batchFile && !batchRun()) return;
+    bufferOutput();
+    if (cmd.recordFile || cmd.replayFile) {
+        replayStart();                           // log of system calls
+        if (err.number()) return;
+    }
 
     // prepare main thread
     threads[0].setRegisters(this);
+    if (cmd.restoreFile) {
+        restoreState(&threads[0]);               // continue from checkpoint
+        if (err.number()) return;
+    }
     // run main thread
     threads[0].run();
+    // the program ends when the main thread ends
+    stopThreads();
+    if (asyncIO) {
+        delete asyncIO;                          // finish pending asynchronous transfers
+        asyncIO = 0;
+    }
+    replayFinish();
+    if (cmd.profileFile || cmd.cacheFile) {
+        // collect counts from all threads
+        for (uint32_t t = 0; t < threads.numEntries(); t++) threads[t].profileMerge();
+        if (cmd.profileFile) profileWrite();
+        if (cmd.cacheFile) cacheWrite();
+    }
+}
+
+/* Multiple threads
+
+Option -maxthreads=N allows the program to start up to N-1 threads in addition to the
+main thread with the system function thread_create. Each emulated thread runs on its own
+host thread with its own registers, call stack, decode cache and native code.
+
+Memory layout: the additional threads get a block each at the end of memory, after the
+sections of the executable file and the heap. A block contains an inaccessible guard region
+of guardSize bytes, a data stack of threadStackSize bytes, and a copy of the thread-local
+(threadp) sections, as they were after loading. The memory map has a readable and writeable
+entry for each block, so a thread can access the stack and thread-local data of another
+thread if it knows the address. A stack overflow into the guard region gives an access
+violation, as for the main thread.
+
+Memory model: all threads share the same memory. The emulator does not reorder memory
+operands within a thread, but accesses from different threads are ordered only as the
+host orders them. Naturally aligned reads and writes up to 8 bytes are not torn.
+compare_swap is atomic. Every compare_swap locks the cache lines it touches, so that
+compare_swap instructions on overlapping operands exclude each other, whether the operands
+are aligned or not. Aligned operands of 1 - 8 bytes use atomic instructions of the host as
+well, so that they are also atomic with respect to ordinary writes. Unaligned operands are
+not. fence is a full host memory fence.
+Everything a thread has written before thread_create is visible to the new thread, and
+everything a thread has written before it ends is visible to the thread that joins it.
+
+A thread ends when it returns with an empty call stack or calls thread_exit. r0 at this
+point is the value returned by thread_join. A thread that ends in an unrecoverable
+error, or calls exit, stops the whole program.
+Code modified by one thread is removed from the decode caches of all threads. The other
+threads see the change before their next instruction after the modifying instruction
+has finished, in the order the host makes the counter CEmulator::codeGeneration visible.
+A file mapped into memory by mmap_file is added to the memory map of all threads. Each
+thread copies the new memory map before its next instruction when it sees the counter
+CEmulator::mapGeneration change. */
+
+// start an additional thread. returns thread number, or 0 if no thread is available
+uint32_t CEmulator::startThread(uint64_t entry, uint64_t argument) {
+    std::lock_guard<std::mutex> lock(threadMutex);
+    if (stopAllThreads) return 0;
+    uint32_t n;                                  // thread number
+    for (n = 1; n < maxNumThreads; n++) {
+        if (threadState[n] == THREAD_FREE) break;
+    }
+    if (n >= maxNumThreads) return 0;            // all threads are in use
+    // fresh copy of thread-local data
+    uint64_t block = threadBlocks + (n - 1) * threadBlockSize;
+    if (threadLocalSize) memcpy(memory + block + threadLocalOffset, threadLocalInit.buf(), size_t(threadLocalSize));
+    threads[n].setChildRegisters(this, n, entry, argument);
+    hostThreads[n] = std::thread(&CThread::run, &threads[n]);
+    threadState[n] = THREAD_USED;
+    return n;
+}
+
+// wait for a thread to finish. returns the value of r0 when it ended, or -1 if number is not a thread that can be joined
+uint64_t CEmulator::joinThread(uint64_t number, uint32_t caller) {
+    if (number == 0 || number >= maxNumThreads || number == caller) return (uint64_t)(int64_t)-1;
+    uint32_t n = (uint32_t)number;
+    {
+        std::lock_guard<std::mutex> lock(threadMutex);
+        if (threadState[n] != THREAD_USED) return (uint64_t)(int64_t)-1;  // not started or already being joined
+        threadState[n] = THREAD_JOINING;
+    }
+    hostThreads[n].join();
+    uint64_t value = threads[n].registers[0];
+    std::lock_guard<std::mutex> lock(threadMutex);
+    threadState[n] = THREAD_FREE;
+    return value;
+}
+
+// stop and wait for all additional threads
+void CEmulator::stopThreads() {
+    if (maxNumThreads < 2) return;
+    {
+        std::lock_guard<std::mutex> lock(threadMutex);
+        stopAllThreads = true;                   // no new threads can start after this
+    }
+    for (uint32_t n = 1; n < maxNumThreads; n++) {
+        {
+            std::lock_guard<std::mutex> lock(threadMutex);
+            // a thread in state THREAD_JOINING is joined by another thread, which is joined here
+            if (threadState[n] != THREAD_USED) continue;
+            threadState[n] = THREAD_JOINING;
+        }
+        hostThreads[n].join();
+        std::lock_guard<std::mutex> lock(threadMutex);
+        threadState[n] = THREAD_FREE;
+    }
 }
 
 // load executable file into memory
@@ -59,6 +230,7 @@ void CEmulator::load() {
         err.submit(ERR_LINK_FILE_TYPE_EXE, filename);
         return;
     }
+    fileChecksum = checkpointChecksum();         // identifies the file after the file buffers are released
     // calculate necessary memory size
     uint64_t blocksize = 0;                      // size of block of segments with same base pointer
     uint32_t ph;                                 // program header index
@@ -67,6 +239,9 @@ void CEmulator::load() {
     uint32_t flags, lastflags;                   // flags of program header
     bool hasDataSegment = false;                 // check if there is a data segment header
     const uint32_t dataflags = SHF_READ | SHF_WRITE | SHF_ALLOC | SHF_DATAP; // expected flags for data segment
+    uint64_t threadAlign = 64;                   // alignment of thread blocks for additional threads
+    uint64_t threadLocalEnd = 0;                 // end of thread-local data of main thread
+    const uint64_t pageSize = (uint64_t)1 << MEMORY_PAGE_BITS; // alignment of stack, heap and guard regions
 
     memsize = environmentSize;                   // reserve space for environment in the beginning
     for (ph = 0; ph < programHeaders.numEntries(); ph++) {
@@ -90,6 +265,12 @@ void CEmulator::load() {
             // continuation of previous block
             blocksize += programHeaders[ph].p_vaddr + programHeaders[ph].p_memsz;
         }
+        if (programHeaders[ph].p_flags & SHF_THREADP) {
+            // upper limit for size of thread-local data
+            align = (uint64_t)1 << programHeaders[ph].p_align;
+            if (align > threadAlign) threadAlign = align;
+            threadLocalSize += programHeaders[ph].p_memsz + align;
+        }
         if ((programHeaders[ph].p_flags & dataflags) == dataflags) hasDataSegment = true;
     }
     if (!hasDataSegment) { // there is no data segment. make one for the stack
@@ -105,15 +286,26 @@ void CEmulator::load() {
     memsize += blocksize;
     align = (uint64_t)1 << MEMORY_MAP_ALIGN;
     memsize = (memsize + align - 1) & -(int64_t)align;
-    // add stack and heap
-    memsize += stackSize + heapSize;
+    // add stack and heap, page aligned, and guard region below stack
+    memsize += guardSize + stackSize + heapSize + 3 * pageSize;
+    if (maxNumThreads > 1) {
+        // add guard region, stack and thread-local data for additional threads
+        if (threadAlign < pageSize) threadAlign = pageSize;
+        threadLocalOffset = (guardSize + threadStackSize + threadAlign - 1) & -(int64_t)threadAlign;
+        threadBlockSize = (threadLocalOffset + threadLocalSize + threadAlign - 1) & -(int64_t)threadAlign;
+        memsize += (maxNumThreads - 1) * threadBlockSize + threadAlign;
+    }
+    // add space for mapped files
+    if (mapAreaSize) memsize += mapAreaSize + MAP_FILE_ALIGN;
     // allocate memory
-    memory = new int8_t[size_t(memsize)];
-    if (!memory) {
-        err.submit(ERR_MEMORY_ALLOCATION); 
-        return;
+    if (cmd.restoreFile) {
+        restoreMemory();                         // memory image from checkpoint file
+        if (err.number()) return;
+    }
+    else {
+        allocateMemory();                        // zero-filled memory
+        if (err.number()) return;
     }
-    memset(memory, 0, size_t(memsize));
     // start making memory map
     address = 0;  
     flags = SHF_READ | SHF_IP;  lastflags = flags;
@@ -124,9 +316,12 @@ void CEmulator::load() {
     for (ph = 0; ph < programHeaders.numEntries(); ph++) {
         flags = programHeaders[ph].p_flags & (SHF_PERMISSIONS | SHF_BASEPOINTER);
         if (flags != lastflags && (lastflags & SHF_IP) && (!(flags & SHF_IP))) {
-            // insert stack here
-            align = 8;
-            address = (address + align - 1) & -(int64_t)align;
+            // insert stack here, with an inaccessible guard region below it
+            address = (address + pageSize - 1) & -(int64_t)pageSize;
+            mapentry.startAddress = address;
+            mapentry.access_addend = 0;
+            memoryMap.push(mapentry);
+            address += guardSize;
             flags = SHF_DATAP | SHF_READ | SHF_WRITE;
             mapentry.startAddress = address;
             mapentry.access_addend = flags;
@@ -136,10 +331,11 @@ void CEmulator::load() {
             lastflags = flags;
             flags = programHeaders[ph].p_flags & (SHF_PERMISSIONS | SHF_BASEPOINTER);
         }
+        // align each segment as the linker did, so that addresses relative to the block match p_vaddr
+        align = (uint64_t)1 << programHeaders[ph].p_align;
+        address = (address + align - 1) & -(int64_t)align;
         if ((flags & SHF_PERMISSIONS) != (lastflags & SHF_PERMISSIONS)) {
             // start new map entry
-            align = (uint64_t)1 << programHeaders[ph].p_align;
-            address = (address + align - 1) & -(int64_t)align;
             mapentry.startAddress = address;
             mapentry.access_addend = flags;
             memoryMap.push(mapentry);
@@ -163,11 +359,46 @@ void CEmulator::load() {
         }
         // store address in program header
         programHeaders[ph].p_vaddr = address;
-        // copy data
-        memcpy(memory + address, dataBuffer.buf() + programHeaders[ph].p_offset, size_t(programHeaders[ph].p_filesz));
+        // copy data, unless memory is restored from checkpoint
+        if (!memoryRestored) loadSegment(ph, address);
         address += programHeaders[ph].p_memsz;
+        if (flags & SHF_THREADP) threadLocalEnd = address;
         lastflags = flags;
     }
+    threadLocalSize = threadLocalEnd ? threadLocalEnd - threadp0 : 0;
+    if (heapSize) {
+        // heap after all data sections
+        address = (address + pageSize - 1) & -(int64_t)pageSize;
+        heapStart = address;
+        heapLayout();                            // fixed addresses of heap allocator data
+        mapentry.startAddress = address;
+        mapentry.access_addend = SHF_DATAP | SHF_READ | SHF_WRITE;
+        memoryMap.push(mapentry);
+        address += heapSize;
+    }
+    if (maxNumThreads > 1) {
+        // guard region, stack and thread-local data for additional threads
+        address = (address + threadAlign - 1) & -(int64_t)threadAlign;
+        if (address + (maxNumThreads - 1) * threadBlockSize > memsize) {
+            err.submit(ERR_ELF_INDEX_RANGE);
+            return;
+        }
+        threadBlocks = address;
+        for (uint32_t n = 1; n < maxNumThreads; n++) {
+            mapentry.startAddress = address;
+            mapentry.access_addend = 0;
+            memoryMap.push(mapentry);
+            mapentry.startAddress = address + guardSize;
+            mapentry.access_addend = SHF_THREADP | SHF_READ | SHF_WRITE;
+            memoryMap.push(mapentry);
+            address += threadBlockSize;
+        }
+    }
+    if (mapAreaSize) {
+        // space for mapped files. map entries are added by mapFile
+        address = (address + MAP_FILE_ALIGN - 1) & -(int64_t)MAP_FILE_ALIGN;
+        mapArea = address;
+    }
     // make terminating entry
     mapentry.startAddress = address;
     mapentry.access_addend = 0;
@@ -275,21 +506,19 @@ void CEmulator::relocate() {
     }
 }
 
-void CEmulator::disassemble() {                  // make disassembly listing for debug output
+void CEmulator::disassemble() {                  // prepare disassembly listing for debug output
     disassembler.copy(*this);                // copy ELF file
     disassembler.getComponents1();           // set up instruction list, etc.
     if (err.number()) return;
-    //disassembler.outputFile = cmd.fileNameBuffer.pushString("ddd.txt");
-    disassembler.debugMode = 1;              // produce disassembly for debug display/list
-    disassembler.go();                       // disassemble
-    if (err.number()) return;
-    disassembler.getLineList(lineList);      // get cross reference list from address to disassembly output file
-    lineList.sort();                         // only needed if multiple segments in lineList
-    disassembler.getOutFile(disassemOut);    // get disassembly output file
-    // replace all linefeeds by end of string
-    for (uint32_t i = 0; i < disassemOut.dataSize(); i++) {
-        if ((uint8_t)disassemOut.buf()[i] < ' ') disassemOut.buf()[i] = 0;
-    }
+    disassembler.debugStart();               // produce disassembly for debug display/list when needed
+}
+
+// disassemble the function containing code address when it is first listed. returns false if nothing new
+bool CEmulator::disassembleFunction(uint64_t address) {
+    // get lines for debug output and cross reference list from address to lines
+    if (!disassembler.debugDisassemble(address, lineList, disassemOut)) return false;
+    lineList.sort();
+    return true;
 }
 
 
@@ -301,6 +530,18 @@ CThread::CThread() {
     pendingTinyInstruction = false;
     callDept = 0;
     listLines = 0;
+    jitBuffer = 0;
+    jitBufferUsed = 0;
+    jitVerifyCount = 0;
+    threadNumber = 0;
+    trace = 0;
+    profiling = false;
+    profileCurrent = &profileOutside;
+    zeroAllMembers(profileOutside);
+    profileTotal = 0;
+    cacheModel = 0;
+    memset(heapCacheNum, 0, sizeof(heapCacheNum)); // no free heap blocks cached
+    replayPos = 0;
 }
 
 // initialize registers etc. from values in emulator
@@ -308,6 +549,7 @@ void CThread::setRegisters(CEmulator * emulator) {
     this->emulator = emulator;
     this->memory = emulator->memory;                       // program memory
     memoryMap.copy(emulator->memoryMap);                   // memory map
+    mapGeneration = emulator->mapGeneration;
 //    ip_base = emulator->ip_base;                           // reference point for code and read-only data
     ip0 = emulator->ip0;                                   // reference point for code and read-only data
     datap = emulator->datap0 + emulator->fileHeader.e_datap_base;  // base pointer for writeable data
@@ -318,15 +560,63 @@ void CThread::setRegisters(CEmulator * emulator) {
     memset(vectorLength, 0, sizeof(vectorLength));
     vectors.setDataSize(32*MaxVectorLength);
     registers[31] = emulator->stackp;                      // stack pointer
-    // to do: add thread number to list file name if multiple threads!
-    listFileName = cmd.outputListFile;                     // name for output list file
+    memset(&perf, 0, sizeof(perf));                        // reset performance counters
+    perfStartTime = hostTimeNs();
+    initPageAccess();                                      // prepare fast memory access checks
+    initDecodeCache();                                     // prepare cache of decoded instructions
+    profileInit();                                         // prepare profile counts if option -profile
+    memset(formatCache, 0, sizeof(formatCache));           // discard format strings of previous program
+    formatParts.setNum(0);
+    formatText.setSize(0);
+    // name for output list file or binary trace. only the main thread makes a list
+    listFileName = cmd.traceFile ? cmd.traceFile : cmd.outputListFile;
+}
+
+// initialize an additional thread. thread-local data must be copied to its thread block first
+void CThread::setChildRegisters(CEmulator * emulator, uint32_t number, uint64_t entry, uint64_t argument) {
+    jitReset();                                            // discard native code from a previous thread with the same number
+    setRegisters(emulator);
+    listFileName = 0;                                      // no debug output list
+    threadNumber = number;
+    uint64_t block = emulator->threadBlocks + (number - 1) * emulator->threadBlockSize;
+    threadp = block + emulator->threadLocalOffset + emulator->fileHeader.e_threadp_base;
+    registers[31] = block + emulator->guardSize + emulator->threadStackSize; // stack pointer
+    registers[0] = argument;                               // parameter to thread function
+    ip = entry;
+    // discard any state from a previous thread with the same number
+    numContr = 1 | 1<<21;
+    ninstructions = 0;
+    mapIndex1 = mapIndex2 = mapIndex3 = 0;
+    pendingTinyInstruction = false;
+    callStack.setSize(0);
+    callDept = 0;
+    jitVerifyCount = 0;
 }
 
 // start running
 void CThread::run() {
+    if (profiling) profileRoot = emulator->profileFunction(ip);
+    if ((cmd.emulateOptions & CMDL_EMU_THREADED) && !listFileName) {
+        runThreaded();                           // faster dispatch. not used with debug output list
+        return;
+    }
+    if (listFileName && cmd.traceFile) {
+        // binary trace instead of text list
+        trace = new CTraceWriter;
+        if (!trace->open(cmd.getFilename(listFileName))) {
+            err.submit(ERR_OUTPUT_FILE, cmd.getFilename(listFileName));
+            delete trace;  trace = 0;
+            return;
+        }
+    }
     listStart();                                 // start writing debug output list
     running = 1;  terminate = false;
-    while (running && !terminate) {
+    std::atomic<bool> & stop = emulator->stopAllThreads;   // another thread has ended the program
+    std::atomic<uint32_t> & generation = emulator->codeGeneration; // changed when code is modified
+    std::atomic<uint32_t> & mapChanged = emulator->mapGeneration;  // changed when a file is mapped into memory
+    while (running && !terminate && !stop.load(std::memory_order_relaxed)) {
+        if (codeModified || generation.load(std::memory_order_acquire) != codeGeneration) checkCodeGeneration();
+        if (mapChanged.load(std::memory_order_acquire) != mapGeneration) checkMapGeneration();
         fetch();                                 // fetch next instruction
         if (terminate) break;
         decode();                                // decode instruction
@@ -334,7 +624,11 @@ void CThread::run() {
         execute();                               // execute instruction
     }
     // write debug output
-    if (listFileName) {
+    if (trace) {
+        delete trace;                            // write remaining trace data and close file
+        trace = 0;
+    }
+    else if (listFileName) {
         listOut.write(cmd.getFilename(listFileName));
     }
 
@@ -367,61 +661,270 @@ void CThread::fetch() {
 // List of instructionlengths, used in decode()
 static const uint8_t lengthList[8] = {1,1,1,1,2,2,3,4};
 
+// called before each instruction when another thread has changed the memory map
+void CThread::checkMapGeneration() {
+    std::lock_guard<std::mutex> lock(emulator->threadMutex); // protects emulator->memoryMap
+    memoryMap.copy(emulator->memoryMap);
+    mapGeneration = emulator->mapGeneration;
+    initPageAccess();
+}
+
+// make table of access permissions for each memory page
+void CThread::initPageAccess() {
+    // a page gets the permissions of the memory map entry that covers it entirely.
+    // pages that span a memory map boundary get no permissions here. 
+    // accesses to such pages are checked by searching the memory map
+    const uint64_t pageSize = (uint64_t)1 << MEMORY_PAGE_BITS;
+    const uint64_t maxPages = (uint64_t)1 << 22;  // 16 GB. accesses above this are checked by searching the memory map
+    numPages = memoryMap[memoryMap.numEntries()-1].startAddress >> MEMORY_PAGE_BITS;
+    if (numPages > maxPages) numPages = maxPages;
+    pageAccess.setDataSize(0);
+    pageAccess.setNum((uint32_t)numPages);
+    pageAccess.zero();
+    for (uint32_t i = 0; i + 1 < memoryMap.numEntries(); i++) {
+        uint64_t firstPage = (memoryMap[i].startAddress + pageSize - 1) >> MEMORY_PAGE_BITS;
+        uint64_t endPage = memoryMap[i+1].startAddress >> MEMORY_PAGE_BITS;
+        if (endPage > numPages) endPage = numPages;
+        for (uint64_t p = firstPage; p < endPage; p++) {
+            pageAccess[(uint32_t)p] = (uint8_t)(memoryMap[i].access_addend & SHF_PERMISSIONS);
+        }
+    }
+}
+
+// set up decode cache for executable memory
+void CThread::initDecodeCache() {
+    // find the address range covered by executable memory map entries
+    decodeStart = decodeEnd = 0;
+    for (uint32_t i = 0; i + 1 < memoryMap.numEntries(); i++) {
+        if (memoryMap[i].access_addend & SHF_EXEC) {
+            if (decodeStart == decodeEnd) decodeStart = memoryMap[i].startAddress;
+            decodeEnd = memoryMap[i+1].startAddress;
+        }
+    }
+    // two index entries per 32-bit word. The second one is for the second of a pair of tiny instructions
+    decodeIndex.setDataSize(0);
+    decodeIndex.setNum((uint32_t)((decodeEnd - decodeStart) >> 1));
+    decodeIndex.zero();
+    decodeCache.setSize(0);
+    decodeFree.setSize(0);
+    // one basic block index entry per 32-bit word
+    blockIndex.setDataSize(0);
+    blockIndex.setNum((uint32_t)((decodeEnd - decodeStart) >> 2));
+    blockIndex.zero();
+    blockCode.setSize(0);
+    blockList.setSize(0);
+    blockBreak = false;
+    codeModified = false;
+    codeGeneration = emulator->codeGeneration;
+}
+
+// discard decoded instructions when code is modified
+void CThread::invalidateDecodeCache(uint64_t address, uint64_t size) {
+    // an instruction that begins up to 12 bytes before address may overlap the modified bytes
+    if (address >= decodeEnd || address + size + 12 <= decodeStart) return;
+    if (emulator->maxNumThreads > 1) codeModified = true;  // other threads are told after the write
+    uint64_t a = address < decodeStart + 12 ? decodeStart : (address - 12) & -(int64_t)4;
+    uint64_t b = address + size;
+    if (b > decodeEnd) b = decodeEnd;
+    for (; a < b; a += 4) {
+        for (uint32_t i = 0; i < 2; i++) {
+            uint32_t & index = decodeIndex[uint32_t((a - decodeStart) >> 1) + i];
+            if (index) {
+                decodeFree.push(index - 1);      // record can be reused
+                index = 0;
+            }
+        }
+    }
+    // discard all basic blocks, because they contain copies of the decoded instructions
+    if (blockList.numEntries()) {
+        jitReset();                              // native code belongs to the discarded blocks
+        blockIndex.zero();
+        blockCode.setSize(0);
+        blockList.setSize(0);
+        blockBreak = true;
+    }
+}
+
+// called before each instruction when code has been modified by this thread or another thread
+void CThread::checkCodeGeneration() {
+    if (codeModified) {
+        // this thread has modified code. The write is finished, so the other threads can decode it again.
+        // This thread has already discarded the modified instructions, unless another thread has also modified code
+        codeModified = false;
+        if (emulator->codeGeneration.fetch_add(1) == codeGeneration) codeGeneration++;
+        if (emulator->codeGeneration.load(std::memory_order_acquire) == codeGeneration) return;
+    }
+    // another thread has modified code. We don't know where, so discard all decoded instructions
+    codeGeneration = emulator->codeGeneration.load(std::memory_order_acquire);
+    decodeIndex.zero();
+    decodeCache.setSize(0);
+    decodeFree.setSize(0);
+    if (blockList.numEntries()) {
+        jitReset();
+        blockIndex.zero();
+        blockCode.setSize(0);
+        blockList.setSize(0);
+        blockBreak = true;
+    }
+}
+
 // decode current instruction
 void CThread::decode() {
+    // find instruction in decode cache
+    SDecodedInstr * d;
+    if (ip >= decodeStart && ip < decodeEnd && !(ip & 3)) {
+        uint32_t slot = uint32_t((ip - decodeStart) >> 1) + pendingTinyInstruction;
+        if (decodeIndex[slot] == 0) {
+            // not decoded before
+            SDecodedInstr newRecord;
+            predecode(newRecord);
+            if (decodeFree.numEntries()) {
+                // reuse a record discarded by invalidateDecodeCache
+                uint32_t index = decodeFree.pop();
+                decodeCache[index] = newRecord;
+                decodeIndex[slot] = index + 1;
+            }
+            else decodeIndex[slot] = decodeCache.push(newRecord) + 1;
+        }
+        d = &decodeCache[decodeIndex[slot] - 1];
+    }
+    else {
+        // outside of executable range. Don't cache
+        predecode(decodeScratch);
+        d = &decodeScratch;
+    }
+    loadDecoded(d);
+}
+
+// copy pre-decoded instruction into thread state and read operands
+void CThread::loadDecoded(SDecodedInstr * d) {
+    // copy static information
+    formatCopy     = d->format;
+    fInstr         = &formatCopy;
+    functionPointer = d->function;
+    op             = d->op;
+    rs             = d->rs;
+    operandType    = d->operandType;
+    nOperands      = d->nOperands;
+    vect           = d->vect;
+    ignoreMask     = (d->flags & DECODED_IGNORE_MASK) != 0;
+    noVectorLength = (d->flags & DECODED_NO_VECLENGTH) != 0;
+    doubleStep     = (d->flags & DECODED_DOUBLE_STEP) != 0;
+    dontRead       = (d->flags & DECODED_DONT_READ) != 0;
+    memcpy(operands, d->operands, sizeof(operands));
+    perfCount(d);                                          // performance counters
+    if (d->flags & DECODED_LIST) listInstruction(ip + d->listOffset - ip0); // make debug listing
+
+    if (d->flags & DECODED_TINY) {
+        // tiny instruction
+        pendingTinyInstruction = (d->flags & DECODED_TINY_PENDING) != 0;
+        if (fInstr->immSize) parm[2].q = d->immediate.q;
+        ip += d->length;                                   // next ip
+        returnType = operandType | 0x10 | vect << 8;
+        return;
+    }
+    // all other formats than tiny:
+    ip += d->length;                                       // next ip
+
+    // get address of memory operand
+    if (fInstr->mem & 0x7F) memAddress = getMemoryAddress();
+
+    if (fInstr->cat == 4 && (fInstr->mem & 0x80)) {
+        // jump instruction with self-relative jump address
+        addrOperand = d->addrOperand;
+        if (fInstr->opAvail & 1) {
+            // last operand is immediate
+            parm[2].q = d->immediate.q;
+            parm[4].q = d->immediateRaw.q;
+        }
+        else {
+            // read register containing last operand
+            parm[2].q = readRegister(operands[5]);
+        }
+        // read register containing first source operand
+        parm[1].q = readRegister(operands[4]);
+        // return type for debug output. may be changed by execution function
+        returnType = operandType | 0x1010;
+        return;
+    }
+    // single format, multi-format, and indirect jump instructions:
+    // get value of last operand if not a vector
+    uint8_t opAvail = fInstr->opAvail;
+    if (opAvail & 0x01) {
+        // immediate operand
+        parm[2].q = d->immediate.q;
+        parm[4].q = d->immediateRaw.q;
+    }
+    else if ((!vect || (fInstr->vect & 4)) && (opAvail & 0x02) && !dontRead) {
+        // scalar or broadcast memory operand
+        parm[2].q = readMemoryOperand(memAddress);
+    }
+    else if (!vect) {
+        // general purpose register
+        parm[2].q = readRegister(operands[5] & 0x1F);
+    }
+    // get values of remaining operands
+    if (nOperands > 1) parm[1].q = readRegister(operands[4] & 0x1F);
+    if (nOperands > 2) parm[0].q = readRegister(operands[3] & 0x1F);
+    // return type for debug output. may be changed by execution function
+    returnType = operandType | 0x10 | vect << 8;
+}
+
+// decode the parts of current instruction that do not depend on register values
+void CThread::predecode(SDecodedInstr & d) {
+    zeroAllMembers(d);
     // check for tiny instruction pair
     if ((pInstr->i[0] & 0xF0000000) == 0x70000000) {
         STinyTemplate tt;
+        d.flags = DECODED_TINY;
         if (pendingTinyInstruction) {
             // get second tiny instruction from pair
             tt.i = pInstr->i[0] >> 14;
-            pendingTinyInstruction = false;
-            if (tt.t.op1) listInstruction(ip + 1 - ip0);           // make debug listing
+            d.length = 4;                                  // next ip
+            d.listOffset = 1;
+            if (tt.t.op1) d.flags |= DECODED_LIST;
         }
         else {
             // get first tiny instruction from pair
             tt.i = pInstr->i[0];
             // remember next tiny instruction, except if it is a NOP
-            pendingTinyInstruction = (pInstr->i[0] & 0x0FFFC000) != 0;
-            listInstruction(ip - ip0);            // make debug listing
+            if ((pInstr->i[0] & 0x0FFFC000) != 0) d.flags |= DECODED_TINY_PENDING;
+            else d.length = 4;                             // next ip
+            d.flags |= DECODED_LIST;
         }
         // op code
-        op   = tt.t.op1;
-        rs   = tt.t.rs;
-
-        //!!
-        if (op == 31)
-            op += 0;
+        d.op = tt.t.op1;
+        d.rs = tt.t.rs;
 
         // find format in tables
-        uint32_t ff = lookupFormat(0x70000000 | op << 21);
-        fInstr = &formatList[ff];
+        uint32_t ff = lookupFormat(0x70000000 | d.op << 21);
+        d.format = formatList[ff];
+        d.formatIndex = (uint8_t)ff;
         // find operands
-        nOperands = numOperands[fInstr->exeTable][op];
-        noVectorLength = (nOperands & 0x10) != 0;              // bit 4: vector length determined by execution function
-        dontRead       = (nOperands & 0x40) != 0;              // bit 6: don't read source operand
-        doubleStep = false;
-        nOperands &= 0x7;                                      // bit 0-2: number of operands
-        operandType = fInstr->ot & 7;
-        if (fInstr->ot == 0x35) operandType = 5 + (op & 1);
-        vect = fInstr->vect != 0;
-        operands[0] = operands[4] = tt.t.rd;
-        operands[5] = tt.t.rs;
-        if (fInstr->immSize) {
-            operands[5] = 0x20;   // operand is immediate
-            parm[2].q = tt.t.rs;
-        }
-        if (fInstr->mem) operands[5] = 0x40;       // operand is memory. 
-        operands[1] = 0xFF;   // no mask
-        if (!pendingTinyInstruction) ip += 4;  // next ip
-        returnType = operandType | 0x10 | vect << 8;
+        uint8_t nOp = numOperands[d.format.exeTable][d.op];
+        if (nOp & 0x10) d.flags |= DECODED_NO_VECLENGTH;   // bit 4: vector length determined by execution function
+        if (nOp & 0x40) d.flags |= DECODED_DONT_READ;      // bit 6: don't read source operand
+        d.nOperands = nOp & 0x7;                           // bit 0-2: number of operands
+        d.operandType = d.format.ot & 7;
+        if (d.format.ot == 0x35) d.operandType = 5 + (d.op & 1);
+        d.vect = d.format.vect != 0;
+        d.operands[0] = d.operands[4] = tt.t.rd;
+        d.operands[5] = tt.t.rs;
+        if (d.format.immSize) {
+            d.operands[5] = 0x20;   // operand is immediate
+            d.immediate.q = tt.t.rs;
+        }
+        if (d.format.mem) d.operands[5] = 0x40;           // operand is memory. 
+        d.operands[1] = 0xFF;   // no mask
+        d.function = metaFunctionTable[d.format.exeTable][d.op];
+        if (!d.vect && !d.format.mem && d.function) d.handler = DECODED_HANDLER_SCALAR;
         return;
     }
     // all other formats than tiny:
-    listInstruction(ip - ip0);            // make debug listing
+    d.flags = DECODED_LIST;
     // decoding similar to CDisassembler::parseInstruction()
-    op = pInstr->a.op1;
-    rs = pInstr->a.rs;
+    d.op = pInstr->a.op1;
+    d.rs = pInstr->a.rs;
 
     // Get format
     uint32_t format = (pInstr->a.il << 8) + (pInstr->a.mode << 4); // Construct format = (il,mode,submode)
@@ -432,10 +935,10 @@ void CThread::decode() {
         format += pInstr->a.mode2;
         break;
     case 0x250: case 0x310:  // Submode for jump instructions etc.
-        if (op < 8) {
-            format += op;  
-            if (format == 0x254) op = 63;                  // format 254 has no OPJ
-            else op = pInstr->b[0] & 0x3F;
+        if (d.op < 8) {
+            format += d.op;  
+            if (format == 0x254) d.op = 63;                // format 254 has no OPJ
+            else d.op = pInstr->b[0] & 0x3F;
         }
         else {
             format += 8;
@@ -444,130 +947,144 @@ void CThread::decode() {
     }
 
     // Look up format details (lookupFormat() is in emulator2.cpp)
-    fInstr = &formatList[lookupFormat(pInstr->q)];
-    format = fInstr->format2;                              // Include subformat depending on op1
-    if (fInstr->tmpl == 0xE && pInstr->a.op2) {
+    d.formatIndex = (uint8_t)lookupFormat(pInstr->q);
+    d.format = formatList[d.formatIndex];
+    format = d.format.format2;                             // Include subformat depending on op1
+    uint8_t nOp;                                           // number of operands and flag bits
+    if (d.format.tmpl == 0xE && pInstr->a.op2) {
         // Single format instruction if op2 != 0 in E template
-        static SFormat form;                               // don't initialize static object.
-        form = *fInstr;                                    // copy format record
-        form.cat = 1;                                      // change category
-        fInstr = &form;                                    // point to static object
-        if (format == 0x207 && pInstr->a.op2 == 1) nOperands = numOperands2071[op]; // table for format 2.0.7
-        else if (format == 0x226 && pInstr->a.op2 == 1) nOperands = numOperands2261[op]; // table for format 2.2.6
-        else if (format == 0x227 && pInstr->a.op2 == 1) nOperands = numOperands2271[op]; // table for format 2.2.7
-        else nOperands = 0xB;                              // default value when there is no table
+        d.format.cat = 1;                                  // change category
+        if (format == 0x207 && pInstr->a.op2 == 1) nOp = numOperands2071[d.op]; // table for format 2.0.7
+        else if (format == 0x226 && pInstr->a.op2 == 1) nOp = numOperands2261[d.op]; // table for format 2.2.6
+        else if (format == 0x227 && pInstr->a.op2 == 1) nOp = numOperands2271[d.op]; // table for format 2.2.7
+        else nOp = 0xB;                                    // default value when there is no table
     }
     else {    
-        nOperands = numOperands[fInstr->exeTable][op];     // number of source operands (see bit definitions in emulator2.cpp)
+        nOp = numOperands[d.format.exeTable][d.op];        // number of source operands (see bit definitions in emulator2.cpp)
     }
 
-    ignoreMask     = (nOperands & 0x08) != 0;              // bit 3: ignore mask
-    noVectorLength = (nOperands & 0x10) != 0;              // bit 4: vector length determined by execution function
-    doubleStep     = (nOperands & 0x20) != 0;              // bit 5: take double steps
-    dontRead       = (nOperands & 0x40) != 0;              // bit 6: don't read source operand
-    nOperands &= 0x7;                                      // bit 0-2: number of operands
+    if (nOp & 0x08) d.flags |= DECODED_IGNORE_MASK;        // bit 3: ignore mask
+    if (nOp & 0x10) d.flags |= DECODED_NO_VECLENGTH;       // bit 4: vector length determined by execution function
+    if (nOp & 0x20) d.flags |= DECODED_DOUBLE_STEP;        // bit 5: take double steps
+    if (nOp & 0x40) d.flags |= DECODED_DONT_READ;          // bit 6: don't read source operand
+    d.nOperands = nOp & 0x7;                               // bit 0-2: number of operands
 
     // Get operand type
-    if (fInstr->ot == 0) {                                 // Operand type determined by OT field
-        operandType = pInstr->a.ot;                        // Operand type
-        if (!(pInstr->a.mode & 6) && !(fInstr->vect & 0x11)) {
+    if (d.format.ot == 0) {                                // Operand type determined by OT field
+        d.operandType = pInstr->a.ot;                      // Operand type
+        if (!(pInstr->a.mode & 6) && !(d.format.vect & 0x11)) {
             // Check use of M bit
-            format |= (operandType & 4) << 5;              // Add M bit to format
-            operandType &= ~4;                             // Remove M bit from operand type
+            format |= (d.operandType & 4) << 5;            // Add M bit to format
+            d.operandType &= ~4;                           // Remove M bit from operand type
         }
     }
-    else if ((fInstr->ot & 0xF0) == 0x10) {                // Operand type fixed. Value in formatList
-        operandType = fInstr->ot & 7;
+    else if ((d.format.ot & 0xF0) == 0x10) {               // Operand type fixed. Value in formatList
+        d.operandType = d.format.ot & 7;
     }
-    else if (fInstr->ot == 0x32) {                         // int32 for even op1, int64 for odd op1
-        operandType = 2 + (pInstr->a.op1 & 1);
+    else if (d.format.ot == 0x32) {                        // int32 for even op1, int64 for odd op1
+        d.operandType = 2 + (pInstr->a.op1 & 1);
     }
-    else if (fInstr->ot == 0x35) {                         // Float for even op1, double for odd op1
-        operandType = 5 + (pInstr->a.op1 & 1);
+    else if (d.format.ot == 0x35) {                        // Float for even op1, double for odd op1
+        d.operandType = 5 + (pInstr->a.op1 & 1);
     }
     else {
-        operandType = 0;                                   // Error in formatList. Should not occur
+        d.operandType = 0;                                 // Error in formatList. Should not occur
     }
 
     // Find instruction length
     uint8_t instrLength = lengthList[pInstr->i[0] >> 29];  // Length up to 3 determined by il. Length 4 by upper bit of mode
-    ip += instrLength * 4;  // next ip
+    d.length = instrLength * 4;
 
-    // get address of memory operand
-    if (fInstr->mem & 0x7F) memAddress = getMemoryAddress();
+    // find execution function
+    if (d.format.exeTable == 0) {
+        d.function = 0;
+    }
+    else if (d.format.tmpl == 0xE && pInstr->a.op2 != 0) {  // single format instruction with E template
+        uint8_t index; // index into EDispatchTable
+        // bit 0-2 = mode2
+        // bit   3 = mode bit 1
+        // bit   4 = il bit 0
+        // bit 5-6 = op2 - 1
+        index = pInstr->a.mode2 | (pInstr->a.mode << 2 & 8) | (pInstr->a.il << 4 & 0x10) | (pInstr->a.op2 - 1) << 5;
+        d.function = EDispatchTable[index];
+    }
+    else {  // all other instructions. exeTable indicates which function table to look into  
+        d.function = metaFunctionTable[d.format.exeTable][d.op];
+    }
 
     // find operands
-    if (fInstr->cat == 4 && (fInstr->mem & 0x80)) {
+    if (d.format.cat == 4 && (d.format.mem & 0x80)) {
         // jump instruction with self-relative jump address
         // check if it uses vector registers
-        vect = (fInstr->vect & 0x10) && (pInstr->a.ot & 4);
+        d.vect = (d.format.vect & 0x10) && (pInstr->a.ot & 4);
         // pointer to address field
-        const uint8_t * pa = &pInstr->b[0] + fInstr->addrPos;
+        const uint8_t * pa = &pInstr->b[0] + d.format.addrPos;
         // store relative address in addrOperand
-        switch (fInstr->addrSize) {
+        switch (d.format.addrSize) {
         case 1:    // sign extend 8-bit offset
-            addrOperand = *(int8_t*)pa;
+            d.addrOperand = *(int8_t*)pa;
             break;
         case 2:    // sign extend 16-bit offset
-            addrOperand = *(int16_t*)pa;
+            d.addrOperand = *(int16_t*)pa;
             break;
         case 3:    // sign extend 24-bit offset
-            addrOperand = *(int32_t*)pa << 8 >> 8;
+            d.addrOperand = *(int32_t*)pa << 8 >> 8;
             break;
         case 4:    // sign extend 32-bit offset
-            addrOperand = *(int32_t*)pa;
+            d.addrOperand = *(int32_t*)pa;
             break;
         case 8:    // 64-bit offset
-            addrOperand = *(int64_t*)pa;
+            d.addrOperand = *(int64_t*)pa;
             break;
         default:
-            addrOperand = 0;
+            d.addrOperand = 0;
             err.submit(ERR_INTERNAL);
         }
         // pointer to immediate field
-        const uint8_t * pi = &pInstr->b[0] + fInstr->immPos;
+        const uint8_t * pi = &pInstr->b[0] + d.format.immPos;
         // get immediate operand or last register operand
-        if (fInstr->opAvail & 1) {
+        if (d.format.opAvail & 1) {
             // last operand is immediate. sign extend or convert it into parm[2]
-            switch (fInstr->immSize) {
+            switch (d.format.immSize) {
             case 1:
-                parm[2].qs = parm[4].qs = *(int8_t*)pi;              // sign extend
-                if (pInstr->a.ot == 5) parm[2].f = parm[4].bs;       // convert to float
-                if (pInstr->a.ot == 6) parm[2].d = parm[4].bs;       // convert to double
+                d.immediate.qs = d.immediateRaw.qs = *(int8_t*)pi;       // sign extend
+                if (pInstr->a.ot == 5) d.immediate.f = d.immediateRaw.bs; // convert to float
+                if (pInstr->a.ot == 6) d.immediate.d = d.immediateRaw.bs; // convert to double
                 break;
             case 2:
-                parm[2].qs = parm[4].qs = *(int16_t*)pi;             // sign extend
-                if (pInstr->a.ot == 5) parm[2].f = half2float(*(uint16_t*)pi); // convert from half precision
-                if (pInstr->a.ot == 6) parm[2].d = half2float(*(uint16_t*)pi); // convert from half precision
+                d.immediate.qs = d.immediateRaw.qs = *(int16_t*)pi;      // sign extend
+                if (pInstr->a.ot == 5) d.immediate.f = half2float(*(uint16_t*)pi); // convert from half precision
+                if (pInstr->a.ot == 6) d.immediate.d = half2float(*(uint16_t*)pi); // convert from half precision
                 break;
             case 4:
-                parm[2].qs = parm[4].qs = *(int32_t*)pi;             // sign extend
-                if (pInstr->a.ot == 6) parm[2].d = *(float*)pi;      // convert to double
+                d.immediate.qs = d.immediateRaw.qs = *(int32_t*)pi;      // sign extend
+                if (pInstr->a.ot == 6) d.immediate.d = *(float*)pi;      // convert to double
                 break;
             case 8:
-                parm[2].qs = parm[4].qs = *(int64_t*)pi;  break;     // just copy
+                d.immediate.qs = d.immediateRaw.qs = *(int64_t*)pi;  break; // just copy
             default:
                 err.submit(ERR_INTERNAL);
             }
-            operands[5] = 0x20;
+            d.operands[5] = 0x20;
             // first source operand
-            if (fInstr->opAvail & 0x20) operands[4] = pInstr->a.rs;
-            else operands[4] = pInstr->a.rd;
+            if (d.format.opAvail & 0x20) d.operands[4] = pInstr->a.rs;
+            else d.operands[4] = pInstr->a.rd;
         }
         else {
             // last source operand is a register
-            if (fInstr->opAvail & 0x20) operands[5] = pInstr->a.rs;
-            else operands[5] = pInstr->a.rd;
-            operands[4] = pInstr->a.rd;
-            // read register containing last operand
-            parm[2].q = readRegister(operands[5]);
+            if (d.format.opAvail & 0x20) d.operands[5] = pInstr->a.rs;
+            else d.operands[5] = pInstr->a.rd;
+            d.operands[4] = pInstr->a.rd;
+        }
+        d.operands[0] = pInstr->a.rd;                       // destination
+        d.operands[1] = 0xFF;                               // no mask
+        if (!d.vect && !(d.format.mem & 0x7F) && d.function) {
+            d.handler = DECODED_HANDLER_JUMP;
+            // funcTab3[32] = compare_jump_generic
+            if (d.function == funcTab3[32] && d.operandType < 4 && (d.op & 0xE) <= 8) {
+                d.handler = DECODED_HANDLER_COMPARE_JUMP;  // integer compare and jump without mask
+            }
         }
-        operands[0] = pInstr->a.rd;                         // destination
-        operands[1] = 0xFF;                                 // no mask
-        // read register containing first source operand
-        parm[1].q = readRegister(operands[4]);
-        // return type for debug output. may be changed by execution function
-        returnType = operandType | 0x1010;
         return;
     }
     // single format, multi-format, and indirect jump instructions:
@@ -575,125 +1092,104 @@ void CThread::decode() {
     // Make list of operands from available operands.
     // The operands[] array must have 6 elements to avoid overflow here,
     // even if some elements are later overwritten and used for other purposes
-    uint8_t opAvail = fInstr->opAvail;    // Bit index of available operands
+    uint8_t opAvail = d.format.opAvail;   // Bit index of available operands
     // opAvail bits: 1 = immediate, 2 = memory,
     // 0x10 = RT, 0x20 = RS, 0x40 = RU, 0x80 = RD 
     int j = 5;
-    if (opAvail & 0x01) operands[j--] = 0x20;           // immediate operand
-    if (opAvail & 0x02) operands[j--] = 0x40;           // memory operand
-    if (opAvail & 0x10) operands[j--] = pInstr->a.rt;   // register RT
-    if (opAvail & 0x20) operands[j--] = pInstr->a.rs;   // register RS
-    if (opAvail & 0x40) operands[j--] = pInstr->a.ru;   // register RU
-    if (opAvail & 0x80) operands[j--] = pInstr->a.rd;   // register RD
-    operands[0] = pInstr->a.rd;                         // destination
+    if (opAvail & 0x01) d.operands[j--] = 0x20;         // immediate operand
+    if (opAvail & 0x02) d.operands[j--] = 0x40;         // memory operand
+    if (opAvail & 0x10) d.operands[j--] = pInstr->a.rt; // register RT
+    if (opAvail & 0x20) d.operands[j--] = pInstr->a.rs; // register RS
+    if (opAvail & 0x40) d.operands[j--] = pInstr->a.ru; // register RU
+    if (opAvail & 0x80) d.operands[j--] = pInstr->a.rd; // register RD
+    d.operands[0] = pInstr->a.rd;                       // destination
 
     // find mask register
-    if (fInstr->tmpl == 0xA || fInstr->tmpl == 0xE) {
-        operands[1] = pInstr->a.mask;
+    if (d.format.tmpl == 0xA || d.format.tmpl == 0xE) {
+        d.operands[1] = pInstr->a.mask;
         // find fallback register
-        if (nOperands >= 3) operands[2] = operands[3];     // three operands: use first operand
-        else if (j < 3) operands[2] = operands[j+2];       // two or one operands: use last vacant operand
-        else operands[2] = operands[4];                    // no vacant operand: use first operand
+        if (d.nOperands >= 3) d.operands[2] = d.operands[3]; // three operands: use first operand
+        else if (j < 3) d.operands[2] = d.operands[j+2];   // two or one operands: use last vacant operand
+        else d.operands[2] = d.operands[4];                // no vacant operand: use first operand
     }
     else {
-        operands[1] = operands[2] = 0xFF;                  // no mask, no fallback
+        d.operands[1] = d.operands[2] = 0xFF;              // no mask, no fallback
     }
 
     // determine if vector registers are used
-    vect = (fInstr->vect & 1) || ((fInstr->vect & 0x10) && (pInstr->a.ot & 4));
+    d.vect = (d.format.vect & 1) || ((d.format.vect & 0x10) && (pInstr->a.ot & 4));
 
-    // get value of last operand if not a vector
+    // get value of immediate operand
     if (opAvail & 0x01) {
         // pointer to immediate field
-        const uint8_t * pi = &pInstr->b[0] + fInstr->immPos;
+        const uint8_t * pi = &pInstr->b[0] + d.format.immPos;
+        SNum imm;
         // get value, sign extended
-        switch (fInstr->immSize) {
+        switch (d.format.immSize) {
         case 1:
-            parm[2].qs = *(int8_t*)pi;
+            imm.qs = *(int8_t*)pi;
             break;
         case 2:
-            parm[2].qs = *(int16_t*)pi;
+            imm.qs = *(int16_t*)pi;
             break;
         case 4:
-            parm[2].qs = *(int32_t*)pi;
+            imm.qs = *(int32_t*)pi;
             break;
         case 8:
-            parm[2].qs = *(uint64_t*)pi;
+            imm.qs = *(uint64_t*)pi;
             break;
         case 14:  // 4 bits
-            parm[2].q = *(uint8_t*)pi & 0xF;
+            imm.q = *(uint8_t*)pi & 0xF;
             break;
         default:
+            imm.q = 0;
             err.submit(ERR_INTERNAL);
         }
         // extend, shift, or convert
-        parm[4].q = parm[2].q;                             // preserve original value
-        switch (operandType) {
+        d.immediateRaw.q = imm.q;                          // preserve original value
+        switch (d.operandType) {
         case 5:  // float
-            if (fInstr->immSize == 1) { // convert integer
-                parm[2].f = (float)(int8_t)parm[2].b;
+            if (d.format.immSize == 1) { // convert integer
+                imm.f = (float)(int8_t)imm.b;
             }
-            else if (fInstr->immSize == 2) { // convert half precision
-                parm[2].f = half2float(parm[2].i);
+            else if (d.format.immSize == 2) { // convert half precision
+                imm.f = half2float(imm.i);
             }
             break;
         case 6:  // double precision
-            if (fInstr->immSize == 1) { // convert integer
-                parm[2].d = (double)(int8_t)parm[2].b;
+            if (d.format.immSize == 1) { // convert integer
+                imm.d = (double)(int8_t)imm.b;
             }
-            else if (fInstr->immSize == 2) { // convert half precision
-                parm[2].d = half2float(parm[2].i);
+            else if (d.format.immSize == 2) { // convert half precision
+                imm.d = half2float(imm.i);
             }
-            else if (fInstr->immSize == 4) { // convert single precision
-                parm[2].d = parm[2].f;
+            else if (d.format.immSize == 4) { // convert single precision
+                imm.d = imm.f;
             }
             break;
         case 7:  // quadruple precision
             // todo
             break;
         default: // all integer types. shift value if needed
-            if (fInstr->imm2 & 4) parm[2].q <<= pInstr->a.im3;
-            else if (fInstr->imm2 & 8) parm[2].q <<= pInstr->a.im2;
+            if (d.format.imm2 & 4) imm.q <<= pInstr->a.im3;
+            else if (d.format.imm2 & 8) imm.q <<= pInstr->a.im2;
         }
+        d.immediate.q = imm.q;
     }
-    else if ((!vect || (fInstr->vect & 4)) && (opAvail & 0x02) && !dontRead) {
-        // scalar or broadcast memory operand
-        if (!dontRead) parm[2].q = readMemoryOperand(memAddress);
-    }
-    else if (!vect) {
-        // general purpose register
-        parm[2].q = readRegister(operands[5] & 0x1F);
+    // scalar instructions without mask and memory operand can use the fast handler
+    if (!d.vect && !(d.format.mem & 0x7F) && !(opAvail & 0x02) && (d.operands[1] & 7) == 7 && d.function) {
+        d.handler = DECODED_HANDLER_SCALAR;
     }
-    // get values of remaining operands
-    if (nOperands > 1) parm[1].q = readRegister(operands[4] & 0x1F);
-    if (nOperands > 2) parm[0].q = readRegister(operands[3] & 0x1F);
-    // return type for debug output. may be changed by execution function
-    returnType = operandType | 0x10 | vect << 8;
 }
 
 
 // execute current instruction
 void CThread::execute() {
     uint64_t result = 0;                         // destination value
-    PFunc functionPointer = 0;                   // pointer to execution function
+    uint64_t ipNext = ip;                        // next instruction if no jump
     running = 1;
 
-    // find function pionter
-    if (fInstr->exeTable == 0) {
-        interrupt(INT_UNKNOWN_INST);  return;
-    }
-    if (fInstr->tmpl == 0xE && pInstr->a.op2 != 0) {  // single format instruction with E template
-        uint8_t index; // index into EDispatchTable
-        // bit 0-2 = mode2
-        // bit   3 = mode bit 1
-        // bit   4 = il bit 0
-        // bit 5-6 = op2 - 1
-        index = pInstr->a.mode2 | (pInstr->a.mode << 2 & 8) | (pInstr->a.il << 4 & 0x10) | (pInstr->a.op2 - 1) << 5;
-        functionPointer = EDispatchTable[index];
-    }
-    else {  // all other instructions. fInstr->exeTable indicates which function table to look into  
-        functionPointer = metaFunctionTable[fInstr->exeTable][op];
-    }
+    // function pointer has been found by decode()
     if (!functionPointer || !fInstr->exeTable) {
         interrupt(INT_UNKNOWN_INST);
         return;
@@ -732,12 +1228,17 @@ void CThread::execute() {
         if (!noVectorLength) {        
             vectorLength[operands[0]] = vectorLengthR;
         }
+        perf.vectorInstructions++;
+        perf.vectorElements += vectorLengthR / elementSize;
 
         // last operand type
         uint8_t lastOpType = 2; // 0: broadcast immediate or memory, 1: memory vector, 2: vector register
         if ((fInstr->opAvail & 2) && !(fInstr->vect & 4)) lastOpType = 1;
         if ((fInstr->opAvail & 1) || ((fInstr->opAvail & 2) && (fInstr->vect & 4))) lastOpType = 0;
 
+        // common instructions are done on the whole vector at once
+        if (!listFileName && executeVectorKernel(lastOpType)) return;
+
         // loop through vector
         vect = 1;
         for (vectorOffset = 0; vectorOffset < vectorLengthR; vectorOffset += elementSize) {
@@ -788,6 +1289,7 @@ void CThread::execute() {
             vect ^= 3;                                     // toggle between 1 for even elements, 2 for odd
             if (doubleStep) vectorOffset += elementSize;   // skip next element if instruction takes two elements at a time            
         }
+        if (fInstr->cat == 4 && ip != ipNext) perf.jumpsTaken++;
         listResult(result);                                // debug output
     }
     else {
@@ -811,11 +1313,296 @@ void CThread::execute() {
         // get mask for operand size (operandType may have been changed by function)
         // store in destination register, zero extended from operand size
         if (running & 1) registers[operands[0]] = result & dataSizeMask[operandType];
+        if (fInstr->cat == 4 && ip != ipNext) perf.jumpsTaken++;
         listResult(result);                                // debug output
     }
 }
 
 
+// run with threaded dispatch of pre-decoded instructions.
+// Instructions are taken from the decode cache and dispatched to a handler chosen by predecode().
+// Scalar instructions without mask and memory operand bypass the vector, mask and
+// vector length logic of execute(). Everything else goes through loadDecoded() and execute().
+// With option -emu=blocks, the instructions of a basic block are executed in sequence
+// without looking up each instruction, and common instruction pairs are fused
+void CThread::runThreaded() {
+    SDecodedInstr * d;                           // current pre-decoded instruction
+    SDecodedInstr * next = 0;                    // next instruction in current basic block
+    SDecodedInstr * blockEnd = 0;                // end of current basic block
+    uint64_t blockIp = 0;                        // address of current basic block
+    uint32_t index;                              // index+1 into decodeCache or blockList
+    uint64_t result;                             // destination value
+    SNum a, b;                                   // operands for compare
+    uint8_t branch;                              // jump condition
+    bool useBlocks = (cmd.emulateOptions & CMDL_EMU_BLOCKS) != 0;
+    bool jitVerifyMode = (cmd.emulateOptions & CMDL_EMU_JIT_VERIFY) != 0;
+    const uint32_t jitHotCount = 16;             // compile basic block when it has been executed this many times
+    SJitSegment * segment;                       // native code sequence
+    uint8_t handler;                             // handler to use
+    uint64_t ipNext;                             // next instruction if no jump
+#if defined(__GNUC__)
+    // computed goto. indexed by DECODED_HANDLER_*
+    static void * const handlerLabels[6] = {&&handlerGeneric, &&handlerScalar, &&handlerJump, &&handlerCompareJump, &&handlerAddCompareJump, &&handlerJit};
+#endif
+    std::atomic<bool> & stop = emulator->stopAllThreads;   // another thread has ended the program
+    std::atomic<uint32_t> & generation = emulator->codeGeneration; // changed when code is modified
+    std::atomic<uint32_t> & mapChanged = emulator->mapGeneration;  // changed when a file is mapped into memory
+    running = 1;  terminate = false;
+    while (running && !terminate && !stop.load(std::memory_order_relaxed)) {
+        if (codeModified || generation.load(std::memory_order_acquire) != codeGeneration) checkCodeGeneration();
+        if (mapChanged.load(std::memory_order_acquire) != mapGeneration) checkMapGeneration();
+        if (jitVerifyCount && --jitVerifyCount == 0) {
+            // the interpreter has finished a sequence that was also run as native code
+            jitVerify();
+            if (terminate) break;
+        }
+        if (next < blockEnd && !blockBreak && ip == blockIp + next->blockOffset) {
+            // continue in current basic block
+            d = next++;
+        }
+        else {
+            blockEnd = 0;
+            if (ip - decodeStart >= decodeEnd - decodeStart || (ip & 3)
+            || (index = decodeIndex[uint32_t((ip - decodeStart) >> 1) + pendingTinyInstruction]) == 0) {
+                // first time or outside code range: standard path. This checks execute permission and fills the decode cache
+                fetch();                         // fetch next instruction
+                if (terminate) break;
+                decode();                        // decode instruction
+                if (terminate) break;
+                execute();                       // execute instruction
+                continue;
+            }
+            d = &decodeCache[index - 1];
+            if (useBlocks && !pendingTinyInstruction) {
+                // find or make basic block starting here
+                index = blockIndex[uint32_t((ip - decodeStart) >> 2)];
+                if (index == 0) index = makeBasicBlock();
+                if (index) {
+                    SBasicBlock & block = blockList[index - 1];
+                    if (++block.count == jitHotCount && (cmd.emulateOptions & CMDL_EMU_JIT)) {
+                        jitCompileBlock(block, ip);  // hot block. compile to native code
+                    }
+                    d = &blockCode[block.first];
+                    next = d + 1;
+                    blockEnd = d + block.num;
+                    blockIp = ip;
+                    blockBreak = false;
+                }
+            }
+        }
+        pInstr = (STemplate const *)(memory + ip);
+        handler = d->handler;
+    dispatch:
+#if defined(__GNUC__)
+        goto *handlerLabels[handler];
+#else
+        switch (handler) {
+        case DECODED_HANDLER_SCALAR:       goto handlerScalar;
+        case DECODED_HANDLER_JUMP:         goto handlerJump;
+        case DECODED_HANDLER_COMPARE_JUMP: goto handlerCompareJump;
+        case DECODED_HANDLER_ADD_COMPARE_JUMP: goto handlerAddCompareJump;
+        case DECODED_HANDLER_JIT:          goto handlerJit;
+        default:                           goto handlerGeneric;
+        }
+#endif
+
+    handlerJit:
+        // sequence of instructions compiled to native code
+        segment = &jitSegments[d->jitSegment - 1];
+        handler = segment->handler;
+        if ((numContr & (MSK_OVERFL_I | 1)) != 1) {
+            goto dispatch;                       // overflow check or mask needed. use interpreter
+        }
+        if (jitVerifyMode) {
+            // run native code, then restore registers and let the interpreter do the same instructions
+            memcpy(jitSaved, registers, sizeof(jitSaved));
+            jitExpectedIp = ((PJitCode)(jitBuffer + segment->codeOffset))(registers);
+            memcpy(jitExpected, registers, sizeof(jitExpected));
+            memcpy(registers, jitSaved, sizeof(jitSaved));
+            jitVerifyIp = ip;
+            jitVerifyCount = segment->num;
+            goto dispatch;
+        }
+        ip = ((PJitCode)(jitBuffer + segment->codeOffset))(registers);
+        segment->count++;                        // instructions are added to performance counters later
+        if (segment->endsWithJump && ip != segment->ipNext) perf.jumpsTaken++;
+        pendingTinyInstruction = false;          // a sequence never ends between two tiny instructions
+        next = d + segment->num;
+        continue;
+
+    handlerAddCompareJump:
+        // add immediate, followed by integer compare and jump. next instruction is the compare
+        if ((numContr & (MSK_OVERFL_I | 1)) != 1 || next >= blockEnd || jitVerifyCount == 1) {
+            goto handlerScalar;                  // overflow check or mask needed. do one instruction at a time
+        }
+        if (jitVerifyCount) jitVerifyCount--;    // two instructions done here
+        perfCount(d);
+        registers[d->operands[0]] = (registers[d->operands[4] & 0x1F] + d->immediate.q) & dataSizeMask[d->operandType];
+        ip += d->length;
+        d = next++;
+        goto compareJump;
+
+    handlerCompareJump:
+        // integer compare and conditional jump. same as compare_jump_generic() in emulator3.cpp
+        if ((numContr & 1) == 0) goto handlerJump;  // masked off by numContr. do the general way
+    compareJump:
+        perfCount(d);
+        ip += d->length;
+        a.q = registers[d->operands[4] & 0x1F] & dataSizeMask[d->operandType];
+        if (d->format.opAvail & 1) b.q = d->immediate.q & dataSizeMask[d->operandType];
+        else b.q = registers[d->operands[5] & 0x1F] & dataSizeMask[d->operandType];
+        switch (d->op & 0xE) {
+        case 0:  // jump if equal
+            branch = a.q == b.q;  break;
+        case 2:  // jump if signed below
+            a.q ^= (dataSizeMask[d->operandType] >> 1) + 1;  b.q ^= (dataSizeMask[d->operandType] >> 1) + 1;
+            branch = a.q < b.q;  break;
+        case 4:  // jump if signed above
+            a.q ^= (dataSizeMask[d->operandType] >> 1) + 1;  b.q ^= (dataSizeMask[d->operandType] >> 1) + 1;
+            branch = a.q > b.q;  break;
+        case 6:  // jump if unsigned below
+            branch = a.q < b.q;  break;
+        default: // jump if unsigned above
+            branch = a.q > b.q;  break;
+        }
+        if ((branch ^ d->op) & 1) {
+            ip += d->addrOperand * 4;
+            perf.jumpsTaken++;
+        }
+        continue;
+
+    handlerScalar:
+        // general purpose registers and immediate operand only
+        perfCount(d);
+        formatCopy = d->format;
+        fInstr = &formatCopy;
+        op = d->op;
+        rs = d->rs;
+        operandType = d->operandType;
+        nOperands = d->nOperands;
+        vect = 0;
+        ignoreMask = (d->flags & DECODED_IGNORE_MASK) != 0;
+        noVectorLength = (d->flags & DECODED_NO_VECLENGTH) != 0;
+        doubleStep = (d->flags & DECODED_DOUBLE_STEP) != 0;
+        dontRead = (d->flags & DECODED_DONT_READ) != 0;
+        memcpy(operands, d->operands, sizeof(operands));
+        if (d->flags & DECODED_TINY) {
+            // tiny instruction functions read their register operands themselves
+            pendingTinyInstruction = (d->flags & DECODED_TINY_PENDING) != 0;
+            if (fInstr->immSize) parm[2].q = d->immediate.q;
+            ip += d->length;
+            ipNext = ip;
+            returnType = operandType | 0x10;
+            goto executeScalar;
+        }
+        if (operands[5] & 0x20) {                // immediate operand
+            parm[2].q = d->immediate.q;
+            parm[4].q = d->immediateRaw.q;
+        }
+        else parm[2].q = registers[operands[5] & 0x1F];
+        ip += d->length;
+        ipNext = ip;
+        if (nOperands > 1) parm[1].q = registers[operands[4] & 0x1F];
+        if (nOperands > 2) parm[0].q = registers[operands[3] & 0x1F];
+        returnType = operandType | 0x10;
+        goto executeScalar;
+
+    handlerJump:
+        // jump with self-relative address
+        perfCount(d);
+        formatCopy = d->format;
+        fInstr = &formatCopy;
+        op = d->op;
+        rs = d->rs;
+        operandType = d->operandType;
+        nOperands = d->nOperands;
+        vect = 0;
+        ignoreMask = (d->flags & DECODED_IGNORE_MASK) != 0;
+        noVectorLength = (d->flags & DECODED_NO_VECLENGTH) != 0;
+        doubleStep = (d->flags & DECODED_DOUBLE_STEP) != 0;
+        dontRead = (d->flags & DECODED_DONT_READ) != 0;
+        memcpy(operands, d->operands, sizeof(operands));
+        ip += d->length;
+        ipNext = ip;
+        addrOperand = d->addrOperand;
+        if (fInstr->opAvail & 1) {
+            parm[2].q = d->immediate.q;
+            parm[4].q = d->immediateRaw.q;
+        }
+        else parm[2].q = registers[operands[5] & 0x1F];
+        parm[1].q = registers[operands[4] & 0x1F];
+        returnType = operandType | 0x1010;
+
+    executeScalar:
+        // same as the general purpose register part of execute()
+        running = 1;
+        parm[3].q = numContr;                    // no mask
+        if ((numContr & 1) == 0 && !ignoreMask) {
+            // result is masked off. find fallback
+            if ((operands[2] & 0x1F) == 0x1F) result = 0;
+            else result = registers[operands[2] & 0x1F];
+        }
+        else {
+            result = (*d->function)(this);
+        }
+        if (running & 1) registers[operands[0]] = result & dataSizeMask[operandType];
+        if (ip != ipNext && fInstr->cat == 4) perf.jumpsTaken++;
+        continue;
+
+    handlerGeneric:
+        // all other instructions
+        loadDecoded(d);
+        if (terminate) break;
+        execute();
+    }
+}
+
+// translate basic block starting at ip.
+// The instructions must be in the decode cache already, which means that execute
+// permission has been checked. The block ends after a jump, call, return or system call,
+// before an instruction that has not been decoded yet, or at a maximum length.
+// Returns index+1 into blockList, or 0 if no block could be made
+uint32_t CThread::makeBasicBlock() {
+    const uint32_t maxBlockLength = 256;         // maximum number of instructions in a block
+    SBasicBlock block;
+    block.first = blockCode.numEntries();
+    block.num = 0;
+    block.count = 0;
+    uint64_t address = ip;                       // address of current instruction
+    bool pending = false;                        // second of a pair of tiny instructions
+    while (address < decodeEnd && block.num < maxBlockLength) {
+        uint32_t index = decodeIndex[uint32_t((address - decodeStart) >> 1) + pending];
+        if (index == 0) break;                   // not decoded yet
+        SDecodedInstr instr = decodeCache[index - 1];
+        if (instr.function == 0) break;          // unknown instruction. leave it to the standard path
+        instr.blockOffset = uint32_t(address - ip);
+        blockCode.push(instr);
+        block.num++;
+        pending = (instr.flags & DECODED_TINY_PENDING) != 0;
+        address += instr.length;
+        if (instr.format.cat == 4) break;        // control transfer ends block
+    }
+    if (pending) {
+        // don't end block between two tiny instructions
+        blockCode.pop();  block.num--;
+    }
+    if (block.num == 0) return 0;
+
+    // fuse add immediate with a following integer compare and jump
+    for (uint32_t i = block.first; i + 1 < block.first + block.num; i++) {
+        SDecodedInstr & d = blockCode[i];
+        if (d.handler == DECODED_HANDLER_SCALAR && d.function == funcTab2[II_ADD] && !(d.flags & DECODED_TINY)
+        && d.operandType < 4 && d.nOperands == 2 && d.operands[5] == 0x20
+        && blockCode[i+1].handler == DECODED_HANDLER_COMPARE_JUMP) {
+            d.handler = DECODED_HANDLER_ADD_COMPARE_JUMP;
+        }
+    }
+    uint32_t blockNum = blockList.push(block);
+    blockIndex[uint32_t((ip - decodeStart) >> 2)] = blockNum + 1;
+    return blockNum + 1;
+}
+
+
 // read vector element
 uint64_t CThread::readVectorElement(uint32_t v, uint32_t vectorOffset) {
     uint32_t size;   // element size
@@ -946,36 +1733,44 @@ uint64_t CThread::getMemoryAddress() {
 
 // read a memory operand
 uint64_t CThread::readMemoryOperand(uint64_t address) {
-    // get most likely memory map index
-    uint32_t * indexp = readonly ? &mapIndex2 : &mapIndex3;
-    uint32_t index = * indexp;
+    perf.memoryReads++;
+    profileCurrent->memoryReads++;
+#ifdef CACHE_SIMULATION
+    if (cacheModel) cacheAccess(address, dataSizeTable[operandType]);
+#endif
+    // the memory map is searched only if the page access table cannot tell that access is allowed
+    if (!pageAccessible(address, dataSizeTable[operandType], SHF_READ)) {
+        // get most likely memory map index
+        uint32_t * indexp = readonly ? &mapIndex2 : &mapIndex3;
+        uint32_t index = * indexp;
 
-    // find memory map entry
-    while (address < memoryMap[index].startAddress) {
-        if (index > 0) index--;
-        else {
-            interrupt(INT_ACCESS_READ);  return 0;
+        // find memory map entry
+        while (address < memoryMap[index].startAddress) {
+            if (index > 0) index--;
+            else {
+                interrupt(INT_ACCESS_READ);  return 0;
+            }
         }
-    }
-    while (address >= memoryMap[index + 1].startAddress) {
-        if (index + 2 < memoryMap.numEntries()) index++;
-        else {
+        while (address >= memoryMap[index + 1].startAddress) {
+            if (index + 2 < memoryMap.numEntries()) index++;
+            else {
+                interrupt(INT_ACCESS_READ);  return 0;
+            }
+        }
+        // check read permission
+        if (!(memoryMap[index].access_addend & SHF_READ)) {
             interrupt(INT_ACCESS_READ);  return 0;
         }
-    }
-    // check read permission
-    if (!(memoryMap[index].access_addend & SHF_READ)) {
-        interrupt(INT_ACCESS_READ);  return 0;
-    }
 
-    // check if map boundary crossed
-    if (address + dataSizeTable[operandType] > memoryMap[index+1].startAddress
-    && !(memoryMap[index+1].access_addend & SHF_READ)) {
-        interrupt(INT_ACCESS_READ);
-    }
+        // check if map boundary crossed
+        if (address + dataSizeTable[operandType] > memoryMap[index+1].startAddress
+        && !(memoryMap[index+1].access_addend & SHF_READ)) {
+            interrupt(INT_ACCESS_READ);
+        }
 
-    // save index for next time
-    *indexp = index;
+        // save index for next time
+        *indexp = index;
+    }
 
     // get value, zero extended    
     const int8_t * p = memory + address;  // pointer to data
@@ -996,33 +1791,42 @@ uint64_t CThread::readMemoryOperand(uint64_t address) {
 
 // write a memory operand
 void CThread::writeMemoryOperand(uint64_t val, uint64_t address) {
-    // most likely memory map index is saved in mapIndex3
-    // find memory map entry
-    while (address < memoryMap[mapIndex3].startAddress) {
-        if (mapIndex3 > 0) mapIndex3--;
-        else {
-            interrupt(INT_ACCESS_WRITE);  return;
+    perf.memoryWrites++;
+    profileCurrent->memoryWrites++;
+#ifdef CACHE_SIMULATION
+    if (cacheModel) cacheAccess(address, dataSizeTable[operandType]);
+#endif
+    // the memory map is searched only if the page access table cannot tell that access is allowed
+    if (!pageAccessible(address, dataSizeTable[operandType], SHF_WRITE)) {
+        // most likely memory map index is saved in mapIndex3
+        // find memory map entry
+        while (address < memoryMap[mapIndex3].startAddress) {
+            if (mapIndex3 > 0) mapIndex3--;
+            else {
+                interrupt(INT_ACCESS_WRITE);  return;
+            }
         }
-    }
-    while (address >= memoryMap[mapIndex3+1].startAddress) {
-        if (mapIndex3 + 2 < memoryMap.numEntries()) mapIndex3++;
-        else {
+        while (address >= memoryMap[mapIndex3+1].startAddress) {
+            if (mapIndex3 + 2 < memoryMap.numEntries()) mapIndex3++;
+            else {
+                interrupt(INT_ACCESS_WRITE);  return;
+            }
+        }
+        // check write permission
+        if (!(memoryMap[mapIndex3].access_addend & SHF_WRITE)) {
             interrupt(INT_ACCESS_WRITE);  return;
         }
-    }
-    // check write permission
-    if (!(memoryMap[mapIndex3].access_addend & SHF_WRITE)) {
-        interrupt(INT_ACCESS_WRITE);  return;
-    }
 
-    // check if map boundary crossed
-    if (address + dataSizeTable[operandType] > memoryMap[mapIndex3+1].startAddress
-    && !(memoryMap[mapIndex3+1].access_addend & SHF_WRITE)) {
-        interrupt(INT_ACCESS_WRITE);
+        // check if map boundary crossed
+        if (address + dataSizeTable[operandType] > memoryMap[mapIndex3+1].startAddress
+        && !(memoryMap[mapIndex3+1].access_addend & SHF_WRITE)) {
+            interrupt(INT_ACCESS_WRITE);
+        }
     }
+    // self-modifying code must be decoded again
+    if (address < decodeEnd) invalidateDecodeCache(address, dataSizeTable[operandType]);
 
     // write value
-    // get value, zero extended    
     int8_t * p = memory + address;  // pointer to data
     switch (dataSizeTableMax8[operandType]) {
     case 0:
@@ -1042,14 +1846,129 @@ void CThread::writeMemoryOperand(uint64_t val, uint64_t address) {
     }
 }
 
+// locks for compare_swap. a lock is chosen by the 64-byte cache line address
+const uint32_t NUM_ATOMIC_LOCKS = 64;
+static std::mutex atomicLocks[NUM_ATOMIC_LOCKS];
+
+// atomic compare and exchange of a memory operand. returns the old value
+uint64_t CThread::compareSwapMemory(uint64_t address, uint64_t expected, uint64_t newValue) {
+    uint32_t size = dataSizeTable[operandType];
+    // lock the cache lines of the first and last byte. An aligned operand and an unaligned operand
+    // that overlap it must use the same lock, because the host cannot exchange the unaligned one atomically
+    uint32_t lock1 = (uint32_t)(address >> 6) % NUM_ATOMIC_LOCKS;
+    uint32_t lock2 = (uint32_t)((address + size - 1) >> 6) % NUM_ATOMIC_LOCKS;
+    if (lock1 > lock2) {uint32_t tmp = lock1; lock1 = lock2; lock2 = tmp;}  // lock in fixed order
+    std::lock_guard<std::mutex> guard1(atomicLocks[lock1]);
+    std::unique_lock<std::mutex> guard2(atomicLocks[lock2], std::defer_lock);
+    if (lock2 != lock1) guard2.lock();
+    if (size <= 8 && (address & (size - 1)) == 0
+    && pageAccessible(address, size, SHF_READ) && pageAccessible(address, size, SHF_WRITE)) {
+        // aligned and accessible. use host atomic instruction
+        perf.memoryReads++;  perf.memoryWrites++;
+        profileCurrent->memoryReads++;  profileCurrent->memoryWrites++;
+#ifdef CACHE_SIMULATION
+        if (cacheModel) {
+            cacheAccess(address, size);  cacheAccess(address, size);
+        }
+#endif
+        if (address < decodeEnd) invalidateDecodeCache(address, size);
+        void * p = memory + address;
+#if defined(__GNUC__)
+        switch (size) {
+        case 1: {
+            uint8_t e = (uint8_t)expected;
+            __atomic_compare_exchange_n((uint8_t*)p, &e, (uint8_t)newValue, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+            return e;}
+        case 2: {
+            uint16_t e = (uint16_t)expected;
+            __atomic_compare_exchange_n((uint16_t*)p, &e, (uint16_t)newValue, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+            return e;}
+        case 4: {
+            uint32_t e = (uint32_t)expected;
+            __atomic_compare_exchange_n((uint32_t*)p, &e, (uint32_t)newValue, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+            return e;}
+        default: {
+            uint64_t e = expected;
+            __atomic_compare_exchange_n((uint64_t*)p, &e, newValue, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+            return e;}
+        }
+#elif defined(_MSC_VER)
+        switch (size) {
+        case 1:
+            return (uint8_t)_InterlockedCompareExchange8((char*)p, (char)newValue, (char)expected);
+        case 2:
+            return (uint16_t)_InterlockedCompareExchange16((short*)p, (short)newValue, (short)expected);
+        case 4:
+            return (uint32_t)_InterlockedCompareExchange((long*)p, (long)newValue, (long)expected);
+        default:
+            return (uint64_t)_InterlockedCompareExchange64((long long*)p, (long long)newValue, (long long)expected);
+        }
+#endif
+    }
+    // unaligned, crossing a page boundary, or access violation.
+    // read and write give the same interrupts as other instructions
+    uint64_t sizemask = dataSizeMask[operandType];    // mask for operand size
+    uint64_t oldValue = readMemoryOperand(address);   // read value from memory
+    if (((oldValue ^ expected) & sizemask) == 0) {    // value match
+        writeMemoryOperand(newValue, address);        // write new value to memory
+    }
+    return oldValue;
+}
+
+// read performance counter. counter is one of the PERF_* constants
+uint64_t CThread::readPerf(uint32_t counter, uint32_t index) {
+    if (counter != PERF_TIME && counter != PERF_CALL_DEPTH) jitCountPerf(); // get counts from native code
+    uint64_t sum = 0;
+    switch (counter) {
+    case PERF_RESET:
+        memset(&perf, 0, sizeof(perf));
+        for (uint32_t s = 0; s < jitSegments.numEntries(); s++) jitSegments[s].count = 0;
+        perfStartTime = hostTimeNs();
+        return 0;
+    case PERF_TIME:
+        return hostTimeNs() - perfStartTime;
+    case PERF_INSTRUCTIONS:
+        for (int i = 0; i < 8; i++) sum += perf.category[i];
+        return sum;
+    case PERF_CATEGORY:
+        return index < 8 ? perf.category[index] : 0;
+    case PERF_FORMAT:
+        return index < 256 ? perf.format[index] : 0;
+    case PERF_JUMPS:
+        if (index == 0) return perf.jumpsTaken;
+        if (index == 1) return perf.category[4] - perf.jumpsTaken;
+        return 0;
+    case PERF_MEMORY:
+        if (index == 0) return perf.memoryReads;
+        if (index == 1) return perf.memoryWrites;
+        return 0;
+    case PERF_VECTOR:
+        if (index == 0) return perf.vectorInstructions;
+        if (index == 1) return perf.vectorElements;
+        return 0;
+    case PERF_CALL_DEPTH:
+        if (index == 0) return callStack.numEntries();
+        if (index == 1) return callDept;
+        return 0;
+    }
+    return 0;
+}
+
 // start writing debug list
 void CThread::listStart() {
     if (!listFileName) return;                   // nothing if no list file
+    uint64_t startTime = (uint64_t)time(0);
+    if (trace) trace->putHeader(startTime);
+    else listHeader(startTime);
+}
+
+// write heading of debug list as text
+void CThread::listHeader(uint64_t startTime) {
     listOut.put("Debug listing of ");
     listOut.put(cmd.getFilename(cmd.inputFile));
     listOut.newLine();
     // Date and time. (Will fail after year 2038 on computers that use 32-bit time_t)
-    time_t time1 = time(0);
+    time_t time1 = (time_t)startTime;
     char * timestring = ctime(&time1);
     if (timestring) {
         for (char *c = timestring; *c; c++) {            // Remove terminating '\n' in timestring
@@ -1060,10 +1979,16 @@ void CThread::listStart() {
     }
 }
 
-static uint32_t listIndex = 0;                   // index into lineList
 // write current instruction to debug list
 void CThread::listInstruction(uint64_t address) {
     if (!listFileName) return;                   // nothing if no list file
+    if (trace) trace->putInstruction((uint32_t)address, *(uint32_t*)(memory + ip0 + address));
+    else listInstructionText(address);
+}
+
+static uint32_t listIndex = 0;                   // index into lineList
+// write instruction to debug list as text
+void CThread::listInstructionText(uint64_t address) {
     SLineRef rec = {address, 1, 0};
     const char * text = 0;
     if (listIndex + 1 < emulator->lineList.numEntries() && emulator->lineList[listIndex+1] == rec) {
@@ -1072,6 +1997,9 @@ void CThread::listInstruction(uint64_t address) {
     }
     else {  // we may have jumped. Find address in list
         listIndex = (uint32_t)emulator->lineList.findFirst(rec);
+        if ((int32_t)listIndex < 0 && emulator->disassembleFunction(address)) {
+            listIndex = (uint32_t)emulator->lineList.findFirst(rec); // function not disassembled before
+        }
     }
     if (listIndex < emulator->lineList.numEntries()) {
         text = emulator->disassemOut.getString(emulator->lineList[listIndex].textPos); // get line from disassembly
@@ -1089,12 +2017,55 @@ void CThread::listInstruction(uint64_t address) {
 void CThread::listResult(uint64_t result) {
     if (++listLines >= cmd.maxLines) cmd.maxLines = 0;  // stop listing 
     if (listFileName == 0 || returnType == 0 || cmd.maxLines == 0) return;      // nothing if no list file or no return value
-    listOut.tabulate(emulator->disassembler.asmTab0);
+    // collect result data. memory reads for the list are not counted in performance counters
+    uint64_t memoryReads = perf.memoryReads;
+    uint64_t profileReads = profileCurrent->memoryReads;
+    CCacheModel * cache = cacheModel;            // the simulated caches don't see reads for the list
+    cacheModel = 0;
+    listData.setSize(0);
     if (!(returnType & 0x100)) { // general purpose register
         if (returnType & 0x20) { // memory destination
             result = readMemoryOperand(getMemoryAddress());
         }
         if (returnType & 0x30) { // register or memory
+            listData.push(&result, 8);
+            if ((returnType & 0xF) == 4) listData.push(&parm[5].q, 8);  // int128
+        }
+    }
+    else if (returnType & 0x30) { // vector
+        uint8_t destinationReg = operands[0] & 0x1F;
+        if (!(returnType & 0x20)) vectorLengthR = vectorLength[destinationReg];
+        uint8_t type = returnType & 0xF;
+        operandType = type;
+        uint32_t elementSize = dataSizeTable[type & 7];
+        if (type == 8) elementSize = 2;          // half precision
+        if (elementSize > 8) elementSize = 8;    // int128 and float128 listed as two int64
+        uint32_t length = vectorLengthR;
+        if (returnType & 0x40) length += elementSize;  // one extra element (save_cp instruction)
+        for (uint32_t vectorOffset = 0; vectorOffset < length; vectorOffset += elementSize) {
+            if (returnType & 0x20) { // memory destination
+                result = readMemoryOperand(getMemoryAddress() + vectorOffset);
+            }
+            else {            
+                result = readVectorElement(destinationReg, vectorOffset);
+            }
+            listData.push(&result, elementSize);
+        }
+    }
+    perf.memoryReads = memoryReads;
+    profileCurrent->memoryReads = profileReads;
+    cacheModel = cache;
+    if (trace) trace->putResult(operands[0], (uint16_t)returnType, listData.buf(), listData.dataSize());
+    else listResultText(returnType, (const uint8_t *)listData.buf(), listData.dataSize());
+}
+
+// write result to debug list as text
+void CThread::listResultText(uint32_t returnType, const uint8_t * data, uint32_t size) {
+    uint64_t result = 0;
+    listOut.tabulate(emulator->disassembler.asmTab0);
+    if (!(returnType & 0x100)) { // general purpose register
+        if ((returnType & 0x30) && size >= 8) { // register or memory
+            memcpy(&result, data, 8);
             switch (returnType & 0xF) {
             case 0:  // int8
                 listOut.putHex((uint8_t)result); break;
@@ -1105,18 +2076,20 @@ void CThread::listResult(uint64_t result) {
             case 3: case 6:  // int64
                 listOut.putHex(result); break;
             case 4:  // int128
-                listOut.putHex(parm[5].q, 2); listOut.putHex(result, 2); break;
+                if (size >= 16) {
+                    uint64_t high;
+                    memcpy(&high, data + 8, 8);
+                    listOut.putHex(high, 2); listOut.putHex(result, 2);
+                }
+                else listOut.put("?");
+                break;
             default:
                 listOut.put("?");
             }
         }
     }
     else if (returnType & 0x30) { // vector
-        uint8_t destinationReg = operands[0] & 0x1F;
-        //uint32_t vectorLengthR = vectorLength[destinationReg];
-        if (!(returnType & 0x20)) vectorLengthR = vectorLength[destinationReg];
         uint8_t type = returnType & 0xF;
-        operandType = type;
         uint32_t elementSize = dataSizeTable[type & 7];
         if (type == 8) elementSize = 2;          // half precision
         if (elementSize > 8) elementSize = 8;    // int128 and float128 listed as two int64
@@ -1125,15 +2098,10 @@ void CThread::listResult(uint64_t result) {
             double d;
             float f;
         } u;
-        if (vectorLengthR == 0) listOut.put("Empty");
-        if (returnType & 0x40) vectorLengthR += elementSize;  // one extra element (save_cp instruction)
-        for (uint32_t vectorOffset = 0; vectorOffset < vectorLengthR; vectorOffset += elementSize) {
-            if (returnType & 0x20) { // memory destination
-                result = readMemoryOperand(getMemoryAddress() + vectorOffset);
-            }
-            else {            
-                result = readVectorElement(destinationReg, vectorOffset);
-            }
+        if (size == ((returnType & 0x40) ? elementSize : 0)) listOut.put("Empty");
+        for (uint32_t vectorOffset = 0; vectorOffset + elementSize <= size; vectorOffset += elementSize) {
+            result = 0;
+            memcpy(&result, data + vectorOffset, elementSize);
             switch (returnType & 0xF) {
             case 0:  // int8
                 listOut.putHex((uint8_t)result); break;
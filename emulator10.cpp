@@ -0,0 +1,233 @@
+/****************************  emulator10.cpp  *******************************
+* Author:        agent
+* date created:  2026-10-16
+* Last modified: 2026-10-16
+* Version:       1.01
+* Project:       Binary tools for ForwardCom instruction set
+* Description:
+* Emulator: Binary trace output
+*
+* With option -trace=filename, the emulator writes the debug output as compact
+* binary records instead of text. The records go through a fixed-size ring buffer
+* and are written to the file by a background thread while the program is running.
+* Option -readtrace=filename makes the text listing from a binary trace file
+* afterwards, using the disassembly of the same executable file.
+* The format of the trace file is described in emulator.h
+*
+* Copyright 2018-2026 GNU General Public License http://www.gnu.org/licenses
+*****************************************************************************/
+
+#include "stdafx.h"
+#include <chrono>
+
+// constructor
+CTraceWriter::CTraceWriter() {
+    file = 0;
+    ring = 0;
+    head = 0;
+    tail = 0;
+    notified = 0;
+    closing = false;
+}
+
+// destructor
+CTraceWriter::~CTraceWriter() {
+    close();
+}
+
+// create file and start writer thread. returns false if the file cannot be created
+bool CTraceWriter::open(const char * filename) {
+    file = fopen(filename, "wb");
+    if (!file) return false;
+    ring = new uint8_t[TRACE_RING_SIZE];
+    writer = std::thread(&CTraceWriter::writerLoop, this);
+    return true;
+}
+
+// write remaining data, stop writer thread and close file
+void CTraceWriter::close() {
+    if (!file) return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closing = true;
+    }
+    dataReady.notify_one();
+    writer.join();
+    fclose(file);
+    file = 0;
+    delete[] ring;
+    ring = 0;
+}
+
+// put data into ring buffer. Called only by the emulator thread
+void CTraceWriter::put(const void * data, uint32_t size) {
+    uint64_t h = head.load(std::memory_order_relaxed);
+    if (h + size - tail.load(std::memory_order_acquire) > TRACE_RING_SIZE) {
+        // buffer full. wait for writer thread
+        std::unique_lock<std::mutex> lock(mutex);
+        notified = h;
+        dataReady.notify_one();
+        spaceReady.wait(lock, [&] {return h + size - tail.load(std::memory_order_acquire) <= TRACE_RING_SIZE;});
+    }
+    uint32_t pos = (uint32_t)h & (TRACE_RING_SIZE - 1);
+    uint32_t n1 = TRACE_RING_SIZE - pos;         // space before end of ring
+    if (n1 > size) n1 = size;
+    memcpy(ring + pos, data, n1);
+    if (n1 < size) memcpy(ring, (const uint8_t *)data + n1, size - n1);  // wrap around
+    head.store(h + size, std::memory_order_release);
+    if (h + size - notified >= TRACE_RING_SIZE / 4) {
+        // wake up writer thread when a quarter of the buffer is filled
+        std::lock_guard<std::mutex> lock(mutex);
+        notified = h + size;
+        dataReady.notify_one();
+    }
+}
+
+// writer thread
+void CTraceWriter::writerLoop() {
+    bool finish;
+    do {
+        {
+            // wait for data. write at least every 100 ms so that little is lost if the emulator is aborted
+            std::unique_lock<std::mutex> lock(mutex);
+            dataReady.wait_for(lock, std::chrono::milliseconds(100), [this] {
+                return closing || head.load(std::memory_order_acquire) - tail.load(std::memory_order_relaxed) >= TRACE_RING_SIZE / 4;});
+            finish = closing;                    // head is read below, so all data are written before finishing
+        }
+        uint64_t h = head.load(std::memory_order_acquire);
+        uint64_t t = tail.load(std::memory_order_relaxed);
+        if (t == h) continue;
+        while (t < h) {
+            uint32_t pos = (uint32_t)t & (TRACE_RING_SIZE - 1);
+            uint32_t n = TRACE_RING_SIZE - pos;
+            if (n > h - t) n = uint32_t(h - t);
+            fwrite(ring + pos, 1, n, file);
+            t += n;
+        }
+        fflush(file);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tail.store(t, std::memory_order_release);
+        }
+        spaceReady.notify_one();
+    } while (!finish);
+}
+
+// write file header
+void CTraceWriter::putHeader(uint64_t startTime) {
+    uint8_t rec[24];
+    uint32_t version = TRACE_VERSION, reserved = 0;
+    memcpy(rec, TRACE_SIGNATURE, 8);
+    memcpy(rec + 8, &version, 4);
+    memcpy(rec + 12, &reserved, 4);
+    memcpy(rec + 16, &startTime, 8);
+    put(rec, sizeof(rec));
+}
+
+// write TRACE_INSTRUCTION record
+void CTraceWriter::putInstruction(uint32_t address, uint32_t instructionWord) {
+    uint8_t rec[9];
+    rec[0] = TRACE_INSTRUCTION;
+    memcpy(rec + 1, &address, 4);
+    memcpy(rec + 5, &instructionWord, 4);
+    put(rec, sizeof(rec));
+}
+
+// write TRACE_RESULT record
+void CTraceWriter::putResult(uint8_t reg, uint16_t returnType, const void * data, uint32_t size) {
+    uint8_t rec[8];
+    rec[0] = TRACE_RESULT;
+    rec[1] = reg;
+    memcpy(rec + 2, &returnType, 2);
+    memcpy(rec + 4, &size, 4);
+    put(rec, sizeof(rec));
+    if (size) put(data, size);
+}
+
+// write TRACE_INTERRUPT record
+void CTraceWriter::putInterrupt(uint32_t n, bool terminate) {
+    uint8_t rec[6];
+    rec[0] = TRACE_INTERRUPT;
+    memcpy(rec + 1, &n, 4);
+    rec[5] = terminate;
+    put(rec, sizeof(rec));
+}
+
+// write TRACE_SYSTEM_CALL record
+void CTraceWriter::putSystemCall(uint32_t mod, uint32_t funcid) {
+    uint8_t rec[9];
+    rec[0] = TRACE_SYSTEM_CALL;
+    memcpy(rec + 1, &mod, 4);
+    memcpy(rec + 5, &funcid, 4);
+    put(rec, sizeof(rec));
+}
+
+// make debug output list from binary trace file.
+// The text is written to the list file in pieces so that memory use is bounded
+void CThread::decodeTrace(const char * filename) {
+    const char * outputName = cmd.getFilename(listFileName);
+    FILE * in = fopen(filename, "rb");
+    if (!in) {
+        err.submit(ERR_INPUT_FILE, filename);  return;
+    }
+    FILE * out = fopen(outputName, "wb");
+    if (!out) {
+        err.submit(ERR_OUTPUT_FILE, outputName);  fclose(in);  return;
+    }
+    uint8_t rec[24];                             // header or fixed part of record
+    uint32_t version, a, b;                      // numbers in header or record
+    uint64_t startTime;
+    uint16_t rtype;                              // returnType
+    int type;                                    // record type
+    if (fread(rec, 1, 24, in) != 24 || memcmp(rec, TRACE_SIGNATURE, 8) != 0) goto BADFILE;
+    memcpy(&version, rec + 8, 4);
+    if (version != TRACE_VERSION) goto BADFILE;
+    memcpy(&startTime, rec + 16, 8);
+    listHeader(startTime);
+
+    while ((type = fgetc(in)) != EOF) {
+        switch (type) {
+        case TRACE_INSTRUCTION:
+            if (fread(rec, 1, 8, in) != 8) goto BADFILE;
+            memcpy(&a, rec, 4);
+            listInstructionText(a);
+            break;
+        case TRACE_RESULT:
+            if (fread(rec, 1, 7, in) != 7) goto BADFILE;
+            memcpy(&rtype, rec + 1, 2);
+            memcpy(&a, rec + 3, 4);              // size of data
+            if (a > TRACE_RING_SIZE) goto BADFILE;
+            listData.setSize(0);
+            listData.setDataSize(a);
+            if (fread(listData.buf(), 1, a, in) != a) goto BADFILE;
+            listResultText(rtype, (const uint8_t *)listData.buf(), a);
+            break;
+        case TRACE_INTERRUPT:
+            if (fread(rec, 1, 5, in) != 5) goto BADFILE;
+            memcpy(&a, rec, 4);
+            listInterruptText(a, rec[4] != 0);
+            break;
+        case TRACE_SYSTEM_CALL:
+            if (fread(rec, 1, 8, in) != 8) goto BADFILE;
+            memcpy(&a, rec, 4);  memcpy(&b, rec + 4, 4);
+            listSystemCallText(a, b);
+            break;
+        default:
+            goto BADFILE;
+        }
+        if (listOut.dataSize() >= TRACE_RING_SIZE) {
+            // write a piece of the listing
+            fwrite(listOut.buf(), 1, listOut.dataSize(), out);
+            listOut.setSize(0);
+        }
+    }
+    goto DONE;
+
+BADFILE:
+    err.submit(ERR_EMU_TRACE_FORMAT, filename);
+DONE:
+    fwrite(listOut.buf(), 1, listOut.dataSize(), out);
+    listOut.setSize(0);
+    fclose(out);
+    fclose(in);
+}
@@ -0,0 +1,292 @@
+/****************************  emulator11.cpp  *******************************
+* Author:        agent
+* date created:  2026-10-16
+* Last modified: 2026-10-16
+* Version:       1.01
+* Project:       Binary tools for ForwardCom instruction set
+* Description:
+* Emulator: Function profiler
+*
+* With option -profile=filename, each thread counts executed instructions and
+* memory operands for each 32-bit word of code. Calls and returns are detected
+* when the size of the call stack changes, and counted as edges of a call graph.
+* When the program ends, the counts are attributed to the functions in the
+* symbol table of the executable file, and a flat profile and a call graph are
+* written to the file. Instructions executed as native code (-jit) cannot be
+* counted, so -jit is disabled when profiling.
+* The same table of counts for each word of code is used for the cache
+* simulator (-cache, emulator12.cpp), but instructions are counted only with
+* -profile.
+*
+* Copyright 2018-2026 GNU General Public License http://www.gnu.org/licenses
+*****************************************************************************/
+
+#include "stdafx.h"
+
+// Operator for sorting functions by address
+static inline bool operator < (SProfileFunction const & a, SProfileFunction const & b) {
+    return a.address < b.address;
+}
+
+// record for sorting functions by a count, largest first
+struct SProfileSort {
+    uint64_t key;                                // instructions
+    uint32_t index;                              // index into profileFunctions
+};
+
+static inline bool operator < (SProfileSort const & a, SProfileSort const & b) {
+    return a.key > b.key;
+}
+
+// make list of functions for profile
+void CEmulator::profileFunctionList() {
+    // find the address range covered by executable memory map entries, as in CThread::initDecodeCache
+    uint64_t start = 0, end = 0;
+    for (uint32_t i = 0; i + 1 < memoryMap.numEntries(); i++) {
+        if (memoryMap[i].access_addend & SHF_EXEC) {
+            if (start == end) start = memoryMap[i].startAddress;
+            end = memoryMap[i+1].startAddress;
+        }
+    }
+    profileStart = start;
+    SProfileFunction func;
+    zeroAllMembers(func);
+    profileFunctions.setSize(0);
+    profileFunctions.push(func);                 // entry 0 is code outside any function
+    // get function symbols in executable sections
+    for (uint32_t i = 0; i < symbols.numEntries(); i++) {
+        ElfFwcSym & sym = symbols[i];
+        uint32_t sec = sym.st_section;
+        if (sym.st_type != STT_FUNC || sec == 0 || sec >= sectionHeaders.numEntries()) continue;
+        if (!(sectionHeaders[sec].sh_flags & SHF_EXEC)) continue;
+        // address relative to ip0, as in CDisassembler
+        func.address = ip0 + sectionHeaders[sec].sh_addr + sym.st_value;
+        func.name = sym.st_name;
+        if (func.address >= start && func.address < end) profileFunctions.push(func);
+    }
+    profileFunctions.sort();
+    // make index from code word to function. a function extends to the next function
+    profileIndex.setDataSize(0);
+    profileIndex.setNum((uint32_t)((end - start) >> 2));
+    profileIndex.zero();
+    for (uint32_t f = 1; f < profileFunctions.numEntries(); f++) {
+        uint32_t w1 = (uint32_t)((profileFunctions[f].address - start) >> 2);
+        uint32_t w2 = profileIndex.numEntries();
+        if (f + 1 < profileFunctions.numEntries()) w2 = (uint32_t)((profileFunctions[f+1].address - start) >> 2);
+        for (uint32_t w = w1; w < w2; w++) profileIndex[w] = f;  // functions with the same address: the last one is used
+    }
+}
+
+// write profile file
+void CEmulator::profileWrite() {
+    uint32_t numFunctions = profileFunctions.numEntries();
+    uint64_t total = 0, reads = 0, writes = 0;
+    for (uint32_t f = 0; f < numFunctions; f++) {
+        total  += profileFunctions[f].instructions;
+        reads  += profileFunctions[f].memoryReads;
+        writes += profileFunctions[f].memoryWrites;
+    }
+    CTextFileBuffer out;
+    char line[256];
+    out.put("Function profile of ");
+    out.put(cmd.getFilename(cmd.inputFile));
+    out.newLine();
+    sprintf(line, "Instructions executed: %llu. Memory operands read: %llu, written: %llu",
+        (unsigned long long)total, (unsigned long long)reads, (unsigned long long)writes);
+    out.put(line);
+    out.newLine();  out.newLine();
+
+    // flat profile, sorted by instructions executed in each function
+    CDynamicArray<SProfileSort> order;
+    SProfileSort rec;
+    for (uint32_t f = 0; f < numFunctions; f++) {
+        if (profileFunctions[f].instructions == 0 && profileFunctions[f].calls == 0) continue;
+        rec.key = profileFunctions[f].instructions;
+        rec.index = f;
+        order.push(rec);
+    }
+    order.sort();
+    out.put("Flat profile:");
+    out.newLine();
+    out.put("   instructions      %       inclusive      calls   memory reads  memory writes  function");
+    out.newLine();
+    for (uint32_t i = 0; i < order.numEntries(); i++) {
+        SProfileFunction & func = profileFunctions[order[i].index];
+        sprintf(line, "%15llu %6.2f %15llu %10llu %14llu %14llu  ",
+            (unsigned long long)func.instructions, total ? func.instructions * 100. / total : 0.,
+            (unsigned long long)func.inclusive, (unsigned long long)func.calls,
+            (unsigned long long)func.memoryReads, (unsigned long long)func.memoryWrites);
+        out.put(line);
+        out.put(order[i].index ? stringBuffer.getString(func.name) : "(outside functions)");
+        out.newLine();
+    }
+
+    // call graph, sorted by inclusive instructions
+    for (uint32_t i = 0; i < order.numEntries(); i++) order[i].key = profileFunctions[order[i].index].inclusive;
+    order.sort();
+    out.newLine();
+    out.put("Call graph:");
+    out.newLine();
+    for (uint32_t i = 0; i < order.numEntries(); i++) {
+        uint32_t f = order[i].index;
+        if (f == 0) continue;
+        SProfileFunction & func = profileFunctions[f];
+        out.newLine();
+        out.put(stringBuffer.getString(func.name));
+        sprintf(line, ": inclusive %llu, self %llu, called %llu times",
+            (unsigned long long)func.inclusive, (unsigned long long)func.instructions, (unsigned long long)func.calls);
+        out.put(line);
+        out.newLine();
+        for (uint32_t e = 0; e < profileEdges.numEntries(); e++) {
+            SProfileEdge & edge = profileEdges[e];
+            if (edge.callee != f) continue;
+            out.put("    called from ");
+            out.put(edge.caller ? stringBuffer.getString(profileFunctions[edge.caller].name) : "(outside functions)");
+            sprintf(line, " %llu times", (unsigned long long)edge.calls);
+            out.put(line);
+            out.newLine();
+        }
+        for (uint32_t e = 0; e < profileEdges.numEntries(); e++) {
+            SProfileEdge & edge = profileEdges[e];
+            if (edge.caller != f) continue;
+            out.put("    calls ");
+            out.put(edge.callee ? stringBuffer.getString(profileFunctions[edge.callee].name) : "(outside functions)");
+            sprintf(line, " %llu times, %llu instructions", (unsigned long long)edge.calls, (unsigned long long)edge.inclusive);
+            out.put(line);
+            out.newLine();
+        }
+    }
+    out.write(cmd.getFilename(cmd.profileFile));
+}
+
+// prepare profile counts. called from setRegisters
+void CThread::profileInit() {
+    if (profileCounts.numEntries()) profileMerge();  // counts from a previous thread with the same number
+    profiling = cmd.profileFile && emulator->profileIndex.numEntries() != 0;
+    profileCurrent = &profileOutside;
+    zeroAllMembers(profileOutside);
+    profileTotal = 0;
+    profileRoot = 0;
+    profileEdges.setSize(0);
+    profileStack.setSize(0);
+    if (emulator->profileIndex.numEntries() == 0) return;  // neither -profile nor -cache
+#ifdef CACHE_SIMULATION
+    if (cmd.cacheFile) {
+        if (!cacheModel) cacheModel = new CCacheModel;
+        cacheModel->init(cmd.cacheConfig, emulator->cacheSymbols.numEntries());
+    }
+#endif
+    profileCounts.setDataSize(0);
+    profileCounts.setNum(emulator->profileIndex.numEntries());
+    profileCounts.zero();
+    profileActive.setDataSize(0);
+    profileActive.setNum(emulator->profileFunctions.numEntries());
+    profileActive.zero();
+    profileInclusive.setDataSize(0);
+    profileInclusive.setNum(emulator->profileFunctions.numEntries());
+    profileInclusive.zero();
+}
+
+// count current instruction in profile. called from perfCount
+void CThread::profileInstruction() {
+    if (callStack.numEntries() != profileStack.numEntries()) profileCallReturn(callStack.numEntries());
+    uint64_t word = (ip - emulator->profileStart) >> 2;
+    if (word < profileCounts.numEntries()) profileCurrent = (SProfileCount *)profileCounts.buf() + word;
+    else profileCurrent = &profileOutside;
+    profileCurrent->instructions++;
+    profileTotal++;
+}
+
+// update call graph when the size of callStack has changed
+void CThread::profileCallReturn(uint32_t depth) {
+    while (profileStack.numEntries() < depth) {
+        // call. the return address is after the call instruction
+        uint64_t returnAddress = callStack[profileStack.numEntries()];
+        uint32_t caller = emulator->profileFunction(returnAddress - 4);
+        uint32_t callee = emulator->profileFunction(ip);
+        // find edge. try the last edge used from the same call instruction first
+        uint64_t word = (returnAddress - 4 - emulator->profileStart) >> 2;
+        SProfileCount * site = word < profileCounts.numEntries() ? &profileCounts[(uint32_t)word] : &profileOutside;
+        uint32_t e = site->edge;
+        if (e == 0 || profileEdges[e-1].caller != caller || profileEdges[e-1].callee != callee) {
+            for (e = 0; e < profileEdges.numEntries(); e++) {
+                if (profileEdges[e].caller == caller && profileEdges[e].callee == callee) break;
+            }
+            if (e == profileEdges.numEntries()) {
+                SProfileEdge edge = {caller, callee, 0, 0};
+                profileEdges.push(edge);
+            }
+            site->edge = ++e;
+        }
+        profileEdges[e-1].calls++;
+        profileActive[callee]++;
+        SProfileFrame frame = {e - 1, profileTotal};
+        profileStack.push(frame);
+    }
+    while (profileStack.numEntries() > depth) {
+        // return
+        SProfileFrame frame = profileStack.pop();
+        SProfileEdge & edge = profileEdges[frame.edge];
+        uint64_t n = profileTotal - frame.start;
+        edge.inclusive += n;
+        // a recursive function is counted only when the outermost call returns
+        if (--profileActive[edge.callee] == 0) profileInclusive[edge.callee] += n;
+    }
+}
+
+// add profile counts of this thread to CEmulator
+void CThread::profileMerge() {
+    if (profileCounts.numEntries() == 0) return;
+    profileCallReturn(0);                        // close calls that have not returned
+    // the function where the thread started is not called through callStack
+    profileInclusive[profileRoot] = profileTotal;
+    SProfileFunction * functions = (SProfileFunction *)emulator->profileFunctions.buf();
+    const uint32_t * index = (const uint32_t *)emulator->profileIndex.buf();
+    for (uint32_t w = 0; w < profileCounts.numEntries(); w++) {
+        SProfileCount & count = profileCounts[w];
+        if (count.instructions == 0 && count.memoryReads == 0 && count.memoryWrites == 0 && count.cacheAccesses == 0) continue;
+        SProfileFunction & func = functions[index[w]];
+        func.instructions += count.instructions;
+        func.memoryReads  += count.memoryReads;
+        func.memoryWrites += count.memoryWrites;
+        func.cacheAccesses += count.cacheAccesses;
+        func.l1Misses     += count.l1Misses;
+        func.l2Misses     += count.l2Misses;
+    }
+    functions[0].instructions += profileOutside.instructions;
+    functions[0].memoryReads  += profileOutside.memoryReads;
+    functions[0].memoryWrites += profileOutside.memoryWrites;
+    functions[0].cacheAccesses += profileOutside.cacheAccesses;
+    functions[0].l1Misses     += profileOutside.l1Misses;
+    functions[0].l2Misses     += profileOutside.l2Misses;
+    if (cacheModel) {
+        for (uint32_t s = 0; s < cacheModel->symbols.numEntries(); s++) {
+            SCacheSymbol & sym = emulator->cacheSymbols[s];
+            sym.accesses += cacheModel->symbols[s].accesses;
+            sym.l1Misses += cacheModel->symbols[s].l1Misses;
+            sym.l2Misses += cacheModel->symbols[s].l2Misses;
+        }
+        delete cacheModel;                       // made again by profileInit if the thread number is reused
+        cacheModel = 0;
+    }
+    for (uint32_t f = 0; f < profileInclusive.numEntries(); f++) {
+        if (f) functions[f].inclusive += profileInclusive[f];
+    }
+    for (uint32_t e = 0; e < profileEdges.numEntries(); e++) {
+        SProfileEdge & edge = profileEdges[e];
+        functions[edge.callee].calls += edge.calls;
+        uint32_t e2;
+        for (e2 = 0; e2 < emulator->profileEdges.numEntries(); e2++) {
+            if (emulator->profileEdges[e2].caller == edge.caller && emulator->profileEdges[e2].callee == edge.callee) break;
+        }
+        if (e2 == emulator->profileEdges.numEntries()) emulator->profileEdges.push(edge);
+        else {
+            emulator->profileEdges[e2].calls += edge.calls;
+            emulator->profileEdges[e2].inclusive += edge.inclusive;
+        }
+    }
+    profileCounts.setSize(0);                    // don't merge the same counts again
+    profileEdges.setSize(0);
+    profiling = false;
+    profileCurrent = &profileOutside;
+}
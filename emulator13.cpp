@@ -0,0 +1,271 @@
+/****************************  emulator13.cpp  *******************************
+* Author:        agent
+* date created:  2026-10-16
+* Last modified: 2026-10-16
+* Version:       1.01
+* Project:       Binary tools for ForwardCom instruction set
+* Description:
+* Emulator: Checkpoint and restore
+*
+* The system function checkpoint saves the state of the program in the file
+* given by option -checkpoint=filename. Option -restore=filename continues from
+* a checkpoint instead of starting the program from the entry point.
+*
+* The file contains a header with the registers of the main thread, followed by
+* the memory map, the vector registers, the call stack and the initial
+* thread-local data. The memory image comes last, at a file offset aligned to
+* 64 kB, so that it can be mapped directly into the address space of the
+* emulator. Pages of the memory image that contain only zeros are not written,
+* but skipped with a seek, so that they take no disk space on file systems
+* with sparse files. The mapping is private: memory pages are read from the file only
+* when the program touches them, and pages that are written get a private copy.
+* The file itself is never modified, so the same checkpoint can be restored any
+* number of times, also by several emulators at the same time.
+*
+* A checkpoint can be restored only with the same executable file and the same
+* options for vector length and number of threads. Open files and time are not
+* saved. The checkpoint function fails if any other thread than the main thread
+* is running, or if a file has been mapped into memory with mmap_file, because
+* the memory map is then different from the one made by loading the program.
+*
+* Copyright 2018-2026 GNU General Public License http://www.gnu.org/licenses
+*****************************************************************************/
+
+#include "stdafx.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+const uint32_t CHECKPOINT_SIGNATURE = 0x4B504346; // "FCPK"
+const uint32_t CHECKPOINT_VERSION   = 1;
+const uint64_t CHECKPOINT_ALIGN     = 0x10000;    // alignment of memory image in file. allocation granularity on Windows
+
+// header of checkpoint file
+struct SCheckpointHeader {
+    uint32_t signature;                          // CHECKPOINT_SIGNATURE
+    uint32_t version;                            // CHECKPOINT_VERSION
+    uint64_t checksum;                           // checksum of executable file
+    uint64_t memsize;                            // size of memory image
+    uint64_t memoryOffset;                       // file offset of memory image
+    uint32_t maxVectorLength;                    // maximum vector length
+    uint32_t maxNumThreads;                      // maximum number of threads
+    uint32_t numMapEntries;                      // number of entries in memory map
+    uint32_t callStackSize;                      // number of entries in call stack
+    uint64_t threadLocalSize;                    // size of initial thread-local data
+    uint64_t ip;                                 // instruction pointer after the checkpoint call
+    uint64_t numContr;                           // numeric control register
+    uint64_t registers[32];                      // general purpose registers
+    uint32_t vectorLength[32];                   // length of vector registers
+};
+
+// set position in checkpoint file. returns false if failed
+static bool checkpointSeek(FILE * f, uint64_t offset) {
+#ifdef _WIN32
+    return _fseeki64(f, (int64_t)offset, SEEK_SET) == 0;
+#else
+    return fseeko(f, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
+
+// check if a block of memory contains only zeros
+static bool checkpointZero(const int8_t * p, uint64_t size) {
+    uint64_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t x;
+        memcpy(&x, p + i, 8);
+        if (x) return false;
+    }
+    for (; i < size; i++) {
+        if (p[i]) return false;
+    }
+    return true;
+}
+
+// checksum identifying the executable file. calculated by load before the file buffers are released
+uint64_t CEmulator::checkpointChecksum() {
+    uint64_t h = 0xCBF29CE484222325;             // FNV-1a hash
+    const uint8_t * p = (const uint8_t *)dataBuffer.buf();
+    for (uint32_t i = 0; i < dataBuffer.dataSize(); i++) {
+        h = (h ^ p[i]) * 0x100000001B3;
+    }
+    return h ^ fileHeader.e_entry;
+}
+
+// save state of thread t in checkpoint file. returns 0 if success, -1 if failed
+uint64_t CEmulator::checkpointSave(CThread * t) {
+    if (!cmd.checkpointFile) return (uint64_t)(int64_t)-1;
+    // other threads must not run while memory is saved
+    std::lock_guard<std::mutex> lock(threadMutex);
+    for (uint32_t n = 1; n < threadState.numEntries(); n++) {
+        if (threadState[n] != THREAD_FREE) return (uint64_t)(int64_t)-1;
+    }
+    // restoreState requires the memory map made by load()
+    if (mapAreaUsed) return (uint64_t)(int64_t)-1;
+    SCheckpointHeader header;
+    zeroAllMembers(header);
+    header.signature = CHECKPOINT_SIGNATURE;
+    header.version = CHECKPOINT_VERSION;
+    header.checksum = fileChecksum;
+    header.memsize = memsize;
+    header.maxVectorLength = MaxVectorLength;
+    header.maxNumThreads = maxNumThreads;
+    header.numMapEntries = memoryMap.numEntries();
+    header.callStackSize = t->callStack.numEntries();
+    header.threadLocalSize = threadLocalInit.dataSize();
+    header.ip = t->ip;
+    header.numContr = t->numContr;
+    memcpy(header.registers, t->registers, sizeof(header.registers));
+    memcpy(header.vectorLength, t->vectorLength, sizeof(header.vectorLength));
+    uint64_t stateSize = sizeof(header) + header.numMapEntries * sizeof(SMemoryMap)
+        + 32 * (uint64_t)MaxVectorLength + header.callStackSize * sizeof(uint64_t) + header.threadLocalSize;
+    header.memoryOffset = (stateSize + CHECKPOINT_ALIGN - 1) & -(int64_t)CHECKPOINT_ALIGN;
+
+    CMemoryBuffer state;                         // everything before the memory image
+    state.push(&header, sizeof(header));
+    if (header.numMapEntries) state.push(&memoryMap[0], header.numMapEntries * sizeof(SMemoryMap));
+    state.push(t->vectors.buf(), 32 * MaxVectorLength);
+    if (header.callStackSize) state.push(&t->callStack[0], header.callStackSize * (uint32_t)sizeof(uint64_t));
+    if (header.threadLocalSize) state.push(threadLocalInit.buf(), threadLocalInit.dataSize());
+    state.setDataSize((uint32_t)header.memoryOffset);  // zero padding
+
+    const char * filename = cmd.getFilename(cmd.checkpointFile);
+    FILE * f = fopen(filename, "wb");
+    if (!f) {
+        err.submit(ERR_OUTPUT_FILE, filename);
+        return (uint64_t)(int64_t)-1;
+    }
+    bool ok = fwrite(state.buf(), 1, state.dataSize(), f) == state.dataSize();
+    // write memory image in runs of pages that are not all zero
+    const uint64_t pageSize = (uint64_t)1 << MEMORY_PAGE_BITS;
+    uint64_t written = 0;                        // end of the part of the memory image written so far
+    uint64_t page = 0;
+    while (ok && page < memsize) {
+        uint64_t end = page + pageSize < memsize ? page + pageSize : memsize;
+        if (memoryUntouched(page, end - page) || checkpointZero(memory + page, end - page)) {
+            page = end;  continue;               // skip zero page
+        }
+        // find end of run of non-zero pages
+        while (end < memsize) {
+            uint64_t next = end + pageSize < memsize ? end + pageSize : memsize;
+            if (memoryUntouched(end, next - end) || checkpointZero(memory + end, next - end)) break;
+            end = next;
+        }
+        if (written != page) ok = checkpointSeek(f, header.memoryOffset + page);
+        ok = ok && fwrite(memory + page, 1, size_t(end - page), f) == size_t(end - page);
+        written = page = end;
+    }
+    if (ok && written != memsize) {
+        // zero pages at the end. the file must have the full size for restoreMemory
+        ok = checkpointSeek(f, header.memoryOffset + memsize - 1) && fputc(0, f) == 0;
+    }
+    if (fclose(f) != 0) ok = false;
+    if (!ok) {
+        err.submit(ERR_OUTPUT_FILE, filename);
+        return (uint64_t)(int64_t)-1;
+    }
+    return 0;
+}
+
+// read and check header of checkpoint file. returns false if failed
+static bool checkpointReadHeader(FILE * f, SCheckpointHeader & header) {
+    return fread(&header, 1, sizeof(header), f) == sizeof(header)
+        && header.signature == CHECKPOINT_SIGNATURE && header.version == CHECKPOINT_VERSION;
+}
+
+// map memory image from checkpoint file, copy-on-write. called by load() instead of allocating memory
+void CEmulator::restoreMemory() {
+    const char * filename = cmd.getFilename(cmd.restoreFile);
+    SCheckpointHeader header;
+    FILE * f = fopen(filename, "rb");
+    if (!f) {
+        err.submit(ERR_INPUT_FILE, filename);  return;
+    }
+    bool ok = checkpointReadHeader(f, header);
+    fclose(f);
+    if (!ok || header.checksum != fileChecksum || header.memsize != memsize
+    || header.maxVectorLength != MaxVectorLength || header.maxNumThreads != maxNumThreads
+    || (header.memoryOffset & (CHECKPOINT_ALIGN - 1))) {
+        err.submit(ERR_EMU_CHECKPOINT, filename);  return;
+    }
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    if (file == INVALID_HANDLE_VALUE) {
+        err.submit(ERR_INPUT_FILE, filename);  return;
+    }
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || (uint64_t)fileSize.QuadPart < header.memoryOffset + memsize) {
+        CloseHandle(file);
+        err.submit(ERR_FILE_SIZE, filename);  return;
+    }
+    HANDLE mapping = CreateFileMappingA(file, 0, PAGE_WRITECOPY, 0, 0, 0);
+    CloseHandle(file);
+    void * p = 0;
+    if (mapping) {
+        p = MapViewOfFile(mapping, FILE_MAP_COPY, DWORD(header.memoryOffset >> 32), DWORD(header.memoryOffset), size_t(memsize));
+        CloseHandle(mapping);                    // the view keeps the mapping open
+    }
+    if (!p) {
+        err.submit(ERR_MEMORY_ALLOCATION);  return;
+    }
+#else
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        err.submit(ERR_INPUT_FILE, filename);  return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (uint64_t)st.st_size < header.memoryOffset + memsize) {
+        close(fd);
+        err.submit(ERR_FILE_SIZE, filename);  return;
+    }
+    void * p = mmap(0, size_t(memsize), PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, (off_t)header.memoryOffset);
+    close(fd);                                   // the mapping keeps the file open
+    if (p == MAP_FAILED) {
+        err.submit(ERR_MEMORY_ALLOCATION);  return;
+    }
+#endif
+    memory = (int8_t *)p;
+    memoryRestored = true;
+}
+
+// restore state of main thread from checkpoint file. memory is mapped by restoreMemory()
+void CEmulator::restoreState(CThread * t) {
+    const char * filename = cmd.getFilename(cmd.restoreFile);
+    FILE * f = fopen(filename, "rb");
+    if (!f) {
+        err.submit(ERR_INPUT_FILE, filename);  return;
+    }
+    SCheckpointHeader header;
+    bool ok = checkpointReadHeader(f, header) && header.numMapEntries == memoryMap.numEntries();
+    // the memory map must be the same as calculated by load()
+    SMemoryMap mapEntry;
+    for (uint32_t i = 0; ok && i < header.numMapEntries; i++) {
+        ok = fread(&mapEntry, 1, sizeof(mapEntry), f) == sizeof(mapEntry)
+            && mapEntry.startAddress == memoryMap[i].startAddress && mapEntry.access_addend == memoryMap[i].access_addend;
+    }
+    ok = ok && fread(t->vectors.buf(), 1, 32 * MaxVectorLength, f) == 32 * MaxVectorLength;
+    if (ok) {
+        t->callStack.setNum(header.callStackSize);
+        if (header.callStackSize) ok = fread(&t->callStack[0], sizeof(uint64_t), header.callStackSize, f) == header.callStackSize;
+    }
+    if (ok && header.threadLocalSize) {
+        // thread-local data as it was after loading, for threads started after the restore
+        threadLocalInit.setSize(0);
+        threadLocalInit.setDataSize((uint32_t)header.threadLocalSize);
+        ok = fread(threadLocalInit.buf(), 1, size_t(header.threadLocalSize), f) == header.threadLocalSize;
+    }
+    fclose(f);
+    if (!ok) {
+        err.submit(ERR_EMU_CHECKPOINT, filename);  return;
+    }
+    t->ip = header.ip;
+    t->numContr = header.numContr;
+    memcpy(t->registers, header.registers, sizeof(t->registers));
+    memcpy(t->vectorLength, header.vectorLength, sizeof(t->vectorLength));
+    t->registers[0] = 1;                         // return value of checkpoint function when restored
+}
@@ -0,0 +1,164 @@
+/****************************  emulator14.cpp  *******************************
+* Author:        agent
+* date created:  2026-10-16
+* Last modified: 2026-10-16
+* Version:       1.01
+* Project:       Binary tools for ForwardCom instruction set
+* Description:
+* Emulator: Batch mode
+*
+* Option -batch=filename runs the program once for each input file listed in
+* the file, one name per line. The executable file is loaded and relocated only
+* once. Each run is a child process made with fork, so it gets a copy-on-write
+* view of the loaded memory image. Memory pages are shared between the runs
+* until a run writes to them.
+*
+* Each run reads stdin from its input file and writes stdout to the input file
+* name with extension .out added. Up to -batchjobs=N runs are active at the
+* same time. When all runs are finished, a report with the exit code of each run
+* is written to stdout. The other output files (-list, -trace, -profile,
+* -cache, -checkpoint and -record) get a name for each run made from the input
+* file name, a dot, and the file name given in the option without directory.
+* For example, -list=debug.txt gives test1.txt.debug.txt for input test1.txt.
+*
+* Batch mode requires the fork function. It is not supported under Windows.
+*
+* Copyright 2018-2026 GNU General Public License http://www.gnu.org/licenses
+*****************************************************************************/
+
+#include "stdafx.h"
+
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+// result of one batch run
+struct SBatchRun {
+    uint32_t name;                               // input file name. offset into names buffer
+    int32_t  pid;                                // child process id. 0 if not started
+    int32_t  status;                             // exit code, or signal number if signal
+    bool     signal;                             // run was stopped by a signal
+};
+
+// give an output file of a batch run a name made from the input file name and the name in the option
+static void batchOutputName(uint32_t & option, const char * input) {
+    if (option == 0) return;                     // option not used
+    const char * name = cmd.getFilename(option);
+    const char * p = name + strlen(name);
+    while (p > name && p[-1] != '/' && p[-1] != '\\' && p[-1] != ':') p--;  // remove directory
+    char buffer[1024];
+    snprintf(buffer, sizeof(buffer), "%s.%s", input, p);
+    option = cmd.fileNameBuffer.pushString(buffer);
+}
+
+// run the program once for each input file in parallel processes.
+// returns true in each child process, which then runs the program, and false in the parent when all runs are finished
+bool CEmulator::batchRun() {
+#ifdef _WIN32
+    err.submit(ERR_EMU_BATCH);
+    return false;
+#else
+    const char * listName = cmd.getFilename(cmd.batchFile);
+    CFileBuffer list;
+    list.read(listName);
+    if (err.number()) return false;
+    // split list into lines
+    CMemoryBuffer names;                         // input file names
+    CDynamicArray<SBatchRun> runs;
+    SBatchRun run;
+    zeroAllMembers(run);
+    char * text = (char *)list.buf();
+    uint32_t size = list.dataSize();
+    uint32_t i = 0;
+    while (i < size) {
+        uint32_t start = i;
+        while (i < size && text[i] != '\n' && text[i] != '\r') i++;
+        uint32_t end = i;
+        while (i < size && (text[i] == '\n' || text[i] == '\r')) i++;
+        while (start < end && (uint8_t)text[start] <= ' ') start++;    // remove leading and trailing spaces
+        while (end > start && (uint8_t)text[end-1] <= ' ') end--;
+        if (end == start) continue;                                   // empty line
+        run.name = names.push(text + start, end - start);
+        names.push("", 1);                                            // terminating zero
+        runs.push(run);
+    }
+    uint32_t jobs = cmd.batchJobs;
+    if (jobs == 0) jobs = std::thread::hardware_concurrency();
+    if (jobs == 0) jobs = 1;
+
+    uint32_t next = 0;                           // next run to start
+    uint32_t active = 0;                         // number of runs in progress
+    fflush(stdout);  fflush(stderr);             // don't duplicate buffered output in child processes
+    while (next < runs.numEntries() || active) {
+        if (next < runs.numEntries() && active < jobs) {
+            // start a run
+            const char * input = (const char *)names.buf() + runs[next].name;
+            pid_t pid = fork();
+            if (pid == 0) {
+                // child process. redirect stdin and stdout, then run the program from the shared memory image
+                char outputName[1024];
+                snprintf(outputName, sizeof(outputName), "%s.out", input);
+                if (!freopen(input, "rb", stdin)) {
+                    err.submit(ERR_INPUT_FILE, input);  _exit(err.getWorstError());
+                }
+                if (!freopen(outputName, "w", stdout)) {
+                    err.submit(ERR_OUTPUT_FILE, outputName);  _exit(err.getWorstError());
+                }
+                // the runs must not overwrite each other's output files
+                batchOutputName(cmd.outputListFile, input);
+                batchOutputName(cmd.traceFile, input);
+                batchOutputName(cmd.profileFile, input);
+                batchOutputName(cmd.cacheFile, input);
+                batchOutputName(cmd.checkpointFile, input);
+                batchOutputName(cmd.recordFile, input);
+                return true;
+            }
+            if (pid < 0) {                       // fork failed
+                runs[next].signal = true;
+                runs[next].status = 0;
+            }
+            else {
+                runs[next].pid = pid;
+                active++;
+            }
+            next++;
+            continue;
+        }
+        // wait for any run to finish
+        int status = 0;
+        pid_t pid = wait(&status);
+        if (pid < 0) break;
+        for (i = 0; i < runs.numEntries(); i++) {
+            if (runs[i].pid != pid) continue;
+            if (WIFSIGNALED(status)) {
+                runs[i].signal = true;
+                runs[i].status = WTERMSIG(status);
+            }
+            else runs[i].status = WEXITSTATUS(status);
+            active--;
+            break;
+        }
+    }
+    // write report
+    uint32_t failed = 0;
+    printf("\nBatch run of %s, %u inputs:", cmd.getFilename(cmd.inputFile), runs.numEntries());
+    printf("\n   exit code  input");
+    for (i = 0; i < runs.numEntries(); i++) {
+        const char * input = (const char *)names.buf() + runs[i].name;
+        if (runs[i].signal) {
+            if (runs[i].pid) printf("\n  signal %3i  %s", runs[i].status, input);
+            else printf("\n  not run     %s", input);
+            failed++;
+        }
+        else {
+            printf("\n  %10i  %s", runs[i].status, input);
+            if (runs[i].status) failed++;
+        }
+    }
+    printf("\n%u of %u runs failed\n", failed, runs.numEntries());
+    if (failed) cmd.mainReturnValue = 1;
+    return false;
+#endif
+}
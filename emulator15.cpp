@@ -0,0 +1,165 @@
+/****************************  emulator15.cpp  *******************************
+* Author:        agent
+* date created:  2026-10-16
+* Last modified: 2026-10-16
+* Version:       1.01
+* Project:       Binary tools for ForwardCom instruction set
+* Description:
+* Emulator: Allocation of program memory
+*
+* Program memory is reserved with an anonymous memory mapping (VirtualAlloc
+* under Windows) rather than new and memset. The operating system supplies
+* zero pages when they are first used, so uninitialized data, heap and stacks
+* cost nothing until the program touches them. This makes it possible to give
+* a program a stack or heap of many gigabytes with -stacksize and -heapsize.
+*
+* Read-only segments are mapped from the executable file with MAP_PRIVATE, so
+* that code and constants are read from the file only when they are used. The
+* linker aligns these segments by 1 << FILE_PAGE_ALIGN in memory and in the
+* file. A segment is mapped when its file offset and its address have the same
+* position within a host page. The partial pages at the ends are copied. The
+* executable file buffers are released when the emulator is ready to run
+* (see run in emulator1.cpp).
+* Each data stack has an inaccessible guard region below it in the memory map,
+* so that a stack overflow gives an access violation (see load in emulator1.cpp).
+*
+* Under Windows, the memory is only reserved. A vectored exception handler
+* commits 64 kB at a time when the emulator first touches a reserved page. The
+* host operating system does not raise an exception when a system function
+* such as ReadFile writes to reserved memory, so the memory used by the system
+* functions of the emulated program is committed by commitMemory first.
+*
+* Copyright 2018-2026 GNU General Public License http://www.gnu.org/licenses
+*****************************************************************************/
+
+#include "stdafx.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+// committed in blocks of this size
+static const uint64_t commitGranularity = 0x10000;
+
+// reserved program memory. there is only one emulator
+static int8_t * reservedMemory = 0;
+static uint64_t reservedSize = 0;
+static void * commitHandler = 0;
+
+// commit part of reserved memory. returns false if failed
+static bool commitRange(int8_t * p, uint64_t size) {
+    int8_t * start = reservedMemory + ((p - reservedMemory) & -(int64_t)commitGranularity);
+    int8_t * end = reservedMemory + ((p + size - reservedMemory + commitGranularity - 1) & -(int64_t)commitGranularity);
+    if (end > reservedMemory + reservedSize) end = reservedMemory + reservedSize;
+    return VirtualAlloc(start, size_t(end - start), MEM_COMMIT, PAGE_READWRITE) != 0;
+}
+
+// commit reserved memory when it is first touched
+static LONG CALLBACK commitOnDemand(EXCEPTION_POINTERS * e) {
+    EXCEPTION_RECORD * r = e->ExceptionRecord;
+    if (r->ExceptionCode != EXCEPTION_ACCESS_VIOLATION || r->NumberParameters < 2) return EXCEPTION_CONTINUE_SEARCH;
+    int8_t * p = (int8_t *)r->ExceptionInformation[1];    // address accessed
+    if (p < reservedMemory || p >= reservedMemory + reservedSize) return EXCEPTION_CONTINUE_SEARCH;
+    if (!commitRange(p, 1)) return EXCEPTION_CONTINUE_SEARCH;
+    return EXCEPTION_CONTINUE_EXECUTION;
+}
+#endif
+
+// reserve memsize bytes of zero-filled program memory
+void CEmulator::allocateMemory() {
+#ifdef _WIN32
+    void * p = VirtualAlloc(0, size_t(memsize), MEM_RESERVE, PAGE_READWRITE);
+    if (!p) {
+        err.submit(ERR_MEMORY_ALLOCATION);  return;
+    }
+    reservedMemory = (int8_t *)p;
+    reservedSize = memsize;
+    commitHandler = AddVectoredExceptionHandler(1, commitOnDemand);
+#else
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_NORESERVE
+    flags |= MAP_NORESERVE;                      // don't reserve swap space for a large stack or heap that is never used
+#endif
+    void * p = mmap(0, size_t(memsize), PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (p == MAP_FAILED) {
+        err.submit(ERR_MEMORY_ALLOCATION);  return;
+    }
+#endif
+    memory = (int8_t *)p;
+}
+
+// put the data of program header ph into memory at address
+void CEmulator::loadSegment(uint32_t ph, uint64_t address) {
+    ElfFwcPhdr & header = programHeaders[ph];
+    uint64_t size = header.p_filesz;
+    if (size == 0) return;
+    int8_t * source = dataBuffer.buf() + header.p_offset;
+#ifndef _WIN32
+    if (!(header.p_flags & SHF_WRITE) && ph < fileHeader.e_phnum) {
+        // read-only segment. map the whole pages from the file
+        uint64_t fileOffset = get<ElfFwcPhdr>(uint32_t(fileHeader.e_phoff + ph * fileHeader.e_phentsize)).p_offset;
+        uint64_t hostPage = (uint64_t)sysconf(_SC_PAGESIZE);
+        uint64_t start = (address + hostPage - 1) & -(int64_t)hostPage;  // begin of first whole page
+        uint64_t end = (address + size) & -(int64_t)hostPage;            // end of last whole page
+        if (fileOffset % hostPage == address % hostPage && end > start) {
+            int fh = open(cmd.getFilename(cmd.inputFile), O_RDONLY);
+            if (fh != -1) {
+                void * p = mmap(memory + start, size_t(end - start), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fh, off_t(fileOffset + (start - address)));
+                close(fh);
+                if (p != MAP_FAILED) {
+                    // copy partial pages at the ends
+                    memcpy(memory + address, source, size_t(start - address));
+                    memcpy(memory + end, source + (end - address), size_t(address + size - end));
+                    return;
+                }
+            }
+        }
+    }
+#endif
+    memcpy(memory + address, source, size_t(size));
+}
+
+// make sure that program memory is committed before the host operating system accesses it.
+// only needed under Windows, where memory is committed when first touched by the emulator
+void CEmulator::commitMemory(uint64_t address, uint64_t size) {
+#ifdef _WIN32
+    if (reservedMemory == memory && size && address < memsize) {
+        if (size > memsize - address) size = memsize - address;
+        commitRange(memory + address, size);
+    }
+#endif
+}
+
+// check if a memory range has never been touched. it contains only zeros then.
+// only known under Windows. returns false if unknown
+bool CEmulator::memoryUntouched(uint64_t address, uint64_t size) {
+#ifdef _WIN32
+    MEMORY_BASIC_INFORMATION info;
+    if (reservedMemory != memory || VirtualQuery(memory + address, &info, sizeof(info)) == 0) return false;
+    return info.State == MEM_RESERVE && (int8_t *)info.BaseAddress + info.RegionSize >= memory + address + size;
+#else
+    return false;
+#endif
+}
+
+// free program memory allocated by allocateMemory or mapped by restoreMemory
+void CEmulator::releaseMemory() {
+#ifdef _WIN32
+    if (memoryRestored) UnmapViewOfFile(memory);
+    else {
+        if (commitHandler) RemoveVectoredExceptionHandler(commitHandler);
+        commitHandler = 0;
+        reservedMemory = 0;  reservedSize = 0;
+        VirtualFree(memory, 0, MEM_RELEASE);
+    }
+#else
+    munmap(memory, size_t(memsize));
+#endif
+    memory = 0;
+    memoryRestored = false;
+}
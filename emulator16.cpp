@@ -0,0 +1,91 @@
+/****************************  emulator16.cpp  *******************************
+* Author:        agent
+* date created:  2026-10-16
+* Last modified: 2026-10-16
+* Version:       1.01
+* Project:       Binary tools for ForwardCom instruction set
+* Description:
+* Emulator: Memory mapped files
+*
+* The system function mmap_file maps a host file into program memory, so that
+* the program can read a big input file without copying it with fread.
+* Option -mapsize=N reserves N bytes of address space at the end of memory for
+* this purpose. Each mapped file gets a new entry in the memory map, readable,
+* or readable and writeable if a private copy is requested. Writes to a private
+* copy are never written back to the file. Files stay mapped until the program
+* ends.
+*
+* The file is mapped directly from the host file with mmap, so pages are read
+* from the host page cache only when the program touches them. Under Windows,
+* the file is read into the reserved space instead.
+*
+* The new memory map entry is seen by all threads. The other threads that are
+* already running copy the memory map before their next instruction.
+*
+* Copyright 2018-2026 GNU General Public License http://www.gnu.org/licenses
+*****************************************************************************/
+
+#include "stdafx.h"
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// map file into memory. returns address and size, or 0 if failed
+uint64_t CThread::mapFile(const char * filename, bool writeable, uint64_t & size) {
+    size = 0;
+    if (emulator->mapAreaSize == 0) return 0;    // no space reserved
+    std::lock_guard<std::mutex> lock(emulator->threadMutex); // protects emulator->memoryMap and mapAreaUsed
+    uint64_t & mapAreaUsed = emulator->mapAreaUsed;
+    uint64_t mapAreaSize = emulator->mapAreaSize;
+    uint64_t address = emulator->mapArea + mapAreaUsed;
+#ifdef _WIN32
+    FILE * f = fopen(filename, "rb");
+    if (!f) return 0;
+    fseek(f, 0, SEEK_END);
+    uint64_t fileSize = (uint64_t)_ftelli64(f);
+    fseek(f, 0, SEEK_SET);
+    uint64_t length = (fileSize + MAP_FILE_ALIGN - 1) & -(int64_t)MAP_FILE_ALIGN;
+    bool ok = fileSize != 0 && mapAreaUsed + length <= mapAreaSize;
+    if (ok) emulator->commitMemory(address, fileSize);  // fread cannot write to memory that is only reserved
+    ok = ok && fread(memory + address, 1, size_t(fileSize), f) == fileSize;
+    fclose(f);
+    if (!ok) return 0;
+#else
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return 0;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);  return 0;
+    }
+    uint64_t fileSize = (uint64_t)st.st_size;
+    uint64_t length = (fileSize + MAP_FILE_ALIGN - 1) & -(int64_t)MAP_FILE_ALIGN;
+    if (mapAreaUsed + length > mapAreaSize) {
+        close(fd);  return 0;
+    }
+    // replace the reserved pages. the rest of the last page is zero
+    void * p = mmap(memory + address, size_t(fileSize), PROT_READ | (writeable ? PROT_WRITE : 0),
+        MAP_PRIVATE | MAP_FIXED, fd, 0);
+    close(fd);                                   // the mapping keeps the file open
+    if (p == MAP_FAILED) return 0;
+#endif
+    mapAreaUsed += length;
+    // add memory map entry after the existing ones. the previous terminating entry becomes a gap without access
+    SMemoryMap mapentry;
+    mapentry.startAddress = address;
+    mapentry.access_addend = SHF_DATAP | SHF_READ | (writeable ? SHF_WRITE : 0);
+    emulator->memoryMap.push(mapentry);
+    mapentry.startAddress = address + fileSize;
+    mapentry.access_addend = 0;
+    emulator->memoryMap.push(mapentry);
+    // tell the other threads. update the memory map of this thread
+    emulator->mapGeneration++;
+    memoryMap.copy(emulator->memoryMap);
+    mapGeneration = emulator->mapGeneration;
+    initPageAccess();
+    size = fileSize;
+    return address;
+}
@@ -0,0 +1,179 @@
+/****************************  emulator17.cpp  *******************************
+* Author:        agent
+* date created:  2026-10-16
+* Last modified: 2026-10-16
+* Version:       1.01
+* Project:       Binary tools for ForwardCom instruction set
+* Description:
+* Emulator: Asynchronous input and output
+*
+* The system functions aio_read and aio_write start reading or writing a file
+* and return immediately. The program continues while a pool of host threads
+* does the transfer. The request is a block of five 64-bit fields in program
+* memory: file handle (from fopen), buffer address, number of bytes, file
+* position, and result. The result field is AIO_PENDING until the transfer is
+* finished. Then it is the number of bytes transferred, or -1 if error. The
+* program can poll the result field, or wait with the system function aio_wait.
+* The request block and the buffer must not be used by the program while the
+* request is pending. aio_wait returns -1 immediately if the result field is
+* AIO_PENDING but the request block has not been submitted.
+*
+* Transfers use pread and pwrite at the given file position, so the position
+* of the FILE used by fread and fwrite is not changed. Under Windows, the
+* transfer is done before aio_read or aio_write returns.
+*
+* Copyright 2018-2026 GNU General Public License http://www.gnu.org/licenses
+*****************************************************************************/
+
+#include "stdafx.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+// constructor. starts worker threads
+CAsyncIO::CAsyncIO() {
+    queueHead = 0;
+    closing = false;
+#ifndef _WIN32
+    workers.setSize(ASYNC_IO_WORKERS);
+    for (uint32_t i = 0; i < ASYNC_IO_WORKERS; i++) {
+        workers[i] = std::thread(&CAsyncIO::workerLoop, this);
+    }
+#endif
+}
+
+// destructor. finishes all requests and stops worker threads
+CAsyncIO::~CAsyncIO() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closing = true;
+    }
+    jobReady.notify_all();
+    for (uint32_t i = 0; i < workers.numEntries(); i++) {
+        if (workers[i].joinable()) workers[i].join();
+    }
+}
+
+// queue request
+void CAsyncIO::submit(SAsyncJob const & job) {
+#ifdef _WIN32
+    *job.result = perform(job);                  // no positioned read and write. do it now
+#else
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push(job);
+        submitted.push(job.result);
+    }
+    jobReady.notify_one();
+#endif
+}
+
+// wait until request is finished. returns result
+int64_t CAsyncIO::wait(int64_t * result) {
+    std::unique_lock<std::mutex> lock(mutex);
+    jobDone.wait(lock, [this, result] { return !inFlight(result); });
+    if (*result == AIO_PENDING) return -1;       // never submitted. don't wait forever
+    return *result;
+}
+
+// check if request is queued or in progress. mutex must be locked
+bool CAsyncIO::inFlight(int64_t const * result) {
+    for (uint32_t i = 0; i < submitted.numEntries(); i++) {
+        if (submitted[i] == result) return true;
+    }
+    return false;
+}
+
+// worker thread
+void CAsyncIO::workerLoop() {
+    SAsyncJob job;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            // requests queued before closing are finished
+            jobReady.wait(lock, [this] { return closing || queueHead < queue.numEntries(); });
+            if (queueHead >= queue.numEntries()) return;
+            job = queue[queueHead++];
+            if (queueHead == queue.numEntries()) {
+                queue.setNum(0);                 // queue is empty. reuse space
+                queueHead = 0;
+            }
+        }
+        int64_t done = perform(job);
+        {
+            // store result under the lock so that wait() cannot miss it
+            std::lock_guard<std::mutex> lock(mutex);
+            *job.result = done;
+            for (uint32_t i = 0; i < submitted.numEntries(); i++) {
+                if (submitted[i] == job.result) {
+                    submitted[i] = submitted[submitted.numEntries() - 1];  // remove from list
+                    submitted.pop();
+                    break;
+                }
+            }
+        }
+        jobDone.notify_all();
+    }
+}
+
+// read or write file. returns number of bytes transferred, or -1 if error
+int64_t CAsyncIO::perform(SAsyncJob const & job) {
+    int64_t done = 0;                            // bytes transferred
+#ifdef _WIN32
+    if (_fseeki64(job.file, job.offset, SEEK_SET) != 0) done = -1;
+    else if (job.write) done = (int64_t)fwrite(job.buffer, 1, size_t(job.size), job.file);
+    else done = (int64_t)fread(job.buffer, 1, size_t(job.size), job.file);
+#else
+    int fd = fileno(job.file);
+    while ((uint64_t)done < job.size) {
+        ssize_t n = job.write
+            ? pwrite(fd, job.buffer + done, size_t(job.size - done), (off_t)(job.offset + done))
+            : pread(fd, job.buffer + done, size_t(job.size - done), (off_t)(job.offset + done));
+        if (n < 0) {
+            done = -1;  break;                   // error
+        }
+        if (n == 0) break;                       // end of file
+        done += n;
+    }
+#endif
+    return done;
+}
+
+// asynchronous input/output system functions. request is the address of a request block
+uint64_t CThread::asyncRequest(uint64_t request, uint32_t funcid, uint8_t rd, uint8_t rs) {
+    const uint64_t blockSize = 5 * 8;
+    if ((request & 7) || checkSysMemAccess(request, blockSize, rd, rs, SHF_READ | SHF_WRITE) < blockSize) {
+        interrupt(INT_ACCESS_WRITE);
+        return (uint64_t)(int64_t)-1;
+    }
+    uint64_t * block = (uint64_t *)(memory + request);
+    int64_t * result = (int64_t *)(block + 4);
+    {
+        // start worker threads on first use
+        std::lock_guard<std::mutex> lock(emulator->threadMutex);
+        if (emulator->asyncIO == 0) emulator->asyncIO = new CAsyncIO;
+    }
+    if (funcid == SYSF_AIO_WAIT) {
+        return (uint64_t)emulator->asyncIO->wait(result);
+    }
+    SAsyncJob job;
+    job.file = (FILE *)block[0];
+    job.size = block[2];
+    job.offset = (int64_t)block[3];
+    job.result = result;
+    job.write = funcid == SYSF_AIO_WRITE;
+    if (job.file == 0 || job.offset < 0 || checkSysMemAccess(block[1], job.size, rd, rs, job.write ? SHF_READ : SHF_WRITE) < job.size) {
+        *result = -1;
+        return (uint64_t)(int64_t)-1;
+    }
+    job.buffer = memory + block[1];
+    if (job.write) fflush(job.file);             // data written by fwrite must come first
+    if (cmd.recordFile) {
+        *result = CAsyncIO::perform(job);        // finish now so that the data can be logged
+        return 0;
+    }
+    *result = AIO_PENDING;
+    emulator->asyncIO->submit(job);
+    return 0;
+}
@@ -0,0 +1,366 @@
+/****************************  emulator18.cpp  *******************************
+* Author:        agent
+* date created:  2026-10-16
+* Last modified: 2026-10-16
+* Version:       1.01
+* Project:       Binary tools for ForwardCom instruction set
+* Description:
+* Emulator: Heap allocation
+*
+* The system functions malloc, free, realloc and aligned_alloc manage the heap
+* reserved with option -heapsize. The heap is divided into spans of 64 kB.
+* A span holds blocks of one size class. There are 16 size classes in steps of
+* 16 bytes up to 256 bytes, and powers of 2 from 512 bytes to 32 kB. A block
+* bigger than 32 kB gets whole spans of its own.
+*
+* The data of the allocator are kept in the heap itself, so that they are saved
+* by the checkpoint function and copied to each run in batch mode: a header
+* with the free lists, followed by a table with one entry for each span, and a
+* bitmap for each span with one bit for each allocated small block. Free blocks
+* are linked through their first 8 bytes. All of this is in program memory, so
+* the program can overwrite it. The addresses of the span table, the bitmaps
+* and the spans are therefore kept in CEmulator, and every list head, link and
+* table entry is checked before it is used. A program that writes to freed
+* memory or to the heap header can lose free blocks, but cannot make the
+* emulator read or write outside the heap. Freeing a block that is not
+* allocated, or freeing the same block twice, gives an access violation.
+*
+* A run of free spans has its number of spans in the table entry of both its
+* first and its last span, so that it can be merged with free runs before and
+* after it when spans are freed. A run at the end of the used spans goes back
+* to the part of the heap that has never been used.
+*
+* Each thread has a cache of free blocks of each size class, so that most calls
+* to malloc need no lock. The allocated bits are changed with atomic
+* instructions for this reason. The cache is filled from and returned to the
+* free lists in the heap, protected by CEmulator::heapMutex. free takes
+* heapMutex to check that the block is allocated. Blocks in the cache of a
+* thread are not saved by the checkpoint function. Spans used for small blocks
+* are never returned for large blocks.
+*
+* Copyright 2018-2026 GNU General Public License http://www.gnu.org/licenses
+*****************************************************************************/
+
+#include "stdafx.h"
+#ifdef _MSC_VER
+#include <intrin.h>                              // _InterlockedOr64
+#endif
+
+const uint32_t HEAP_SPAN_BITS  = 16;             // log2(span size)
+const uint64_t HEAP_SPAN_SIZE  = (uint64_t)1 << HEAP_SPAN_BITS;
+const uint64_t HEAP_MAX_SMALL  = 0x8000;         // biggest block in a size class
+const uint64_t HEAP_BITMAP_SIZE = HEAP_SPAN_SIZE / 16 / 8; // bytes of allocated bits for each span
+
+// span table entries
+const uint32_t HEAP_SPAN_SMALL = 0x10000000;     // blocks of the size class in the low bits
+const uint32_t HEAP_SPAN_FREE  = 0x40000000;     // first and last span of a free run. number of spans in the low bits
+const uint32_t HEAP_SPAN_LARGE = 0x80000000;     // first span of a large block. number of spans in the low bits
+const uint32_t HEAP_SPAN_COUNT = 0x0FFFFFFF;     // mask for size class or number of spans
+
+// header at the start of the heap. all zero before the first use
+struct SHeapHeader {
+    uint64_t top;                                // first span never used. 0 until initialized
+    uint64_t largeFree;                          // first free run of spans. 0 if none
+    uint64_t freeList[HEAP_NUM_CLASSES];         // first free block of each size class. 0 if none
+};
+
+// size class for block size. -1 if large block
+static inline int32_t heapSizeClass(uint64_t size) {
+    if (size <= 256) return size ? int32_t((size - 1) >> 4) : 0;
+    if (size > HEAP_MAX_SMALL) return -1;
+    return int32_t(bitScanReverse(size - 1)) + 8;   // 512 bytes = class 16
+}
+
+// block size for size class c
+static inline uint64_t heapClassSize(uint32_t c) {
+    return c < 16 ? (c + 1) * 16 : (uint64_t)512 << (c - 16);
+}
+
+// atomic change of a word of allocated bits. sets bits if set, otherwise keeps only bits.
+// returns the old value
+static inline uint64_t heapBitsUpdate(uint64_t * p, uint64_t bits, bool set) {
+#if defined(__GNUC__)
+    return set ? __atomic_fetch_or(p, bits, __ATOMIC_RELAXED) : __atomic_fetch_and(p, bits, __ATOMIC_RELAXED);
+#elif defined(_MSC_VER)
+    return set ? (uint64_t)_InterlockedOr64((long long*)p, (long long)bits)
+        : (uint64_t)_InterlockedAnd64((long long*)p, (long long)bits);
+#else
+    uint64_t old = *p;
+    *p = set ? old | bits : old & bits;
+    return old;
+#endif
+}
+
+// find addresses of span table, bitmaps and spans. called by load
+void CEmulator::heapLayout() {
+    // span table and bitmaps follow the header. spans are aligned to their size
+    uint64_t numSpans = heapSize >> HEAP_SPAN_BITS;   // maximum number of spans
+    heapTable = heapStart + sizeof(SHeapHeader);
+    heapBitmaps = (heapTable + numSpans * sizeof(uint32_t) + 7) & -8;
+    heapSpanBase = (heapBitmaps + numSpans * HEAP_BITMAP_SIZE + HEAP_SPAN_SIZE - 1) & -(int64_t)HEAP_SPAN_SIZE;
+    heapSpanEnd = (heapStart + heapSize) & -(int64_t)HEAP_SPAN_SIZE;
+    if (heapSpanEnd < heapSpanBase) heapSpanEnd = heapSpanBase;   // heap too small. no spans
+}
+
+// initialize heap allocator the first time it is used. heapMutex must be locked
+void CEmulator::heapInit() {
+    SHeapHeader * h = (SHeapHeader *)(memory + heapStart);
+    if (h->top == 0) h->top = heapSpanBase;      // first use
+    else if (h->top < heapSpanBase || h->top > heapSpanEnd || (h->top & (HEAP_SPAN_SIZE - 1))) {
+        h->top = heapSpanEnd;                    // overwritten by the program. the unused spans are lost
+    }
+}
+
+// span table entry for address. 0 if outside heap
+uint32_t * CEmulator::heapSpanEntry(uint64_t address) {
+    if (address < heapSpanBase || address >= heapSpanEnd) return 0;
+    return (uint32_t *)(memory + heapTable) + ((address - heapSpanBase) >> HEAP_SPAN_BITS);
+}
+
+// word of allocated bits for small block of the given size. bit gets the bit for the block
+uint64_t * CEmulator::heapAllocatedBits(uint64_t address, uint64_t size, uint64_t & bit) {
+    uint64_t index = (address & (HEAP_SPAN_SIZE - 1)) / size;   // block number within span
+    bit = (uint64_t)1 << (index & 63);
+    return (uint64_t *)(memory + heapBitmaps + ((address - heapSpanBase) >> HEAP_SPAN_BITS) * HEAP_BITMAP_SIZE) + (index >> 6);
+}
+
+// check that a free list head or link points to a free block of size class c
+bool CEmulator::heapFreeBlock(uint64_t block, uint32_t c) {
+    uint32_t * entry = heapSpanEntry(block);
+    uint64_t size = heapClassSize(c);
+    if (entry == 0 || *entry != (HEAP_SPAN_SMALL | c) || ((block & (HEAP_SPAN_SIZE - 1)) % size) != 0) return false;
+    uint64_t bit;
+    uint64_t * bits = heapAllocatedBits(block, size, bit);
+    return (heapBitsUpdate(bits, 0, true) & bit) == 0;
+}
+
+// take up to n free blocks of size class c. returns number of blocks. heapMutex must be locked
+uint32_t CEmulator::heapTake(uint32_t c, uint64_t * blocks, uint32_t n) {
+    SHeapHeader * h = (SHeapHeader *)(memory + heapStart);
+    uint64_t size = heapClassSize(c);
+    uint32_t i = 0;
+    while (i < n) {
+        uint64_t block = h->freeList[c];
+        if (block && !heapFreeBlock(block, c)) {
+            block = h->freeList[c] = 0;          // overwritten by the program. forget the list
+        }
+        if (block == 0) {
+            // free list is empty. make a new span and link all its blocks
+            uint64_t span = heapSpans(1, HEAP_SPAN_SIZE);
+            if (span == 0) break;                // heap is full
+            *heapSpanEntry(span) = HEAP_SPAN_SMALL | c;
+            uint64_t num = HEAP_SPAN_SIZE / size;
+            for (uint64_t k = 0; k < num; k++) {
+                *(uint64_t*)(memory + span + k * size) = k + 1 < num ? span + (k + 1) * size : 0;
+            }
+            h->freeList[c] = span;
+            continue;
+        }
+        // follow link only if it points to a free block of the same size class
+        uint64_t next = *(uint64_t*)(memory + block);
+        if (!heapFreeBlock(next, c)) next = 0;
+        h->freeList[c] = next;
+        blocks[i++] = block;
+    }
+    return i;
+}
+
+// return n free blocks of size class c. heapMutex must be locked
+void CEmulator::heapGive(uint32_t c, uint64_t const * blocks, uint32_t n) {
+    SHeapHeader * h = (SHeapHeader *)(memory + heapStart);
+    for (uint32_t i = 0; i < n; i++) {
+        *(uint64_t*)(memory + blocks[i]) = h->freeList[c];
+        h->freeList[c] = blocks[i];
+    }
+}
+
+// allocate n spans with the given alignment. returns address, or 0 if heap is full. heapMutex must be locked
+uint64_t CEmulator::heapSpans(uint64_t n, uint64_t alignment) {
+    SHeapHeader * h = (SHeapHeader *)(memory + heapStart);
+    if (n == 0 || n > HEAP_SPAN_COUNT || alignment < HEAP_SPAN_SIZE) return 0;
+    // first fit in list of free runs
+    uint64_t * link = &h->largeFree;
+    uint64_t numSpans = (heapSpanEnd - heapSpanBase) >> HEAP_SPAN_BITS;
+    for (uint64_t i = 0; *link; i++) {
+        uint64_t run = *link;
+        if (i >= numSpans) {
+            *link = 0;  break;                   // list has a loop
+        }
+        uint32_t * entry = heapSpanEntry(run);
+        if (entry == 0 || !(*entry & HEAP_SPAN_FREE) || (run & (HEAP_SPAN_SIZE - 1))) {
+            *link = 0;  break;                   // list is broken. forget the rest
+        }
+        uint64_t runSpans = *entry & HEAP_SPAN_COUNT;
+        if (runSpans > (heapSpanEnd - run) >> HEAP_SPAN_BITS) {
+            *link = 0;  break;
+        }
+        uint64_t start = (run + alignment - 1) & -(int64_t)alignment;
+        uint64_t skip = (start - run) >> HEAP_SPAN_BITS;
+        if (skip + n <= runSpans) {
+            *link = *(uint64_t*)(memory + run);  // remove run from list
+            *entry = 0;
+            entry[runSpans - 1] = 0;             // last span of run
+            // put unused parts before and after back into the list
+            if (skip) heapFreeSpans(run, skip);
+            if (skip + n < runSpans) heapFreeSpans(start + (n << HEAP_SPAN_BITS), runSpans - skip - n);
+            return start;
+        }
+        link = (uint64_t*)(memory + run);
+    }
+    // take spans never used before
+    uint64_t start = (h->top + alignment - 1) & -(int64_t)alignment;
+    if (start < h->top || start > heapSpanEnd || n > (heapSpanEnd - start) >> HEAP_SPAN_BITS) return 0;
+    uint64_t skipped = h->top;
+    h->top = start + (n << HEAP_SPAN_BITS);
+    if (start > skipped) heapFreeSpans(skipped, (start - skipped) >> HEAP_SPAN_BITS);
+    return start;
+}
+
+// remove free run from list of free runs. heapMutex must be locked
+void CEmulator::heapUnlinkRun(uint64_t run) {
+    SHeapHeader * h = (SHeapHeader *)(memory + heapStart);
+    uint64_t * link = &h->largeFree;
+    uint64_t numSpans = (heapSpanEnd - heapSpanBase) >> HEAP_SPAN_BITS;
+    for (uint64_t i = 0; *link && i < numSpans; i++) {
+        if (*link == run) {
+            *link = *(uint64_t*)(memory + run);
+            return;
+        }
+        uint32_t * entry = heapSpanEntry(*link);
+        if (entry == 0 || !(*entry & HEAP_SPAN_FREE) || (*link & (HEAP_SPAN_SIZE - 1))) {
+            *link = 0;  return;                  // list is broken. forget the rest
+        }
+        link = (uint64_t*)(memory + *link);
+    }
+}
+
+// free n spans at address. heapMutex must be locked
+void CEmulator::heapFreeSpans(uint64_t address, uint64_t n) {
+    SHeapHeader * h = (SHeapHeader *)(memory + heapStart);
+    uint32_t * table = (uint32_t *)(memory + heapTable);
+    uint64_t numSpans = (heapSpanEnd - heapSpanBase) >> HEAP_SPAN_BITS;
+    uint64_t first = (address - heapSpanBase) >> HEAP_SPAN_BITS;   // index of first span
+    uint64_t end = first + n;                    // index after last span
+    table[first] = 0;  table[end - 1] = 0;
+    // merge with free run before
+    if (first > 0 && (table[first - 1] & HEAP_SPAN_FREE)) {
+        uint64_t m = table[first - 1] & HEAP_SPAN_COUNT;
+        if (m && m <= first && table[first - m] == table[first - 1]) {
+            heapUnlinkRun(heapSpanBase + ((first - m) << HEAP_SPAN_BITS));
+            table[first - m] = 0;  table[first - 1] = 0;
+            first -= m;
+        }
+    }
+    // merge with free run after
+    if (end < numSpans && (table[end] & HEAP_SPAN_FREE)) {
+        uint64_t m = table[end] & HEAP_SPAN_COUNT;
+        if (m && m <= numSpans - end && table[end + m - 1] == table[end]) {
+            heapUnlinkRun(heapSpanBase + (end << HEAP_SPAN_BITS));
+            table[end] = 0;  table[end + m - 1] = 0;
+            end += m;
+        }
+    }
+    address = heapSpanBase + (first << HEAP_SPAN_BITS);
+    if (heapSpanBase + (end << HEAP_SPAN_BITS) == h->top) {
+        h->top = address;                        // last spans used. give back to the unused part
+        return;
+    }
+    table[first] = table[end - 1] = HEAP_SPAN_FREE | (uint32_t)(end - first);
+    *(uint64_t*)(memory + address) = h->largeFree;
+    h->largeFree = address;
+}
+
+// size of allocated heap block. 0 if not an allocated block. heapMutex must be locked
+uint64_t CEmulator::heapBlock(uint64_t address) {
+    uint32_t * entry = heapSpanEntry(address);
+    if (entry == 0) return 0;
+    if (*entry & HEAP_SPAN_LARGE) {
+        uint64_t n = *entry & HEAP_SPAN_COUNT;
+        if ((address & (HEAP_SPAN_SIZE - 1)) || n > (heapSpanEnd - address) >> HEAP_SPAN_BITS) return 0;
+        return n << HEAP_SPAN_BITS;
+    }
+    uint32_t c = *entry & HEAP_SPAN_COUNT;       // size class
+    if ((*entry & ~HEAP_SPAN_COUNT) != HEAP_SPAN_SMALL || c >= HEAP_NUM_CLASSES) return 0;
+    uint64_t size = heapClassSize(c);
+    if (((address & (HEAP_SPAN_SIZE - 1)) % size) != 0) return 0;
+    uint64_t bit;
+    uint64_t * bits = heapAllocatedBits(address, size, bit);
+    if (!(heapBitsUpdate(bits, 0, true) & bit)) return 0;       // not allocated
+    return size;
+}
+
+// size of allocated heap block. 0 if not an allocated block
+uint64_t CThread::heapBlockSize(uint64_t address) {
+    if (emulator->heapSize == 0) return 0;
+    std::lock_guard<std::mutex> lock(emulator->heapMutex);
+    return emulator->heapBlock(address);
+}
+
+// allocate heap block. alignment must be a power of 2. returns 0 if failed
+uint64_t CThread::heapAllocate(uint64_t size, uint64_t alignment) {
+    if (emulator->heapSize == 0 || (alignment & (alignment - 1)) || size > emulator->heapSize) return 0;
+    if (alignment > 16) {
+        // blocks with a size that is a power of 2 are aligned by their size
+        if (size < alignment) size = alignment;
+        if (size <= HEAP_MAX_SMALL) size = (uint64_t)1 << bitScanReverse(size * 2 - 1);
+    }
+    int32_t c = heapSizeClass(size);
+    if (c >= 0) {
+        if (heapCacheNum[c] == 0) {
+            // fill half of the cache from the free list
+            std::lock_guard<std::mutex> lock(emulator->heapMutex);
+            emulator->heapInit();
+            heapCacheNum[c] = emulator->heapTake(c, heapCache[c], HEAP_CACHE_SIZE / 2);
+            if (heapCacheNum[c] == 0) return 0;
+        }
+        uint64_t address = heapCache[c][--heapCacheNum[c]];
+        uint64_t bit;
+        uint64_t * bits = emulator->heapAllocatedBits(address, heapClassSize(c), bit);
+        heapBitsUpdate(bits, bit, true);         // mark as allocated
+        return address;
+    }
+    // large block
+    std::lock_guard<std::mutex> lock(emulator->heapMutex);
+    emulator->heapInit();
+    uint64_t n = (size + HEAP_SPAN_SIZE - 1) >> HEAP_SPAN_BITS;
+    uint64_t address = emulator->heapSpans(n, alignment > HEAP_SPAN_SIZE ? alignment : HEAP_SPAN_SIZE);
+    if (address) *emulator->heapSpanEntry(address) = HEAP_SPAN_LARGE | (uint32_t)n;
+    return address;
+}
+
+// free heap block. returns false if not an allocated block or already freed
+bool CThread::heapFree(uint64_t address) {
+    if (address == 0) return true;
+    if (emulator->heapSize == 0) return false;
+    std::lock_guard<std::mutex> lock(emulator->heapMutex);
+    uint64_t size = emulator->heapBlock(address);
+    if (size == 0) return false;
+    int32_t c = heapSizeClass(size);
+    if (c >= 0) {
+        uint64_t bit;
+        uint64_t * bits = emulator->heapAllocatedBits(address, size, bit);
+        heapBitsUpdate(bits, ~bit, false);       // mark as free
+        if (heapCacheNum[c] == HEAP_CACHE_SIZE) {
+            // cache is full. return half of it to the free list
+            heapCacheNum[c] -= HEAP_CACHE_SIZE / 2;
+            emulator->heapGive(c, heapCache[c] + heapCacheNum[c], HEAP_CACHE_SIZE / 2);
+        }
+        heapCache[c][heapCacheNum[c]++] = address;
+        return true;
+    }
+    emulator->heapFreeSpans(address, size >> HEAP_SPAN_BITS);
+    return true;
+}
+
+// change size of heap block. returns new address, or 0 if failed
+uint64_t CThread::heapReallocate(uint64_t address, uint64_t size) {
+    if (address == 0) return heapAllocate(size, 16);
+    uint64_t oldSize = heapBlockSize(address);
+    if (oldSize == 0) return 0;
+    if (size <= oldSize && size > oldSize / 2) return address;   // fits and does not waste too much
+    uint64_t newAddress = heapAllocate(size, 16);
+    if (newAddress == 0) return 0;               // old block is unchanged
+    memcpy(memory + newAddress, memory + address, size_t(size < oldSize ? size : oldSize));
+    heapFree(address);
+    return newAddress;
+}
@@ -0,0 +1,204 @@
+/****************************  emulator19.cpp  *******************************
+* Author:        agent
+* date created:  2026-10-16
+* Last modified: 2026-10-16
+* Version:       1.01
+* Project:       Binary tools for ForwardCom instruction set
+* Description:
+* Emulator: Record and replay of system calls
+*
+* Option -record=filename writes the result of each system function that
+* depends on the host to a log file: time, file and stdin input, and the other
+* file functions. The log contains the return value and the data that the
+* function wrote into program memory. Option -replay=filename runs the program
+* again with the results taken from the log instead of the host, so that the
+* run is exactly the same and no files or stdin are read. Output to stdout
+* with puts, putchar and printf is still written when replaying. fprintf and
+* fwrite are not, because the file handles in the log are not valid files.
+*
+* The log is read into memory before the program starts. Each thread reads its
+* own records in the order they were written, so a program with several
+* threads can be replayed only if the threads make the same calls as when
+* recording. Asynchronous transfers are done before aio_read or aio_write
+* returns when recording, so that the data can be logged. mmap_file fails when
+* recording or replaying.
+*
+* The log file has a header with a checksum of the executable file, followed
+* by a record for each call. A record is an SReplayRecord followed by blocks of
+* data, each an SReplayBlock followed by the data padded to a multiple of 8
+* bytes.
+*
+* Copyright 2018-2026 GNU General Public License http://www.gnu.org/licenses
+*****************************************************************************/
+
+#include "stdafx.h"
+
+const uint32_t REPLAY_SIGNATURE = 0x50524346;    // "FCRP"
+const uint32_t REPLAY_VERSION   = 1;
+const uint32_t REPLAY_TERMINATED = 1;            // flag: the call gave an access violation
+
+// header of log file
+struct SReplayHeader {
+    uint32_t signature;                          // REPLAY_SIGNATURE
+    uint32_t version;                            // REPLAY_VERSION
+    uint64_t checksum;                           // checksum of executable file
+};
+
+// record of one system call
+struct SReplayRecord {
+    uint32_t length;                             // size of record including data blocks
+    uint32_t funcid;                             // system function id
+    uint32_t thread;                             // thread number
+    uint32_t flags;                              // REPLAY_TERMINATED
+    uint64_t result;                             // return value in r0
+};
+
+// data written into program memory by the system call
+struct SReplayBlock {
+    uint64_t address;                            // address in program memory
+    uint64_t size;                               // number of bytes following
+};
+
+// system functions that are recorded and replayed
+bool CThread::replayFunction(uint32_t funcid) {
+    switch (funcid) {
+    case SYSF_TIME:  case SYSF_FPRINTF:  case SYSF_FOPEN:  case SYSF_FCLOSE:
+    case SYSF_FREAD:  case SYSF_FWRITE:  case SYSF_FFLUSH:  case SYSF_FEOF:
+    case SYSF_FTELL:  case SYSF_FSEEK:  case SYSF_FERROR:  case SYSF_GETCHAR:
+    case SYSF_FGETC:  case SYSF_FGETS:  case SYSF_GETS_S:  case SYSF_REMOVE:
+    case SYSF_AIO_READ:  case SYSF_AIO_WRITE:
+        return true;
+    }
+    return false;
+}
+
+// open log file for option -record or read log file for option -replay
+void CEmulator::replayStart() {
+    SReplayHeader header;
+    if (cmd.recordFile) {
+        const char * filename = cmd.getFilename(cmd.recordFile);
+        recordFile = fopen(filename, "wb");
+        if (!recordFile) {
+            err.submit(ERR_OUTPUT_FILE, filename);  return;
+        }
+        header.signature = REPLAY_SIGNATURE;
+        header.version = REPLAY_VERSION;
+        header.checksum = fileChecksum;
+        fwrite(&header, 1, sizeof(header), recordFile);
+    }
+    if (cmd.replayFile) {
+        const char * filename = cmd.getFilename(cmd.replayFile);
+        replayLog.read(filename);
+        if (err.number()) return;
+        if (replayLog.dataSize() < sizeof(header)) {
+            err.submit(ERR_EMU_REPLAY, filename);  return;
+        }
+        memcpy(&header, replayLog.buf(), sizeof(header));
+        if (header.signature != REPLAY_SIGNATURE || header.version != REPLAY_VERSION
+        || header.checksum != fileChecksum) {
+            err.submit(ERR_EMU_REPLAY, filename);
+        }
+    }
+}
+
+// close log file
+void CEmulator::replayFinish() {
+    if (recordFile) {
+        if (fclose(recordFile) != 0) err.submit(ERR_OUTPUT_FILE, cmd.getFilename(cmd.recordFile));
+        recordFile = 0;
+    }
+}
+
+// write system call to log file. args = registers r0 - r3 before the call
+void CThread::recordCall(uint32_t funcid, uint64_t const * args, uint8_t rd, uint8_t rs) {
+    SReplayBlock blocks[2];                      // data written into program memory
+    uint32_t numBlocks = 0;
+    SReplayRecord record;
+    record.funcid = funcid;
+    record.thread = threadNumber;
+    record.flags = terminate ? REPLAY_TERMINATED : 0;
+    record.result = registers[0];
+    if (!terminate) {
+        switch (funcid) {
+        case SYSF_TIME:
+            if (args[0] && checkSysMemAccess(args[0], 8, rd, rs, SHF_WRITE)) {
+                blocks[numBlocks].address = args[0];  blocks[numBlocks++].size = 8;
+            }
+            break;
+        case SYSF_FREAD:
+            blocks[numBlocks].address = args[0];  blocks[numBlocks++].size = registers[0] * args[1];
+            break;
+        case SYSF_FGETS:  case SYSF_GETS_S:
+            if (registers[0] && args[1]) {       // string including terminating zero
+                blocks[numBlocks].address = args[0];
+                blocks[numBlocks++].size = strnlen((const char*)memory + args[0], (size_t)args[1] - 1) + 1;
+            }
+            break;
+        case SYSF_AIO_READ:  case SYSF_AIO_WRITE: {
+            // the transfer is finished. log the data and the result field of the request block
+            int64_t done = *(int64_t *)(memory + args[0] + 32);
+            if (funcid == SYSF_AIO_READ && done > 0) {
+                blocks[numBlocks].address = *(uint64_t *)(memory + args[0] + 8);
+                blocks[numBlocks++].size = (uint64_t)done;
+            }
+            blocks[numBlocks].address = args[0] + 32;  blocks[numBlocks++].size = 8;
+            break;}
+        }
+    }
+    uint64_t length = sizeof(record);
+    for (uint32_t i = 0; i < numBlocks; i++) length += sizeof(SReplayBlock) + ((blocks[i].size + 7) & -8);
+    record.length = (uint32_t)length;
+    const uint64_t zero = 0;
+    std::lock_guard<std::mutex> lock(emulator->recordMutex);
+    FILE * f = emulator->recordFile;
+    fwrite(&record, 1, sizeof(record), f);
+    for (uint32_t i = 0; i < numBlocks; i++) {
+        fwrite(&blocks[i], 1, sizeof(SReplayBlock), f);
+        fwrite(memory + blocks[i].address, 1, (size_t)blocks[i].size, f);
+        fwrite(&zero, 1, size_t(-(int64_t)blocks[i].size & 7), f);  // padding
+    }
+}
+
+// take result of system call from log instead of calling the host
+void CThread::replayCall(uint32_t funcid, uint8_t rd, uint8_t rs) {
+    CFileBuffer & log = emulator->replayLog;
+    if (replayPos == 0) replayPos = sizeof(SReplayHeader);
+    // find next record of this thread
+    SReplayRecord record;
+    while (true) {
+        if (replayPos + sizeof(record) > log.dataSize()) goto MISMATCH;  // no more records
+        memcpy(&record, log.buf() + replayPos, sizeof(record));
+        if (record.length < sizeof(record) || record.length > log.dataSize() - replayPos) goto MISMATCH;
+        if (record.thread == threadNumber) break;
+        replayPos += record.length;
+    }
+    if (record.funcid != funcid) goto MISMATCH;
+    {
+        // copy data blocks into program memory
+        uint32_t pos = replayPos + sizeof(record);
+        uint32_t end = replayPos + record.length;
+        replayPos = end;
+        while (pos < end) {
+            SReplayBlock block;
+            if (end - pos < sizeof(block)) goto MISMATCH;
+            memcpy(&block, log.buf() + pos, sizeof(block));
+            pos += sizeof(block);
+            if (block.size > end - pos) goto MISMATCH;
+            if (checkSysMemAccess(block.address, block.size, rd, rs, SHF_WRITE) < block.size) {
+                interrupt(INT_ACCESS_WRITE);  return;
+            }
+            memcpy(memory + block.address, log.buf() + pos, (size_t)block.size);
+            pos += (uint32_t)((block.size + 7) & -8);
+        }
+    }
+    registers[0] = record.result;
+    if (record.flags & REPLAY_TERMINATED) {
+        interrupt(funcid == SYSF_FWRITE ? INT_ACCESS_READ : INT_ACCESS_WRITE);
+    }
+    return;
+
+MISMATCH:  // the program does not make the same calls as when recording
+    err.submit(ERR_EMU_REPLAY, cmd.getFilename(cmd.replayFile));
+    emulator->stopAllThreads = true;
+    terminate = true;
+}
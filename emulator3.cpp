@@ -819,6 +819,11 @@ static uint64_t return_62(CThread * t) {
     switch (t->fInstr->format2) {
     case 0x143: // return
         if (t->callStack.numEntries() == 0) {
+            if (t->threadNumber) {               // return from thread function ends the thread
+                t->terminate = true;
+                target = t->ip;
+                break;
+            }
             t->interrupt(INT_CALL_STACK);        // call stack empty
             target = t->entry_point;             // return to program start            
         }
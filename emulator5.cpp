@@ -173,8 +173,8 @@ static uint64_t write_capabilities(CThread * t) {
 }
 
 static uint64_t read_perf(CThread * t) {
-    // Read performance counter
-    return 0;
+    // Read performance counter RS. The immediate operand selects a value for counters with more than one value
+    return t->readPerf(t->rs, t->parm[2].i);
 }
 
 static uint64_t read_sys(CThread * t) {
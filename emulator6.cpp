@@ -789,19 +789,17 @@ static uint64_t store_i32 (CThread * t) {
     return 0;
 }
 
-//static uint64_t fence_ (CThread * t) {return f_nop(t);}
+static uint64_t fence_ (CThread * t) {
+    // Memory fence. Memory operations of other threads are ordered by a full fence on the host
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return f_nop(t);
+}
 
 static uint64_t compare_swap (CThread * t) {
     // Atomic compare and exchange with address [RT+IM2]
     uint64_t val1 = t->parm[0].q;
     uint64_t val2 = t->parm[1].q;
-    // to do: use intrinsic compareandexchange or mutex or pause all threads if multiple threads
-    uint64_t address = t->memAddress;
-    uint64_t sizemask = dataSizeMask[t->operandType]; // mask for operand size
-    uint64_t val3 = t->readMemoryOperand(address);    // read value from memory
-    if (((val3 ^ val1) & sizemask) == 0) {            // value match
-        t->writeMemoryOperand(val2, address);         // write new value to memory
-    }
+    uint64_t val3 = t->compareSwapMemory(t->memAddress, val1, val2); // old value
     t->vect = 4;                                      // stop vector loop
     return val3;                                      // return old value
 }
@@ -1065,7 +1063,7 @@ PFunc funcTab8[64] = {
 PFunc funcTab10[64] = {
     0, 0, 0, 0, 0, 0, 0, 0,                                                 // 0 - 7
     store_i32, 0, 0, 0, 0, 0, 0, 0,                                         // 8 - 15
-    f_nop, 0, compare_swap, 0, 0, 0, 0, 0,                                  // 16 - 23
+    fence_, 0, compare_swap, 0, 0, 0, 0, 0,                                 // 16 - 23
     read_insert, 0, 0, 0, 0, 0, 0, 0,                                       // 24 - 31
     extract_store, 0, 0, 0, 0, 0, 0, 0,                                     // 32 - 39
 };
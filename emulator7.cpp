@@ -12,6 +12,12 @@
 
 #include "stdafx.h"
 
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
 // Data encoding names
 SIntTxt interruptNames[] = {
     {INT_UNKNOWN_INST,       "Unknown instruction"},
@@ -35,6 +41,11 @@ SIntTxt systemFunctionNames[] = {
     {SYSF_EXIT,              "exit"},       // terminate program
     {SYSF_ABORT,             "abort"},      // abort program
     {SYSF_TIME,              "time"},       // time in seconds since jan 1, 1970    
+    {SYSF_THREAD_CREATE,     "thread_create"}, // start a new thread
+    {SYSF_THREAD_JOIN,       "thread_join"},   // wait for a thread to finish
+    {SYSF_THREAD_EXIT,       "thread_exit"},   // end current thread
+    {SYSF_THREAD_ID,         "thread_id"},     // get thread number
+    {SYSF_CHECKPOINT,        "checkpoint"},    // save program state
 
 // input/output functions
     {SYSF_PUTS,              "puts"},       // write string to stdout
@@ -58,6 +69,20 @@ SIntTxt systemFunctionNames[] = {
     {SYSF_FSCANF,            "fscanf"},     // read formatted input from file 
     {SYSF_SSCANF,            "sscanf"},     // read formatted input from string buffer 
     {SYSF_REMOVE,            "remove"},     // delete file 
+    {SYSF_MMAP_FILE,         "mmap_file"},  // map file into memory
+    {SYSF_AIO_READ,          "aio_read"},   // start reading file
+    {SYSF_AIO_WRITE,         "aio_write"},  // start writing file
+    {SYSF_AIO_WAIT,          "aio_wait"},   // wait for asynchronous request
+    {SYSF_MEMCPY,            "memcpy"},     // copy memory
+    {SYSF_MEMMOVE,           "memmove"},    // copy memory, may overlap
+    {SYSF_MEMSET,            "memset"},     // fill memory
+    {SYSF_MEMCMP,            "memcmp"},     // compare memory
+    {SYSF_STRLEN,            "strlen"},     // length of string
+    {SYSF_STRCMP,            "strcmp"},     // compare strings
+    {SYSF_MALLOC,            "malloc"},     // allocate memory
+    {SYSF_FREE,              "free"},       // free memory
+    {SYSF_REALLOC,           "realloc"},    // change size of allocated memory
+    {SYSF_ALIGNED_ALLOC,     "aligned_alloc"}, // allocate aligned memory
 };
 
 // number of entries in list
@@ -69,14 +94,39 @@ void CThread::interrupt(uint32_t n) {
     if (n >= INT_UNKNOWN_INST) {  // unrecoverable error
         terminate = true;              // stop execution
         returnType = 0;
+        emulator->stopAllThreads = true; // stop all other threads too
     }
     if (listFileName && cmd.maxLines != 0) {   // write interrupt to debug output
-        listOut.tabulate(emulator->disassembler.asmTab0);
-        const char * iname = Lookup(interruptNames, n);
-        listOut.put(iname);
-        if (terminate) listOut.put(". Terminating");
-        listOut.newLine();
+        if (trace) trace->putInterrupt(n, terminate);
+        else listInterruptText(n, terminate);
+    }
+}
+
+// write interrupt to debug list as text
+void CThread::listInterruptText(uint32_t n, bool terminate) {
+    listOut.tabulate(emulator->disassembler.asmTab0);
+    const char * iname = Lookup(interruptNames, n);
+    listOut.put(iname);
+    if (terminate) listOut.put(". Terminating");
+    listOut.newLine();
+}
+
+// write system call to debug list as text
+void CThread::listSystemCallText(uint32_t mod, uint32_t funcid) {
+    listOut.tabulate(emulator->disassembler.asmTab0);
+    listOut.put("system call: ");
+    if (mod == SYSM_SYSTEM) { // search for function name
+        for (int i = 0; i < numSystemFunctionNames; i++) {
+            if (systemFunctionNames[i].a == funcid) { // name is in list
+                listOut.put(systemFunctionNames[i].b);
+                goto NAME_WRITTEN;
+            }
+        }
     }
+    // name not found. write id
+    listOut.putHex(mod);  listOut.put(":");  listOut.putHex(funcid);
+    NAME_WRITTEN:
+    listOut.newLine();
 }
 
 /*
@@ -125,68 +175,113 @@ uint64_t CThread::checkSysMemAccess(uint64_t address, uint64_t size, uint8_t rd,
             index2++;
         }
     uint64_t size2 = memoryMap[index2+1].startAddress - address;  // maximum possible size
-    if (size < size2) size = size2;
+    if (size > size2) size = size2;             // limit to the accessible part
+    // system function may overwrite decoded instructions
+    if (mode & SHF_WRITE) invalidateDecodeCache(address, size);
+    emulator->commitMemory(address, size);       // the host may access the memory
     return size;
 }
 
-// emulate fprintf with ForwardCom argument list
-int CThread::fprintfEmulated(FILE * stream, const char * format, uint64_t * argumentList) {
-    // a ForwardCom argument list is compatible with a va_list in 64-bit windows but not in Linux
-    static CMemoryBuffer fstringbuf;             // buffer containing format string
-    fstringbuf.setSize(0);                       // discard any previously stored string
-    fstringbuf.pushString(format);               // copy format string
-    // split the format string into substrings with a single format specifier in each
-    uint32_t arg = 0;                            // argument index
-    int returnValue;                             // return value;
-    int returnSum = 0;                           // sum of return values;
-    char * startp;                               // start of current substring in format string
-    char * percentp1;                            // percent sign in current substring
-    char * percentp2;                            // next percent sign starting next substring
-    startp = fstringbuf.getString(0);            // start of string buffer
-    percentp1 = startp;                          // search for first % sign
-    while (true) {
+// split format string at guest address into substrings with a single format specifier in each.
+// the substrings are stored in formatText and formatParts
+void CThread::formatSplit(uint64_t format, SFormatCache & entry) {
+    const char * s = (const char *)memory + format;
+    entry.firstPart = formatParts.numEntries();
+    entry.numParts = 0;
+    SFormatPart part;
+    const char * startp = s;                     // start of current substring
+    const char * percentp1 = s;                  // percent sign in current substring
+    const char * percentp2;                      // next percent sign starting next substring
+    while (true) {                               // search for first % sign
         percentp1 = strchr(percentp1, '%');
         if (percentp1 && percentp1[1] == '%') percentp1 += 2; // skip "%%" which is not a format code
         else break;
     }
-    // loop for substrings of format string containing only one format specifier each
     do {
-        char c;                                      // format character
-        int asterisks = 0;
-        bool isString = false;
+        zeroAllMembers(part);
         if (percentp1) {
-            percentp2 = percentp1 + 1;               // search for next % sign
+            percentp2 = percentp1 + 1;           // search for next % sign
             while (true) {
                 percentp2 = strchr(percentp2, '%');
                 if (percentp2 && percentp2[1] == '%') percentp2 += 2; // skip "%%" which is not a format code
                 else break;
             }
-            if (percentp2) *percentp2 = 0;           // put temporary end of string at next % sign
             // check if argument is a string, and count asterisks
             int i = 1;
             while (true) {
-                c = percentp1[i++];                  // read character in format specifier
-                if (c == 0) break;                   // end of string
-                if (c == '*') asterisks++;           // count asterisks
-                c |= 0x20;                           // lower case
-                if (c == 's') isString = true;       // %s means string
-                if (c >= 'a' && c <= 'z') break;     // a letter terminates the format specifier
+                char c = percentp1[i++];         // read character in format specifier
+                if (c == 0) break;               // end of string
+                if (c == '*') part.asterisks++;  // count asterisks
+                c |= 0x20;                       // lower case
+                if (c == 's') part.isString = 1; // %s means string
+                if (c >= 'a' && c <= 'z') {      // a letter terminates the format specifier
+                    part.type = c;  break;
+                }
             }
         }
         else {
             percentp2 = 0;
         }
+        uint32_t length = percentp2 ? uint32_t(percentp2 - startp) : (uint32_t)strlen(startp);
+        part.text = formatText.dataSize();
+        formatText.push(startp, length);
+        formatText.push("", 1);                  // terminating zero
+        formatParts.push(part);
+        entry.numParts++;
+        startp = percentp1 = percentp2;
+    }
+    while (startp);
+}
+
+// emulate fprintf with ForwardCom argument list
+int CThread::fprintfEmulated(FILE * stream, uint64_t format, uint64_t * argumentList) {
+    // a ForwardCom argument list is compatible with a va_list in 64-bit windows but not in Linux.
+    // the format string is split into substrings with a single format specifier in each.
+    // the split is cached by guest address if the format string is in read-only memory
+    SFormatCache & cached = formatCache[(format >> 2) & (FORMAT_CACHE_SIZE - 1)];
+    SFormatCache temporary;                      // split of format string that is not cached
+    SFormatCache * parsed = &cached;
+    uint32_t partsBefore = 0, textBefore = 0;
+    if (cached.address != format || format == 0) {
+        uint64_t page1 = format >> MEMORY_PAGE_BITS;
+        uint64_t page2 = (format + strlen((const char *)memory + format)) >> MEMORY_PAGE_BITS;
+        bool readOnly = page2 < numPages && (pageAccess[(uint32_t)page1] & SHF_WRITE) == 0
+            && (pageAccess[(uint32_t)page2] & SHF_WRITE) == 0 && (pageAccess[(uint32_t)page1] & SHF_READ);
+        if (readOnly) {
+            if (formatText.dataSize() > 0x100000) {
+                // too many different format strings. start over
+                memset(formatCache, 0, sizeof(formatCache));
+                formatParts.setNum(0);
+                formatText.setSize(0);
+            }
+            formatSplit(format, cached);
+            cached.address = format;
+        }
+        else {
+            partsBefore = formatParts.numEntries();
+            textBefore = formatText.dataSize();
+            parsed = &temporary;
+            formatSplit(format, temporary);
+        }
+    }
+    uint32_t arg = 0;                            // argument index
+    int returnValue;                             // return value;
+    int returnSum = 0;                           // sum of return values;
+    for (uint32_t p = parsed->firstPart; p < parsed->firstPart + parsed->numParts; p++) {
+        SFormatPart const & part = formatParts[p];
+        const char * startp = (const char *)formatText.buf() + part.text; // current substring
+        char c = part.type;                      // format character
         uint64_t argument = argumentList[arg];   // The argument list can contain any type of argument with size up to 64 bits
         union {
             uint64_t a;
             double d;
         } uu;
-        if (isString) argument += (uint64_t)memory; // translate string address
+        if (part.isString) argument += (uint64_t)memory; // translate string address
         // Print current argument with format substring.
-        if (asterisks) { // asterisks indicate extra arguments
+        if (part.asterisks) { // asterisks indicate extra arguments
             if (c == 'a' || c == 'e' || c == 'f' || c == 'g') {
                 // floating point argument
-                if (asterisks == 1) {
+                if (part.asterisks == 1) {
                     uu.a = argumentList[arg+1];
                     returnValue = fprintf(stream, startp, argument, uu.d, argumentList[arg+2]);
                 }
@@ -198,7 +293,7 @@ int CThread::fprintfEmulated(FILE * stream, const char * format, uint64_t * argu
             else { // integer argument
                 returnValue = fprintf(stream, startp, argument, argumentList[arg+1], argumentList[arg+2]);
             }
-            arg += asterisks + 1;
+            arg += part.asterisks + 1;
         }
         else {
             if (c == 'a' || c == 'e' || c == 'f' || c == 'g') {
@@ -211,50 +306,75 @@ int CThread::fprintfEmulated(FILE * stream, const char * format, uint64_t * argu
             }
             arg++;
         }
-        if (returnValue < 0) return returnValue; // return error
-        else returnSum += returnValue;           // sum of return values
-        if (percentp2) *percentp2 = '%';         // re-insert next % sign
-        startp = percentp1 = percentp2;
+        if (returnValue < 0) {                   // return error
+            returnSum = returnValue;  break;
+        }
+        returnSum += returnValue;                // sum of return values
+    }
+    if (parsed == &temporary) {
+        // discard split of format string that is not cached
+        formatParts.setNum(partsBefore);
+        formatText.setSize(textBefore);
     }
-    while (startp);                              // loop to next substring
     return returnSum;                            // return total number of characters written
 }
 
+// use a large buffer for stdout when it is not a terminal, so that programs
+// writing many small pieces of output are not limited by host system calls
+static char stdoutBuffer[0x40000];
+
+void CEmulator::bufferOutput() {
+    fflush(stdout);
+#ifdef _WIN32
+    if (_isatty(_fileno(stdout))) return;
+#else
+    if (isatty(fileno(stdout))) return;
+#endif
+    setvbuf(stdout, stdoutBuffer, _IOFBF, sizeof(stdoutBuffer));
+}
+
 
 // entry for system calls
 void CThread::systemCall(uint32_t mod, uint32_t funcid, uint8_t rd, uint8_t rs) {
     if (listFileName) {    
         // debug listing
-        listOut.tabulate(emulator->disassembler.asmTab0);
-        listOut.put("system call: ");
-        if (mod == SYSM_SYSTEM) { // search for function name
-            for (int i = 0; i < numSystemFunctionNames; i++) {
-                if (systemFunctionNames[i].a == funcid) { // name is in list
-                    listOut.put(systemFunctionNames[i].b);
-                    goto NAME_WRITTEN;
-                }
-            }
-        }
-        // name not found. write id
-        listOut.putHex(mod);  listOut.put(":");  listOut.putHex(funcid);
-        NAME_WRITTEN:
-        listOut.newLine();
+        if (trace) trace->putSystemCall(mod, funcid);
+        else listSystemCallText(mod, funcid);
     }
     uint64_t temp;    // temporary
     uint64_t dsize;   // data size
     if (mod == SYSM_SYSTEM) {// system function
+        uint64_t args[4];  // parameters before the call, for option -record
+        if (cmd.replayFile && replayFunction(funcid)) {
+            replayCall(funcid, rd, rs);  return; // result from log instead of host
+        }
+        if (cmd.recordFile) memcpy(args, registers, sizeof(args));
         // dispatch by function id
         switch (funcid) {
         case SYSF_EXIT:      // terminate program
-            cmd.mainReturnValue = (int)registers[0];
-            terminate = true;  break;
-        case SYSF_ABORT:     // abort program
-            cmd.mainReturnValue = (int)registers[0];
-            terminate = true;  break;
+        case SYSF_ABORT: {   // abort program
+            // another thread may call exit at the same time. The first one gives the return value
+            std::lock_guard<std::mutex> lock(emulator->threadMutex);
+            if (!emulator->stopAllThreads) cmd.mainReturnValue = (int)registers[0];
+            emulator->stopAllThreads = true;
+            terminate = true;  break;}
         case SYSF_TIME:      // time
             temp = time(0);
             if (registers[0] && checkSysMemAccess(registers[0], 8, rd, rs, SHF_WRITE)) *(uint64_t*)(memory + registers[0]) = temp;
             registers[0] = temp;  break;
+        case SYSF_THREAD_CREATE: // start a new thread. r0 = function address, r1 = parameter
+            temp = emulator->startThread(registers[0], registers[1]);
+            registers[0] = temp ? temp : (uint64_t)(int64_t)-1;  // -1 if no thread available
+            break;
+        case SYSF_THREAD_JOIN:   // wait for a thread to finish. returns its r0
+            registers[0] = emulator->joinThread(registers[0], threadNumber);
+            break;
+        case SYSF_THREAD_EXIT:   // end current thread. The whole program ends if this is the main thread
+            terminate = true;  break;
+        case SYSF_THREAD_ID:     // get number of current thread
+            registers[0] = threadNumber;  break;
+        case SYSF_CHECKPOINT:    // save state in checkpoint file. r0 = 1 when continuing from it with option -restore
+            registers[0] = emulator->checkpointSave(this);  break;
         case SYSF_PUTS:      // write string to stdout
             if (strlen((const char*)memory + registers[0]) > checkSysMemAccess(registers[0], -1, rd, rs, SHF_READ)) {
                 interrupt(INT_ACCESS_READ);
@@ -265,10 +385,10 @@ void CThread::systemCall(uint32_t mod, uint32_t funcid, uint8_t rd, uint8_t rs)
             putchar((char)registers[0]); 
             break;
         case SYSF_PRINTF:    // write formatted output to stdout
-            registers[0] = fprintfEmulated(stdout, (const char*)memory + registers[0], (uint64_t*)(memory + registers[1]));
+            registers[0] = fprintfEmulated(stdout, registers[0], (uint64_t*)(memory + registers[1]));
             break; 
         case SYSF_FPRINTF:   // write formatted output to file
-            registers[0] = fprintfEmulated((FILE *)(registers[0]), (const char*)memory + registers[1], (uint64_t*)(memory + registers[2]));
+            registers[0] = fprintfEmulated((FILE *)(registers[0]), registers[1], (uint64_t*)(memory + registers[2]));
             break;
             /*
         case SYSF_SNPRINTF:   // write formatted output to string buffer 
@@ -370,6 +490,88 @@ void CThread::systemCall(uint32_t mod, uint32_t funcid, uint8_t rd, uint8_t rs)
         case SYSF_REMOVE:    // delete file 
             registers[0] = (uint64_t)remove((char *)(memory+registers[0]));
             break;
+        case SYSF_MMAP_FILE: // map file into memory
+            if (cmd.recordFile || cmd.replayFile) {
+                registers[0] = registers[1] = 0;  // file contents are not logged
+            }
+            else if (strlen((const char*)memory + registers[0]) > checkSysMemAccess(registers[0], -1, rd, rs, SHF_READ)) {
+                interrupt(INT_ACCESS_READ);
+                registers[0] = 0;
+            }
+            else {
+                registers[0] = mapFile((const char*)memory + registers[0], (registers[1] & 1) != 0, temp);
+                registers[1] = temp;
+            }
+            break;
+        case SYSF_AIO_READ:  // start reading file. r0 = request block
+        case SYSF_AIO_WRITE: // start writing file
+        case SYSF_AIO_WAIT:  // wait for request to finish
+            registers[0] = asyncRequest(registers[0], funcid, rd, rs);
+            break;
+        case SYSF_MEMCPY:    // copy memory. r0 = destination, r1 = source, r2 = size
+        case SYSF_MEMMOVE:   // same. memcpy with overlap gives the same result as memmove
+            dsize = registers[2];
+            if (checkSysMemAccess(registers[1], dsize, rd, rs, SHF_READ) < dsize) {
+                interrupt(INT_ACCESS_READ);
+            }
+            else if (checkSysMemAccess(registers[0], dsize, rd, rs, SHF_WRITE) < dsize) {
+                interrupt(INT_ACCESS_WRITE);
+            }
+            else memmove(memory + registers[0], memory + registers[1], (size_t)dsize);
+            break;
+        case SYSF_MEMSET:    // fill memory. r0 = destination, r1 = value, r2 = size
+            dsize = registers[2];
+            if (checkSysMemAccess(registers[0], dsize, rd, rs, SHF_WRITE) < dsize) {
+                interrupt(INT_ACCESS_WRITE);
+            }
+            else memset(memory + registers[0], (int)registers[1], (size_t)dsize);
+            break;
+        case SYSF_MEMCMP:    // compare memory. r0 = first, r1 = second, r2 = size
+            dsize = registers[2];
+            if (checkSysMemAccess(registers[0], dsize, rd, rs, SHF_READ) < dsize
+            || checkSysMemAccess(registers[1], dsize, rd, rs, SHF_READ) < dsize) {
+                interrupt(INT_ACCESS_READ);
+                registers[0] = 0;
+            }
+            else registers[0] = (uint64_t)(int64_t)memcmp(memory + registers[0], memory + registers[1], (size_t)dsize);
+            break;
+        case SYSF_STRLEN:    // length of string in r0
+            // search only the readable part of memory
+            temp = checkSysMemAccess(registers[0], -1, rd, rs, SHF_READ);
+            dsize = strnlen((const char*)memory + registers[0], (size_t)temp);
+            if (dsize >= temp) {
+                interrupt(INT_ACCESS_READ);  // no terminating zero
+                registers[0] = 0;
+            }
+            else registers[0] = dsize;
+            break;
+        case SYSF_STRCMP:    // compare strings in r0 and r1
+            temp = checkSysMemAccess(registers[0], -1, rd, rs, SHF_READ);
+            dsize = checkSysMemAccess(registers[1], -1, rd, rs, SHF_READ);
+            if (strnlen((const char*)memory + registers[0], (size_t)temp) >= temp
+            || strnlen((const char*)memory + registers[1], (size_t)dsize) >= dsize) {
+                interrupt(INT_ACCESS_READ);
+                registers[0] = 0;
+            }
+            else registers[0] = (uint64_t)(int64_t)strcmp((const char*)memory + registers[0], (const char*)memory + registers[1]);
+            break;
+        case SYSF_MALLOC:    // allocate memory. r0 = size
+            registers[0] = heapAllocate(registers[0], 16);
+            break;
+        case SYSF_FREE:      // free memory. r0 = address
+            if (!heapFree(registers[0])) interrupt(INT_ACCESS_WRITE);  // not an allocated block
+            break;
+        case SYSF_REALLOC:   // change size of allocated memory. r0 = address, r1 = new size
+            if (registers[0] && heapBlockSize(registers[0]) == 0) {
+                interrupt(INT_ACCESS_WRITE);     // not an allocated block
+                registers[0] = 0;
+            }
+            else registers[0] = heapReallocate(registers[0], registers[1]);
+            break;
+        case SYSF_ALIGNED_ALLOC: // allocate aligned memory. r0 = alignment, r1 = size
+            registers[0] = heapAllocate(registers[1], registers[0]);
+            break;
         }
+        if (cmd.recordFile && replayFunction(funcid)) recordCall(funcid, args, rd, rs);
     }
 }
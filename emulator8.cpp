@@ -0,0 +1,397 @@
+/****************************  emulator8.cpp  ********************************
+* Author:        agent
+* date created:  2026-10-16
+* Last modified: 2026-10-16
+* Version:       1.01
+* Project:       Binary tools for ForwardCom instruction set
+* Description:
+* Emulator: Compilation of basic blocks to native x86-64 code
+*
+* Sequences of simple general purpose register instructions in hot basic blocks
+* are translated to native code. All other instructions are executed by the
+* threaded interpreter in emulator1.cpp.
+*
+* Copyright 2018-2026 GNU General Public License http://www.gnu.org/licenses
+*****************************************************************************/
+
+#include "stdafx.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define JIT_SUPPORTED  1
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#endif
+
+// size of executable memory buffer for each thread
+static const uint32_t jitBufferSize = 0x100000;
+
+// maximum size of native code for one instruction, including end of sequence
+static const uint32_t jitMaxInstructionSize = 64;
+
+
+#ifdef JIT_SUPPORTED
+
+// allocate memory for native code. It is writable, but not executable, until protectExecutable is called
+static uint8_t * allocateExecutable(uint32_t size) {
+#ifdef _WIN32
+    return (uint8_t *)VirtualAlloc(0, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else
+    void * p = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) return 0;
+    return (uint8_t *)p;
+#endif
+}
+
+// make memory for native code either writable or executable, never both.
+// returns false if failed
+static bool protectExecutable(uint8_t * p, uint32_t size, bool executable) {
+#ifdef _WIN32
+    DWORD oldProtect;
+    return VirtualProtect(p, size, executable ? PAGE_EXECUTE_READ : PAGE_READWRITE, &oldProtect) != 0;
+#else
+    return mprotect(p, size, executable ? PROT_READ | PROT_EXEC : PROT_READ | PROT_WRITE) == 0;
+#endif
+}
+
+// free executable memory
+static void freeExecutable(uint8_t * p, uint32_t size) {
+#ifdef _WIN32
+    VirtualFree(p, 0, MEM_RELEASE);
+#else
+    munmap(p, size);
+#endif
+}
+
+// x86-64 machine code writer
+class CJitEmitter {
+public:
+    CJitEmitter(uint8_t * p) {
+        start = pos = p;
+    }
+    uint8_t * start;                             // beginning of code
+    uint8_t * pos;                               // current position
+    void put8(uint8_t x) {
+        *pos++ = x;
+    }
+    void put32(uint32_t x) {
+        memcpy(pos, &x, 4);  pos += 4;
+    }
+    void put64(uint64_t x) {
+        memcpy(pos, &x, 8);  pos += 8;
+    }
+    // rax or rdx = registers[r]. r11 points to registers
+    void loadReg(uint8_t hostReg, uint8_t r) {
+        put8(0x49);  put8(0x8B);  put8(0x83 | hostReg << 3);  put32((r & 0x1F) * 8);
+    }
+    // registers[r] = rax
+    void storeRax(uint8_t r) {
+        put8(0x49);  put8(0x89);  put8(0x83);  put32((r & 0x1F) * 8);
+    }
+    // rax or rdx = constant
+    void loadConst(uint8_t hostReg, uint64_t value, bool size64) {
+        if (!size64) {                           // mov r32, imm32. zero-extends
+            put8(0xB8 | hostReg);  put32((uint32_t)value);
+        }
+        else if ((int64_t)value == (int32_t)value) {  // mov r64, simm32
+            put8(0x48);  put8(0xC7);  put8(0xC0 | hostReg);  put32((uint32_t)value);
+        }
+        else {                                   // mov r64, imm64
+            put8(0x48);  put8(0xB8 | hostReg);  put64(value);
+        }
+    }
+    // return from native code with new ip in rax
+    // always 11 bytes
+    void returnIp(uint64_t ip) {
+        put8(0x48);  put8(0xB8);  put64(ip);     // mov rax, imm64
+        put8(0xC3);                              // ret
+    }
+};
+
+// host registers used by the native code
+static const uint8_t HOST_RAX = 0;
+static const uint8_t HOST_RDX = 2;
+
+// kinds of compilable operations
+static const uint8_t JIT_MOVE  = 1;              // dest = last operand
+static const uint8_t JIT_ALU   = 2;              // dest = first operand OP last operand
+static const uint8_t JIT_SHIFT = 3;              // dest = first operand shifted by constant
+
+// execution functions that can be compiled. the ALU operation is the x86 opcode with rax, rdx operands
+// and the /digit for the version with immediate operand or for shift by constant
+struct SJitOperation {
+    PFunc  * table;                              // funcTab1 for tiny instructions, funcTab2 for multiformat instructions
+    uint32_t index;                              // index into table
+    uint8_t  kind;                               // JIT_MOVE, JIT_ALU or JIT_SHIFT
+    uint8_t  regOpcode;                          // x86 opcode for op rax, rdx
+    uint8_t  immDigit;                           // x86 /digit for op rax, imm32 (opcode 81) or shift (opcode C1)
+};
+
+static const SJitOperation jitOperations[] = {
+    // multiformat instructions
+    {funcTab2, II_MOVE,          JIT_MOVE,  0x00, 0},
+    {funcTab2, II_ADD,           JIT_ALU,   0x01, 0},
+    {funcTab2, II_SUB,           JIT_ALU,   0x29, 5},
+    {funcTab2, II_AND,           JIT_ALU,   0x21, 4},
+    {funcTab2, II_OR,            JIT_ALU,   0x09, 1},
+    {funcTab2, II_XOR,           JIT_ALU,   0x31, 6},
+    {funcTab2, II_SHIFT_LEFT,    JIT_SHIFT, 0x00, 4},
+    {funcTab2, II_SHIFT_RIGHT_S, JIT_SHIFT, 0x00, 7},
+    {funcTab2, II_SHIFT_RIGHT_U, JIT_SHIFT, 0x00, 5},
+    // tiny instructions. see funcTab1 in emulator4.cpp
+    {funcTab1, 1,                JIT_MOVE,  0x00, 0},   // move unsigned constant
+    {funcTab1, 2,                JIT_ALU,   0x01, 0},   // add constant
+    {funcTab1, 3,                JIT_ALU,   0x29, 5},   // sub constant
+    {funcTab1, 4,                JIT_SHIFT, 0x00, 4},   // shift left by constant
+    {funcTab1, 5,                JIT_SHIFT, 0x00, 5},   // shift right unsigned by constant
+    {funcTab1, 8,                JIT_MOVE,  0x00, 0},   // move register
+    {funcTab1, 9,                JIT_ALU,   0x01, 0},   // add register
+    {funcTab1, 10,               JIT_ALU,   0x29, 5},   // sub register
+    {funcTab1, 11,               JIT_ALU,   0x21, 4},   // and register
+    {funcTab1, 12,               JIT_ALU,   0x09, 1},   // or register
+    {funcTab1, 13,               JIT_ALU,   0x31, 6}    // xor register
+};
+
+// shift count of instruction with constant shift count
+static uint64_t jitShiftCount(SDecodedInstr const & d) {
+    // multiformat shift instructions use the immediate operand without conversion
+    return (d.flags & DECODED_TINY) ? d.immediate.q : d.immediateRaw.q;
+}
+
+// find compilable operation for decoded instruction. returns 0 if not supported
+static const SJitOperation * jitFindOperation(SDecodedInstr const & d) {
+    if (d.handler != DECODED_HANDLER_SCALAR && d.handler != DECODED_HANDLER_ADD_COMPARE_JUMP) return 0;
+    bool tiny = (d.flags & DECODED_TINY) != 0;
+    if (d.operandType != 3 && (tiny || d.operandType != 2)) return 0;  // int64, or int32 for multiformat instructions
+    for (uint32_t i = 0; i < sizeof(jitOperations) / sizeof(jitOperations[0]); i++) {
+        SJitOperation const * o = &jitOperations[i];
+        if (d.function != o->table[o->index] || (o->table == funcTab1) != tiny) continue;
+        if (!tiny && d.nOperands != (o->kind == JIT_MOVE ? 1 : 2)) return 0;
+        if (o->kind == JIT_SHIFT) {
+            // shift count must be an immediate constant smaller than the operand size
+            if (d.operands[5] != 0x20) return 0;
+            if (jitShiftCount(d) >= (d.operandType == 3 ? 64u : 32u)) return 0;
+        }
+        return o;
+    }
+    return 0;
+}
+
+// check if decoded instruction is a control transfer that can end a compiled sequence
+static bool jitIsJump(SDecodedInstr const & d) {
+    if (d.handler == DECODED_HANDLER_COMPARE_JUMP) {
+        return d.operandType == 2 || d.operandType == 3;
+    }
+    // funcTab4[0] = simple self-relative jump
+    return d.handler == DECODED_HANDLER_JUMP && d.function == funcTab4[0];
+}
+
+// emit native code for an ALU instruction
+static void jitEmitOperation(CJitEmitter & e, SDecodedInstr const & d, SJitOperation const * o) {
+    bool size64 = d.operandType == 3;
+    bool immediate = d.operands[5] == 0x20;
+    if (o->kind == JIT_MOVE) {
+        if (immediate) e.loadConst(HOST_RAX, d.immediate.q, size64);
+        else {
+            e.loadReg(HOST_RAX, d.operands[5]);
+            if (!size64) { e.put8(0x89);  e.put8(0xC0); }  // mov eax,eax. zero-extend
+        }
+    }
+    else if (o->kind == JIT_SHIFT) {
+        e.loadReg(HOST_RAX, d.operands[4]);
+        if (size64) e.put8(0x48);
+        e.put8(0xC1);  e.put8(0xC0 | o->immDigit << 3);  e.put8((uint8_t)jitShiftCount(d));
+    }
+    else {
+        e.loadReg(HOST_RAX, d.operands[4]);
+        if (immediate && (!size64 || (int64_t)d.immediate.q == (int32_t)d.immediate.q)) {
+            // op rax, imm32
+            if (size64) e.put8(0x48);
+            e.put8(0x81);  e.put8(0xC0 | o->immDigit << 3);  e.put32((uint32_t)d.immediate.q);
+        }
+        else {
+            // op rax, rdx
+            if (immediate) e.loadConst(HOST_RDX, d.immediate.q, true);
+            else e.loadReg(HOST_RDX, d.operands[5]);
+            if (size64) e.put8(0x48);
+            e.put8(o->regOpcode);  e.put8(0xD0);
+        }
+    }
+    e.storeRax(d.operands[0]);
+}
+
+// emit native code for the jump that ends a sequence
+static void jitEmitJump(CJitEmitter & e, SDecodedInstr const & d, uint64_t ipNext) {
+    uint64_t target = ipNext + d.addrOperand * 4;
+    if (d.handler == DECODED_HANDLER_JUMP) {     // unconditional jump
+        e.returnIp(target);
+        return;
+    }
+    // integer compare and jump. see compare_jump_generic() in emulator3.cpp
+    bool size64 = d.operandType == 3;
+    e.loadReg(HOST_RAX, d.operands[4]);
+    if ((d.format.opAvail & 1) && (!size64 || (int64_t)d.immediate.q == (int32_t)d.immediate.q)) {
+        if (size64) e.put8(0x48);
+        e.put8(0x81);  e.put8(0xF8);  e.put32((uint32_t)d.immediate.q);  // cmp rax, imm32
+    }
+    else {
+        if (d.format.opAvail & 1) e.loadConst(HOST_RDX, d.immediate.q, true);
+        else e.loadReg(HOST_RDX, d.operands[5]);
+        if (size64) e.put8(0x48);
+        e.put8(0x39);  e.put8(0xD0);             // cmp rax, rdx
+    }
+    // x86 condition code for each value of (op & 0xE). The lowest bit inverts the condition
+    static const uint8_t conditionCodes[5] = {
+        0x84,   // 0: equal
+        0x8C,   // 2: signed below
+        0x8F,   // 4: signed above
+        0x82,   // 6: unsigned below
+        0x87};  // 8: unsigned above
+    e.put8(0x0F);  e.put8(conditionCodes[(d.op & 0xE) >> 1] ^ (d.op & 1));
+    e.put32(11);                                 // jump over mov rax,imm64 and ret
+    e.returnIp(ipNext);                          // not taken
+    e.returnIp(target);                          // taken
+}
+
+#endif // JIT_SUPPORTED
+
+
+// destructor
+CThread::~CThread() {
+#ifdef JIT_SUPPORTED
+    if (jitBuffer) freeExecutable(jitBuffer, jitBufferSize);
+#endif
+    if (cacheModel) delete cacheModel;
+}
+
+// compile basic block to native code.
+// Each sequence of compilable instructions becomes a function called by the first
+// instruction of the sequence, which gets the handler DECODED_HANDLER_JIT.
+// The buffer is writable while compiling and executable when done.
+// When the buffer is full, all native code is discarded and hot blocks are compiled again
+void CThread::jitCompileBlock(SBasicBlock & block, uint64_t blockIp) {
+#ifdef JIT_SUPPORTED
+    if (jitBuffer == 0) {
+        jitBuffer = allocateExecutable(jitBufferSize);
+        jitBufferUsed = 0;
+        if (jitBuffer == 0) {
+            cmd.emulateOptions &= ~CMDL_EMU_JIT;  // cannot allocate executable memory. continue without jit
+            return;
+        }
+    }
+    else if (!protectExecutable(jitBuffer, jitBufferSize, false)) {
+        cmd.emulateOptions &= ~CMDL_EMU_JIT;      // cannot make buffer writable. continue without jit
+        return;
+    }
+    uint32_t i = 0;
+    while (i < block.num) {
+        // find sequence of compilable instructions
+        uint32_t first = i;
+        bool endsWithJump = false;
+        while (i < block.num) {
+            SDecodedInstr & d = blockCode[block.first + i];
+            if (jitFindOperation(d)) i++;
+            else {
+                if (jitIsJump(d)) {
+                    endsWithJump = true;  i++;
+                }
+                break;
+            }
+        }
+        if (!endsWithJump && i > first && (blockCode[block.first + i - 1].flags & DECODED_TINY_PENDING)) {
+            i--;                                 // don't split a pair of tiny instructions
+        }
+        if (i == first) {
+            i++;  continue;                      // this instruction is not compilable
+        }
+        if (jitBufferUsed + (i - first) * jitMaxInstructionSize > jitBufferSize) {
+            // buffer full. discard all native code and let other blocks become hot again
+            jitReset();
+            for (uint32_t b = 0; b < blockList.numEntries(); b++) {
+                if (&blockList[b] != &block) blockList[b].count = 0;
+            }
+        }
+        // compile sequence
+        CJitEmitter e(jitBuffer + jitBufferUsed);
+#ifdef _WIN32
+        e.put8(0x49);  e.put8(0x89);  e.put8(0xCB); // mov r11, rcx
+#else
+        e.put8(0x49);  e.put8(0x89);  e.put8(0xFB); // mov r11, rdi
+#endif
+        uint32_t last = endsWithJump ? i - 1 : i;
+        for (uint32_t j = first; j < last; j++) {
+            SDecodedInstr & d = blockCode[block.first + j];
+            jitEmitOperation(e, d, jitFindOperation(d));
+        }
+        SDecodedInstr & dLast = blockCode[block.first + i - 1];
+        uint64_t ipNext = blockIp + dLast.blockOffset + dLast.length;
+        if (endsWithJump) jitEmitJump(e, dLast, ipNext);
+        else e.returnIp(ipNext);
+        // make record of sequence
+        SJitSegment segment;
+        SDecodedInstr & dFirst = blockCode[block.first + first];
+        segment.codeOffset = jitBufferUsed;
+        segment.num = i - first;
+        segment.first = block.first + first;
+        segment.handler = dFirst.handler;
+        segment.endsWithJump = endsWithJump;
+        segment.ipNext = ipNext;
+        segment.count = 0;
+        dFirst.jitSegment = jitSegments.push(segment) + 1;
+        dFirst.handler = DECODED_HANDLER_JIT;
+        jitBufferUsed += uint32_t(e.pos - e.start);
+    }
+    if (!protectExecutable(jitBuffer, jitBufferSize, true)) {
+        // cannot run the native code. go back to the interpreter
+        jitReset();
+        cmd.emulateOptions &= ~CMDL_EMU_JIT;
+    }
+#endif
+}
+
+// discard all native code. called when basic blocks are discarded or the buffer is full
+void CThread::jitReset() {
+    jitCountPerf();                              // don't lose the counts of the discarded segments
+    for (uint32_t s = 0; s < jitSegments.numEntries(); s++) {
+        // give the first instruction of each sequence its interpreter handler back
+        SJitSegment & segment = jitSegments[s];
+        if (segment.first < blockCode.numEntries()) {
+            blockCode[segment.first].handler = segment.handler;
+            blockCode[segment.first].jitSegment = 0;
+        }
+    }
+    jitBufferUsed = 0;
+    jitSegments.setSize(0);
+}
+
+// add instructions executed as native code to performance counters.
+// Native code only counts how many times each sequence has run
+void CThread::jitCountPerf() {
+    for (uint32_t s = 0; s < jitSegments.numEntries(); s++) {
+        SJitSegment & segment = jitSegments[s];
+        if (segment.count == 0) continue;
+        for (uint32_t i = segment.first; i < segment.first + segment.num; i++) {
+            SDecodedInstr const & d = blockCode[i];
+            perf.format[d.formatIndex] += segment.count;
+            perf.category[d.format.cat & 7] += segment.count;
+        }
+        segment.count = 0;
+    }
+}
+
+// compare interpreter results with native code results
+void CThread::jitVerify() {
+    for (int r = 0; r < 32; r++) {
+        if (registers[r] != jitExpected[r]) {
+            err.submit(ERR_EMU_JIT_MISMATCH, int(jitVerifyIp - ip0), r);
+            terminate = true;
+            return;
+        }
+    }
+    if (ip != jitExpectedIp) {
+        err.submit(ERR_EMU_JIT_MISMATCH, int(jitVerifyIp - ip0), 32);
+        terminate = true;
+    }
+}
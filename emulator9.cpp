@@ -0,0 +1,497 @@
+/****************************  emulator9.cpp  ********************************
+* Author:        agent
+* date created:  2026-10-16
+* Last modified: 2026-10-16
+* Version:       1.01
+* Project:       Binary tools for ForwardCom instruction set
+* Description:
+* Emulator: Whole-vector execution of common vector instructions
+*
+* CThread::execute() normally calls the execution function once for each vector
+* element. The kernels in this module do add, sub, mul, and, or, xor, min, max
+* and compare on all elements of a vector register at once, including mask and
+* fallback. They use SSE2 where available and plain loops on other hosts.
+* The float16 instructions add_h, sub_h and mul_h convert a block of elements
+* to single precision, calculate, and convert the results back, rather than
+* converting one element at a time.
+* Instructions and operand combinations not covered here, and elements that
+* need special treatment (NAN operands, overflow traps), are left to the
+* execution functions in emulator4.cpp so that the results are always the same.
+*
+* Copyright 2018-2026 GNU General Public License http://www.gnu.org/licenses
+*****************************************************************************/
+
+#include "stdafx.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define VECTOR_KERNEL_SSE2  1
+#endif
+
+// operations supported by the vector kernels
+static const uint8_t VK_ADD     = 1;
+static const uint8_t VK_SUB     = 2;
+static const uint8_t VK_MUL     = 3;
+static const uint8_t VK_AND     = 4;
+static const uint8_t VK_OR      = 5;
+static const uint8_t VK_XOR     = 6;
+static const uint8_t VK_MIN     = 7;
+static const uint8_t VK_MAX     = 8;
+static const uint8_t VK_MIN_U   = 9;
+static const uint8_t VK_MAX_U   = 10;
+static const uint8_t VK_COMPARE = 11;
+static const uint8_t VK_ADD_H   = 12;            // float16 operations come last
+static const uint8_t VK_SUB_H   = 13;
+static const uint8_t VK_MUL_H   = 14;
+
+// find vector kernel operation for an execution function. returns 0 if none
+static uint8_t vkFindOperation(PFunc f) {
+    if (f == 0) return 0;
+    if (f == funcTab2[II_ADD])     return VK_ADD;
+    if (f == funcTab2[II_SUB])     return VK_SUB;
+    if (f == funcTab2[II_MUL])     return VK_MUL;
+    if (f == funcTab2[II_AND])     return VK_AND;
+    if (f == funcTab2[II_OR])      return VK_OR;
+    if (f == funcTab2[II_XOR])     return VK_XOR;
+    if (f == funcTab2[II_MIN])     return VK_MIN;
+    if (f == funcTab2[II_MAX])     return VK_MAX;
+    if (f == funcTab2[II_MIN_U])   return VK_MIN_U;
+    if (f == funcTab2[II_MAX_U])   return VK_MAX_U;
+    if (f == funcTab2[II_COMPARE]) return VK_COMPARE;
+    if (f == f_add_h)              return VK_ADD_H;
+    if (f == f_sub_h)              return VK_SUB_H;
+    if (f == f_mul_h)              return VK_MUL_H;
+    return 0;
+}
+
+// operands of a vector kernel. Pointers are into CThread::vectors.
+// b is 0 if the last operand is a broadcast scalar, m is 0 if there is no mask,
+// f is 0 if the fallback is zero
+template <typename U>
+struct SVectorKernel {
+    U * d;                                       // destination
+    U const * a;                                 // first source operand
+    U const * b;                                 // last source operand
+    U const * m;                                 // mask
+    U const * f;                                 // fallback
+    U bcast;                                     // broadcast value of last operand
+    uint8_t cond;                                // condition for compare
+    uint64_t maskBits;                           // numContr bits that go into the result of compare
+};
+
+// integer operation on one element
+template <typename U, typename S>
+static inline U vkInteger(uint8_t op, U x, U y, uint8_t cond, uint64_t maskBits) {
+    switch (op) {
+    case VK_ADD:   return (U)(x + y);
+    case VK_SUB:   return (U)(x - y);
+    case VK_MUL:   return (U)((uint64_t)x * y);
+    case VK_AND:   return x & y;
+    case VK_OR:    return x | y;
+    case VK_XOR:   return x ^ y;
+    case VK_MIN:   return (S)x < (S)y ? x : y;
+    case VK_MAX:   return (S)x > (S)y ? x : y;
+    case VK_MIN_U: return x < y ? x : y;
+    case VK_MAX_U: return x > y ? x : y;
+    }
+    // compare. same as f_compare with no mask register
+    const U signBit = (U)1 << (sizeof(U) * 8 - 1);
+    uint8_t cond1 = cond >> 1 & 3;
+    bool result = false;
+    if (cond1 != 3 && !(cond & 8)) {             // signed. flip sign bit to use unsigned compare
+        x ^= signBit;  y ^= signBit;
+    }
+    switch (cond1) {
+    case 0: result = x == y;  break;
+    case 1: result = x < y;  break;
+    case 2: result = x > y;  break;
+    case 3:                                      // abs(a) < abs(b)
+        if (x & signBit) x = (U)(~x + 1);
+        if (y & signBit) y = (U)(~y + 1);
+        result = x < y;  break;
+    }
+    return (U)((uint64_t)(result ^ (cond & 1)) | (maskBits & ~(uint64_t)1));
+}
+
+// integer kernel with plain loop
+template <typename U, typename S>
+static void vkIntegerLoop(uint8_t op, SVectorKernel<U> const & k, uint32_t first, uint32_t end) {
+    for (uint32_t i = first; i < end; i++) {
+        U r = vkInteger<U, S>(op, k.a[i], k.b ? k.b[i] : k.bcast, k.cond, k.maskBits);
+        if (k.m && !(k.m[i] & 1)) r = k.f ? k.f[i] : 0;
+        k.d[i] = r;
+    }
+}
+
+// floating point kernel with plain loop.
+// Elements with a NAN operand are done by the execution function to get the same NAN propagation
+template <typename F, typename U>
+static void vkFloatLoop(CThread * t, uint8_t op, SVectorKernel<U> const & k, uint32_t first, uint32_t end) {
+    if (sizeof(F) != sizeof(U)) return;          // instantiated but not used for integer types
+    for (uint32_t i = first; i < end; i++) {
+        U r;
+        if (k.m && !(k.m[i] & 1)) {
+            r = k.f ? k.f[i] : 0;
+        }
+        else {
+            U ux = k.a[i], uy = k.b ? k.b[i] : k.bcast;
+            F x, y, z = 0;
+            memcpy(&x, &ux, sizeof(F));  memcpy(&y, &uy, sizeof(F));
+            if (x != x || y != y) {              // NAN
+                t->parm[1].q = ux;  t->parm[2].q = uy;
+                t->parm[3].q = k.m ? k.m[i] : t->numContr;
+                r = (U)(*t->functionPointer)(t);
+            }
+            else if (op == VK_COMPARE) {
+                bool result = false;
+                switch (k.cond >> 1 & 3) {
+                case 0: result = x == y;  break;
+                case 1: result = x < y;  break;
+                case 2: result = x > y;  break;
+                case 3: result = fabs(x) < fabs(y);  break;
+                }
+                r = (U)((uint64_t)(result ^ (k.cond & 1)) | (k.maskBits & ~(uint64_t)1));
+            }
+            else {
+                switch (op) {
+                case VK_ADD: z = x + y;  break;
+                case VK_SUB: z = x - y;  break;
+                case VK_MUL: z = x * y;  break;
+                case VK_MIN: case VK_MIN_U: z = x < y ? x : y;  break;
+                case VK_MAX: case VK_MAX_U: z = x > y ? x : y;  break;
+                }
+                memcpy(&r, &z, sizeof(F));
+            }
+        }
+        k.d[i] = r;
+    }
+}
+
+#ifdef VECTOR_KERNEL_SSE2
+// select result or fallback for 16 bytes, depending on bit 0 of each mask element
+static inline __m128i vkSse2Mask(__m128i r, __m128i m, __m128i f, uint32_t size) {
+    __m128i enable;
+    switch (size) {
+    case 1:
+        enable = _mm_cmpeq_epi8(_mm_and_si128(m, _mm_set1_epi8(1)), _mm_set1_epi8(1));  break;
+    case 2:
+        enable = _mm_cmpeq_epi16(_mm_and_si128(m, _mm_set1_epi16(1)), _mm_set1_epi16(1));  break;
+    case 4:
+        enable = _mm_cmpeq_epi32(_mm_and_si128(m, _mm_set1_epi32(1)), _mm_set1_epi32(1));  break;
+    default:
+        // no 64-bit compare in SSE2. copy the result for the low dword to the high dword
+        enable = _mm_cmpeq_epi32(_mm_and_si128(m, _mm_set_epi32(0, 1, 0, 1)), _mm_set_epi32(0, 1, 0, 1));
+        enable = _mm_shuffle_epi32(enable, 0xA0);  break;
+    }
+    return _mm_or_si128(_mm_and_si128(enable, r), _mm_andnot_si128(enable, f));
+}
+
+// integer operation on 16 bytes. returns false if not supported by SSE2
+static inline bool vkSse2Integer(uint8_t op, uint32_t size, __m128i a, __m128i b, __m128i & r) {
+    switch (op) {
+    case VK_ADD:
+        switch (size) {
+        case 1: r = _mm_add_epi8(a, b);  return true;
+        case 2: r = _mm_add_epi16(a, b);  return true;
+        case 4: r = _mm_add_epi32(a, b);  return true;
+        default: r = _mm_add_epi64(a, b);  return true;
+        }
+    case VK_SUB:
+        switch (size) {
+        case 1: r = _mm_sub_epi8(a, b);  return true;
+        case 2: r = _mm_sub_epi16(a, b);  return true;
+        case 4: r = _mm_sub_epi32(a, b);  return true;
+        default: r = _mm_sub_epi64(a, b);  return true;
+        }
+    case VK_MUL:
+        if (size != 2) return false;
+        r = _mm_mullo_epi16(a, b);  return true;
+    case VK_AND:
+        r = _mm_and_si128(a, b);  return true;
+    case VK_OR:
+        r = _mm_or_si128(a, b);  return true;
+    case VK_XOR:
+        r = _mm_xor_si128(a, b);  return true;
+    case VK_MIN:
+        if (size != 2) return false;
+        r = _mm_min_epi16(a, b);  return true;
+    case VK_MAX:
+        if (size != 2) return false;
+        r = _mm_max_epi16(a, b);  return true;
+    case VK_MIN_U:
+        if (size != 1) return false;
+        r = _mm_min_epu8(a, b);  return true;
+    case VK_MAX_U:
+        if (size != 1) return false;
+        r = _mm_max_epu8(a, b);  return true;
+    }
+    return false;
+}
+
+// floating point operation on 16 bytes. returns false if not supported or an operand is NAN
+static inline bool vkSse2Float(uint8_t op, uint32_t size, __m128i a, __m128i b, __m128i & r) {
+    if (size == 4) {
+        __m128 x = _mm_castsi128_ps(a), y = _mm_castsi128_ps(b), z;
+        if (_mm_movemask_ps(_mm_cmpunord_ps(x, y))) return false;   // NAN
+        switch (op) {
+        case VK_ADD: z = _mm_add_ps(x, y);  break;
+        case VK_SUB: z = _mm_sub_ps(x, y);  break;
+        case VK_MUL: z = _mm_mul_ps(x, y);  break;
+        case VK_MIN: case VK_MIN_U: z = _mm_min_ps(x, y);  break;   // minps gives x < y ? x : y
+        case VK_MAX: case VK_MAX_U: z = _mm_max_ps(x, y);  break;   // maxps gives x > y ? x : y
+        default: return false;
+        }
+        r = _mm_castps_si128(z);
+    }
+    else {
+        __m128d x = _mm_castsi128_pd(a), y = _mm_castsi128_pd(b), z;
+        if (_mm_movemask_pd(_mm_cmpunord_pd(x, y))) return false;   // NAN
+        switch (op) {
+        case VK_ADD: z = _mm_add_pd(x, y);  break;
+        case VK_SUB: z = _mm_sub_pd(x, y);  break;
+        case VK_MUL: z = _mm_mul_pd(x, y);  break;
+        case VK_MIN: case VK_MIN_U: z = _mm_min_pd(x, y);  break;
+        case VK_MAX: case VK_MAX_U: z = _mm_max_pd(x, y);  break;
+        default: return false;
+        }
+        r = _mm_castpd_si128(z);
+    }
+    return true;
+}
+#endif
+
+// run kernel on all n elements
+template <typename U, typename S, typename F>
+static void vkRun(CThread * t, uint8_t op, bool isFloat, SVectorKernel<U> const & k, uint32_t n) {
+    uint32_t i = 0;
+#ifdef VECTOR_KERNEL_SSE2
+    // 16 bytes at a time. All source operands are loaded before the destination is
+    // written, so the destination may be the same register as any of the sources.
+    // Vector registers are aligned by 16 or more because CThread::vectors is aligned by 64
+    // and MaxVectorLength is a power of 2 not less than 16
+    const uint32_t step = 16 / sizeof(U);
+    __m128i bb = _mm_setzero_si128();
+    if (!k.b) {
+        switch (sizeof(U)) {
+        case 1: bb = _mm_set1_epi8((char)k.bcast);  break;
+        case 2: bb = _mm_set1_epi16((short)k.bcast);  break;
+        case 4: bb = _mm_set1_epi32((int)k.bcast);  break;
+        default: bb = _mm_set_epi32((int)((uint64_t)k.bcast >> 32), (int)k.bcast, (int)((uint64_t)k.bcast >> 32), (int)k.bcast);  break;
+        }
+    }
+    for (; i + step <= n; i += step) {
+        __m128i a = _mm_load_si128((__m128i const *)(k.a + i));
+        __m128i b = k.b ? _mm_load_si128((__m128i const *)(k.b + i)) : bb;
+        __m128i r;
+        bool ok = isFloat ? vkSse2Float(op, sizeof(U), a, b, r) : vkSse2Integer(op, sizeof(U), a, b, r);
+        if (!ok) {
+            // not supported or NAN. do these elements one by one
+            if (isFloat) vkFloatLoop<F, U>(t, op, k, i, i + step);
+            else vkIntegerLoop<U, S>(op, k, i, i + step);
+            continue;
+        }
+        if (k.m) {
+            __m128i f = k.f ? _mm_load_si128((__m128i const *)(k.f + i)) : _mm_setzero_si128();
+            r = vkSse2Mask(r, _mm_load_si128((__m128i const *)(k.m + i)), f, sizeof(U));
+        }
+        _mm_store_si128((__m128i *)(k.d + i), r);
+    }
+#endif
+    // remaining elements
+    if (isFloat) vkFloatLoop<F, U>(t, op, k, i, n);
+    else vkIntegerLoop<U, S>(op, k, i, n);
+}
+
+// convert n float16 numbers to float. same as half2float
+static void vkHalfToFloat(float * d, uint16_t const * s, uint32_t n) {
+    uint32_t i = 0;
+#ifdef VECTOR_KERNEL_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 8 <= n; i += 8) {
+        __m128i h = _mm_loadu_si128((__m128i const *)(s + i));
+        for (int j = 0; j < 2; j++) {
+            __m128i v = j ? _mm_unpackhi_epi16(h, zero) : _mm_unpacklo_epi16(h, zero);
+            __m128i e = _mm_and_si128(v, _mm_set1_epi32(0x7C00));
+            // exponent and mantissa with adjusted exponent bias
+            __m128i r = _mm_add_epi32(_mm_slli_epi32(_mm_and_si128(v, _mm_set1_epi32(0x7FFF)), 13), _mm_set1_epi32(0x38000000));
+            r = _mm_andnot_si128(_mm_cmpeq_epi32(e, zero), r);                    // subnormal gives zero
+            r = _mm_or_si128(r, _mm_and_si128(_mm_cmpeq_epi32(e, _mm_set1_epi32(0x7C00)), _mm_set1_epi32(0x7F800000))); // inf or nan
+            r = _mm_or_si128(r, _mm_slli_epi32(_mm_and_si128(v, _mm_set1_epi32(0x8000)), 16)); // sign bit
+            _mm_storeu_si128((__m128i *)(d + i + j * 4), r);
+        }
+    }
+#endif
+    for (; i < n; i++) d[i] = half2float(s[i]);
+}
+
+// convert n float numbers to float16. same as float2half
+static void vkFloatToHalf(uint16_t * d, float const * s, uint32_t n) {
+    uint32_t i = 0;
+#ifdef VECTOR_KERNEL_SSE2
+    for (; i + 8 <= n; i += 8) {
+        __m128i r[2];
+        for (int j = 0; j < 2; j++) {
+            __m128i f = _mm_loadu_si128((__m128i const *)(s + i + j * 4));
+            __m128i a = _mm_and_si128(f, _mm_set1_epi32(0x7FFFFFFF));           // absolute value. signed compare works
+            __m128i odd = _mm_and_si128(_mm_srli_epi32(a, 13), _mm_set1_epi32(1));
+            // adjust exponent bias and round to nearest or even
+            __m128i h = _mm_srli_epi32(_mm_add_epi32(_mm_sub_epi32(a, _mm_set1_epi32(0x37FFF001)), odd), 13);
+            h = _mm_andnot_si128(_mm_cmplt_epi32(a, _mm_set1_epi32(0x38800000)), h); // underflow -> 0
+            __m128i over = _mm_cmpgt_epi32(a, _mm_set1_epi32(0x477FFFFF));
+            h = _mm_or_si128(_mm_andnot_si128(over, h), _mm_and_si128(over, _mm_set1_epi32(0x7C00))); // overflow -> inf
+            if (_mm_movemask_epi8(_mm_cmpgt_epi32(a, _mm_set1_epi32(0x7F800000)))) {
+                // nan. rare. do these elements with float2half
+                uint32_t hh[4];
+                _mm_storeu_si128((__m128i *)hh, h);
+                for (int k = 0; k < 4; k++) {
+                    float x = s[i + j * 4 + k];
+                    if (x != x) hh[k] = float2half(x) & 0x7FFF;
+                }
+                h = _mm_loadu_si128((__m128i const *)hh);
+            }
+            h = _mm_or_si128(h, _mm_and_si128(_mm_srli_epi32(f, 16), _mm_set1_epi32(0x8000))); // sign bit
+            r[j] = _mm_srai_epi32(_mm_slli_epi32(h, 16), 16);                    // sign extend for signed pack
+        }
+        _mm_storeu_si128((__m128i *)(d + i), _mm_packs_epi32(r[0], r[1]));
+    }
+#endif
+    for (; i < n; i++) d[i] = float2half(s[i]);
+}
+
+// float16 kernel. A block of elements is converted to float, calculated, and converted back.
+// Elements with a NAN operand are done by the execution function to get the same NAN propagation
+template <typename U>
+static void vkHalfRun(CThread * t, uint8_t op, SVectorKernel<U> const & k, uint32_t n) {
+    if (sizeof(U) != 2) return;                  // instantiated but not used for other types
+    const uint32_t block = 64;                   // elements per block
+    float x[block], y[block], z[block];
+    uint16_t r[block];
+    U bcast = k.bcast;
+    if (t->fInstr->immSize == 1) bcast = (U)float2half((float)(int8_t)bcast); // 8-bit integer, as in f_add_h
+    float yb = half2float(bcast);
+    for (uint32_t i0 = 0; i0 < n; i0 += block) {
+        uint32_t m = n - i0 < block ? n - i0 : block;
+        vkHalfToFloat(x, (uint16_t const *)k.a + i0, m);
+        if (k.b) vkHalfToFloat(y, (uint16_t const *)k.b + i0, m);
+        else for (uint32_t j = 0; j < m; j++) y[j] = yb;
+        switch (op) {
+        case VK_ADD_H: for (uint32_t j = 0; j < m; j++) z[j] = x[j] + y[j];  break;
+        case VK_SUB_H: for (uint32_t j = 0; j < m; j++) z[j] = x[j] - y[j];  break;
+        case VK_MUL_H: for (uint32_t j = 0; j < m; j++) z[j] = x[j] * y[j];  break;
+        }
+        vkFloatToHalf(r, z, m);
+        for (uint32_t j = 0; j < m; j++) {
+            uint32_t i = i0 + j;
+            U d = r[j];
+            if (k.m && !(k.m[i] & 1)) {
+                d = k.f ? k.f[i] : 0;
+            }
+            else if (x[j] != x[j] || y[j] != y[j]) { // NAN. parm[2] still has the broadcast value
+                t->parm[1].q = k.a[i];
+                if (k.b) t->parm[2].q = k.b[i];
+                t->parm[3].q = k.m ? k.m[i] : t->numContr;
+                d = (U)(*t->functionPointer)(t);
+            }
+            k.d[i] = d;
+        }
+    }
+}
+
+// set up kernel operands for element type U
+template <typename U, typename S, typename F>
+static void vkStart(CThread * t, uint8_t op, bool isFloat, bool broadcast, uint32_t n, uint8_t cond, bool fallbackOnly) {
+    uint8_t * v = (uint8_t *)t->vectors.buf();
+    SVectorKernel<U> k;
+    k.d = (U *)(v + t->MaxVectorLength * (t->operands[0] & 0x1F));
+    k.a = (U const *)(v + t->MaxVectorLength * (t->operands[4] & 0x1F));
+    k.b = broadcast ? 0 : (U const *)(v + t->MaxVectorLength * (t->operands[5] & 0x1F));
+    k.m = (t->operands[1] & 7) == 7 ? 0 : (U const *)(v + t->MaxVectorLength * (t->operands[1] & 7));
+    k.f = (t->operands[2] & 0x1F) == 0x1F ? 0 : (U const *)(v + t->MaxVectorLength * (t->operands[2] & 0x1F));
+    k.bcast = (U)t->parm[2].q;
+    k.cond = cond;
+    k.maskBits = t->numContr;
+    if (fallbackOnly) {
+        // all elements are masked off
+        if (k.f) memmove(k.d, k.f, n * sizeof(U));
+        else memset(k.d, 0, n * sizeof(U));
+        return;
+    }
+    if (op >= VK_ADD_H) vkHalfRun<U>(t, op, k, n);
+    else vkRun<U, S, F>(t, op, isFloat, k, n);
+}
+
+// check if any enabled element of a mask register has one of the option bits
+template <typename U>
+static bool vkMaskOptions(uint8_t const * m, uint32_t n, uint64_t options) {
+    for (uint32_t i = 0; i < n; i++) {
+        U e;
+        memcpy(&e, m + i * sizeof(U), sizeof(U));
+        if ((e & 1) && ((uint64_t)e & options)) return true;
+    }
+    return false;
+}
+
+// Execute the current vector instruction on all elements at once, if possible.
+// lastOpType is 0 for broadcast immediate or memory operand, 1 for memory vector,
+// 2 for vector register. Returns false if the instruction must be executed element by element
+bool CThread::executeVectorKernel(uint8_t lastOpType) {
+    uint8_t kop = vkFindOperation(functionPointer);
+    if (kop == 0 || nOperands != 2 || lastOpType == 1 || doubleStep || noVectorLength
+    || ignoreMask || (returnType & 0x20)) return false;
+    if (operandType > 6 || operandType == 4) return false;         // int128 and float128 not supported
+    if (kop >= VK_ADD_H && operandType != 1) return false;         // float16 instruction with wrong operand type
+    bool isFloat = operandType >= 5;
+    uint32_t size = dataSizeTable[operandType];
+    uint32_t len = vectorLengthR;
+    if (len == 0 || len % size != 0) return false;
+    uint32_t n = len / size;
+
+    bool hasMask = (operands[1] & 7) != 7;
+    bool fallbackOnly = !hasMask && !(numContr & 1);                // all elements masked off
+    // source operands shorter than the result give zero elements. leave these cases to the general loop
+    if (vectorLength[operands[4] & 0x1F] < len) return false;
+    if (lastOpType == 2 && vectorLength[operands[5] & 0x1F] < len) return false;
+    if (hasMask && vectorLength[operands[1] & 7] < len) return false;
+    if ((hasMask || fallbackOnly) && (operands[2] & 0x1F) != 0x1F && vectorLength[operands[2] & 0x1F] < len) return false;
+
+    // mask bits that make the execution functions trap
+    uint64_t options = 0;
+    if (kop == VK_ADD || kop == VK_SUB || kop == VK_MUL) options = isFloat ? MSK_OVERFL_FLOAT : MSK_OVERFL_I;
+    if (kop >= VK_ADD_H) options = MSK_OVERFL_FLOAT;
+    uint8_t cond = 0;
+    if (kop == VK_COMPARE) {
+        // condition and mask options of compare are taken from the mask register when there is one
+        if (hasMask) return false;
+        if (fInstr->tmpl == 0xE) cond = pInstr->a.im3;
+        if (cond >> 4) return false;                               // mask and fallback combinations
+        if (isFloat) options = MSK_FLOAT_NAN_LOSS;
+        else if ((fInstr->imm2 & 4) && lastOpType == 0) parm[2].q = pInstr->a.im2; // as in f_compare
+    }
+    if (!fallbackOnly && options) {
+        if (hasMask) {
+            uint8_t const * m = (uint8_t const *)vectors.buf() + MaxVectorLength * (operands[1] & 7);
+            bool found = false;
+            switch (size) {
+            case 1: found = vkMaskOptions<uint8_t>(m, n, options);  break;
+            case 2: found = vkMaskOptions<uint16_t>(m, n, options);  break;
+            case 4: found = vkMaskOptions<uint32_t>(m, n, options);  break;
+            case 8: found = vkMaskOptions<uint64_t>(m, n, options);  break;
+            }
+            if (found) return false;
+        }
+        else if (numContr & options) return false;
+    }
+
+    switch (operandType) {
+    case 0: vkStart<uint8_t,  int8_t,  float> (this, kop, false, lastOpType == 0, n, cond, fallbackOnly);  break;
+    case 1: vkStart<uint16_t, int16_t, float> (this, kop, false, lastOpType == 0, n, cond, fallbackOnly);  break;
+    case 2: vkStart<uint32_t, int32_t, float> (this, kop, false, lastOpType == 0, n, cond, fallbackOnly);  break;
+    case 3: vkStart<uint64_t, int64_t, float> (this, kop, false, lastOpType == 0, n, cond, fallbackOnly);  break;
+    case 5: vkStart<uint32_t, int32_t, float> (this, kop, true,  lastOpType == 0, n, cond, fallbackOnly);  break;
+    case 6: vkStart<uint64_t, int64_t, double>(this, kop, true,  lastOpType == 0, n, cond, fallbackOnly);  break;
+    }
+    // leave the same state as the element loop in execute()
+    vectorOffset = len;
+    vect = (n & 1) ? 2 : 1;
+    return true;
+}
@@ -79,6 +79,14 @@ SErrorText errorTexts[] = {
     {ERR_ELF_STRING_TABLE, 2, "String table corrupt"},
     {ERR_ELF_NO_SECTIONS, 2, "File with absolute constants must have at least one section, even if empty"},    
 
+    {ERR_EMU_JIT_MISMATCH, 2, "Native code and interpreter give different results at address 0x%X, register %i (32 = ip)"},
+    {ERR_VECTOR_LENGTH_OPTION, 2, "Maximum vector length must be a power of 2 from 16 to 65536: %s"},
+    {ERR_EMU_TRACE_FORMAT, 2, "Not a valid trace file: %s"},
+    {ERR_EMU_TRACE_LIST, 2, "Option -readtrace requires -list=filename"},
+    {ERR_EMU_CHECKPOINT, 2, "Checkpoint file %s does not match the executable file and options"},
+    {ERR_EMU_BATCH, 2, "Option -batch is not supported on this platform"},
+    {ERR_EMU_REPLAY, 2, "Replay file %s does not match the program run"},
+
     {ERR_CONTAINER_INDEX, 2, "Index out of range in internal container"},
     {ERR_CONTAINER_OVERFLOW, 2, "Overflow of internal container"},
 
@@ -250,6 +258,7 @@ SErrorText * CErrorReporter::FindError(int ErrorNumber) {
 
 void CErrorReporter::submit(int ErrorNumber) {
     // Print error message with no extra info
+    std::lock_guard<std::mutex> lock(mutex);
     SErrorText * err = FindError(ErrorNumber);
     handleError(err, err->text);
 }
@@ -257,6 +266,7 @@ void CErrorReporter::submit(int ErrorNumber) {
 void CErrorReporter::submit(int ErrorNumber, int extra) {
     // Print error message with extra numeric info
     // ErrorTexts[ErrorNumber] must contain %i where extra is to be inserted
+    std::lock_guard<std::mutex> lock(mutex);
     SErrorText * err = FindError(ErrorNumber);
     strings.setSize((uint32_t)strlen(err->text) + 10);
     sprintf((char*)strings.buf(), err->text, extra);
@@ -266,6 +276,7 @@ void CErrorReporter::submit(int ErrorNumber, int extra) {
 void CErrorReporter::submit(int ErrorNumber, int extra1, int extra2) {
     // Print error message with 2 extra numeric values inserted
     // ErrorTexts[ErrorNumber] must contain two %i fields where extra numbers are to be inserted
+    std::lock_guard<std::mutex> lock(mutex);
     SErrorText * err = FindError(ErrorNumber);
     strings.setSize((uint32_t)strlen(err->text) + 20);
     sprintf((char*)strings.buf(), err->text, extra1, extra2);
@@ -276,6 +287,7 @@ void CErrorReporter::submit(int ErrorNumber, char const * extra) {
     // Print error message with extra text info
     // ErrorTexts[ErrorNumber] must contain %s where extra is to be inserted
     if (extra == 0) extra = "???";
+    std::lock_guard<std::mutex> lock(mutex);
     SErrorText * err = FindError(ErrorNumber);
     strings.setSize((uint32_t)strlen(err->text) + (uint32_t)strlen(extra));
     sprintf((char*)strings.buf(), err->text, extra);
@@ -286,6 +298,7 @@ void CErrorReporter::submit(int ErrorNumber, char const * extra1, char const * e
     // Print error message with two extra text info fields
     // ErrorTexts[ErrorNumber] must contain %s where extra texts are to be inserted
     if (extra1 == 0) extra1 = "???"; if (extra2 == 0) extra2 = "???";
+    std::lock_guard<std::mutex> lock(mutex);
     SErrorText * err = FindError(ErrorNumber);
     strings.setSize((uint32_t)strlen(err->text) + (uint32_t)strlen(extra1) + (uint32_t)strlen(extra2));
     sprintf((char*)strings.buf(), err->text, extra1, extra2);
@@ -296,6 +309,7 @@ void CErrorReporter::submit(int ErrorNumber, char const * extra1, char const * e
     // Print error message with three extra text info fields
     // ErrorTexts[ErrorNumber] must contain %s where extra texts are to be inserted
     if (extra1 == 0) extra1 = "???"; if (extra2 == 0) extra2 = "???"; if (extra3 == 0) extra2 = "???";
+    std::lock_guard<std::mutex> lock(mutex);
     SErrorText * err = FindError(ErrorNumber);
     strings.setSize((uint32_t)strlen(err->text) + (uint32_t)strlen(extra1) + (uint32_t)strlen(extra2) + (uint32_t)strlen(extra3));
     sprintf((char*)strings.buf(), err->text, extra1, extra2, extra3);
@@ -306,6 +320,7 @@ void CErrorReporter::submit(int ErrorNumber, int extra1, char const * extra2) {
     // Print error message with two extra text fields inserted
     // ErrorTexts[ErrorNumber] must contain %i and %s where extra texts are to be inserted
     if (extra2 == 0) extra2 = "???";
+    std::lock_guard<std::mutex> lock(mutex);
     SErrorText * err = FindError(ErrorNumber);
     strings.setSize((uint32_t)strlen(err->text) + 10 + (uint32_t)strlen(extra2));
     sprintf((char*)strings.buf(), err->text, extra1, extra2);
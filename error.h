@@ -77,6 +77,14 @@ const int ERR_INPUT_NOT_RELINKABLE     = 319;
 const int ERR_LINK_UNRESOLVED          = 320;
 const int ERR_LINK_UNRESOLVED_WARN     = 321;
 
+const int ERR_EMU_JIT_MISMATCH         = 400;
+const int ERR_VECTOR_LENGTH_OPTION     = 401;
+const int ERR_EMU_TRACE_FORMAT         = 402;
+const int ERR_EMU_TRACE_LIST           = 403;
+const int ERR_EMU_CHECKPOINT           = 404;
+const int ERR_EMU_BATCH                = 405;
+const int ERR_EMU_REPLAY               = 406;
+
 const int ERR_TOO_MANY_ERRORS          = 500;
 const int ERR_BIG_ENDIAN               = 501;
 const int ERR_INTERNAL                 = 502;
@@ -204,6 +212,7 @@ protected:
    int worstError;                               // Highest error number encountered
    int maxWarnings;                              // Max number of warning messages to pring
    int maxErrors;                                // Max number of error messages to print
+   std::mutex mutex;                             // Protects strings and counters. Emulated threads may report errors at the same time
    void handleError(SErrorText * err, char const * text); // Used by submit function
 };
 
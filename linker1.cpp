@@ -1058,6 +1058,10 @@ void CLinker::makeProgramHeaders() {
                 // different permissions. must align by at least 1 << MEMORY_MAP_ALIGN
                 if (maxAlign < MEMORY_MAP_ALIGN) maxAlign = MEMORY_MAP_ALIGN;
             }
+            if (!(sections[sec].sh_flags & SHF_WRITE) && maxAlign < FILE_PAGE_ALIGN) {
+                // read-only segment. page aligned so that the loader can map it from the file
+                maxAlign = FILE_PAGE_ALIGN;
+            }
             // use low 32 bits of p_paddr to store index into sections and 
             // high 32 bits to store number of sections
             pHeader.p_paddr = sec;
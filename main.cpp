@@ -178,8 +178,8 @@ void CConverter::emulate() {
     emulator.go();                   // Do the job
 }
 
-// Convert half precision floating point number
-float half2float(uint32_t half) {
+// Convert half precision floating point number. used for making halfToFloatTable
+static float half2floatCompute(uint32_t half) {
     union {
         uint32_t hhh;
         float fff;
@@ -204,44 +204,40 @@ float half2float(uint32_t half) {
     return u.fff;
 }
 
+// Table for converting half precision to single precision, indexed by the 16-bit pattern
+float halfToFloatTable[0x10000];
+
+// Fill halfToFloatTable before main() is called
+static struct CHalfTableInit {
+    CHalfTableInit() {
+        for (uint32_t i = 0; i < 0x10000; i++) halfToFloatTable[i] = half2floatCompute(i);
+    }
+} halfTableInit;
+
 // Convert floating point number to half precision. subnormals give zero
 uint16_t float2half(float x) {
-    union {
-        float f;
-        struct {
-            uint32_t mant: 23;
-            uint32_t expo:  8;
-            uint32_t sign:  1;
-        };
-    } u;
-    union {
-        uint16_t h;
-        struct {
-            uint16_t mant: 10;
-            uint16_t expo:  5;
-            uint16_t sign:  1;
-        };
-    } v;
-    u.f = x;
-    v.mant = u.mant >> 13;         // get upper part of mantissa
-    if (u.mant & (1 << 12)) {      // round to nearest or even
-        if ((u.mant & ((1 << 12) - 1)) || (v.mant & 1)) { // round up if odd or remaining bits are nonzero
-            v.h++;                       // overflow here will give infinity
-        }
+    uint32_t f;
+    memcpy(&f, &x, 4);
+    uint32_t sign = f >> 16 & 0x8000;
+    uint32_t a = f & 0x7FFFFFFF;                 // absolute value
+    uint32_t h;
+    if (a < 0x38800000) {
+        h = 0;                                   // underflow -> 0
     }
-    v.expo = u.expo - 0x70;
-    v.sign = u.sign;
-    if (u.expo == 0xFF) {
-        v.expo = 0x1F;  // infinity or nan
-        if (u.mant != 0 && v.mant == 0) v.mant = 0x200;  // make sure output is a nan if input is nan
+    else if (a < 0x47800000) {
+        // adjust exponent bias and round to nearest or even. overflow here gives infinity
+        h = (a - 0x37FFF001 + (a >> 13 & 1)) >> 13;
     }
-    else if (u.expo > 0x8E) {
-        v.expo = 0x1F;  v.mant = 0;  // overflow -> inf
+    else if (a <= 0x7F800000) {
+        h = 0x7C00;                              // overflow -> inf
     }
-    else if (u.expo < 0x71) {
-        v.expo = 0;  v.mant = 0;     // underflow -> 0
+    else {
+        // nan. the payload is rounded as above, without carry into the exponent
+        h = (a >> 13) + ((a >> 12 & 1) & ((a & 0xFFF) != 0 || (a >> 13 & 1)));
+        h = 0x7C00 | (h & 0x3FF);
+        if ((h & 0x3FF) == 0) h |= 0x200;        // make sure output is a nan if input is nan
     }
-    return v.h;   
+    return uint16_t(h | sign);
 }
 
 // Convert double precision floating point number to half precision. subnormals give zero
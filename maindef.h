@@ -90,8 +90,11 @@ uint32_t bitScanForward(uint64_t x);
 // Convert 32 bit time stamp to string
 const char * timestring(uint32_t t);
 
-// Convert half precision floating point number to single precision
-float half2float(uint32_t half);
+// Convert half precision floating point number to single precision. subnormals give zero
+extern float halfToFloatTable[0x10000];
+static inline float half2float(uint32_t half) {
+    return halfToFloatTable[half & 0xFFFF];
+}
 
 // Convert floating point number to half precision
 uint16_t float2half(float x);
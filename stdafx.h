@@ -31,6 +31,11 @@
 #include <ctype.h>
 #include <time.h>
 #include <math.h>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <chrono>
 
 #include "maindef.h"
 #include "elf_forwardcom.h"
@@ -49,6 +49,11 @@
 #define SYSF_EXIT                 0x010  // terminate program
 #define SYSF_ABORT                0x011  // abort program
 #define SYSF_TIME                 0x020  // time
+#define SYSF_THREAD_CREATE        0x030  // start a new thread. r0 = function address, r1 = parameter
+#define SYSF_THREAD_JOIN          0x031  // wait for a thread to finish. r0 = thread number
+#define SYSF_THREAD_EXIT          0x032  // end current thread. r0 = return value
+#define SYSF_THREAD_ID            0x033  // get number of current thread. main thread = 0
+#define SYSF_CHECKPOINT           0x040  // save state in checkpoint file. returns r0 = 0 when saved, 1 when restored, -1 if failed
 
 // input/output functions
 #define SYSF_PUTS                 0x101  // write string to stdout
@@ -73,3 +78,26 @@
 #define SYSF_FSCANF               0x131  // read formatted input from file
 #define SYSF_SSCANF               0x132  // read formatted input from string buffer
 #define SYSF_REMOVE               0x140  // delete file
+#define SYSF_MMAP_FILE            0x150  // map file into memory. r0 = file name, r1 = 1 for writeable private copy. returns address, r1 = size. 0 if failed
+#define SYSF_AIO_READ             0x160  // start reading file. r0 = request block. returns 0 if started, -1 if failed
+#define SYSF_AIO_WRITE            0x161  // start writing file. r0 = request block. returns 0 if started, -1 if failed
+#define SYSF_AIO_WAIT             0x162  // wait for request to finish. r0 = request block. returns result
+
+// request block for SYSF_AIO_READ and SYSF_AIO_WRITE. five 64-bit fields, aligned by 8:
+// file handle, buffer address, number of bytes, file position, result.
+// result is AIO_PENDING until the request is finished, then the number of bytes transferred, or -1 if error
+#define AIO_PENDING               (-2)
+
+// memory and string functions. done by the host at full speed after one check of the memory range
+#define SYSF_MEMCPY               0x201  // copy memory. r0 = destination, r1 = source, r2 = size. returns destination
+#define SYSF_MEMMOVE              0x202  // copy memory, may overlap. r0 = destination, r1 = source, r2 = size. returns destination
+#define SYSF_MEMSET               0x203  // fill memory. r0 = destination, r1 = byte value, r2 = size. returns destination
+#define SYSF_MEMCMP               0x204  // compare memory. r0 = first, r1 = second, r2 = size. returns <0, 0, >0
+#define SYSF_STRLEN               0x205  // length of zero-terminated string in r0
+#define SYSF_STRCMP               0x206  // compare zero-terminated strings in r0 and r1. returns <0, 0, >0
+
+// memory allocation functions. use the heap reserved with option -heapsize
+#define SYSF_MALLOC               0x210  // allocate memory. r0 = size. returns address, or 0 if failed
+#define SYSF_FREE                 0x211  // free memory. r0 = address returned by malloc, realloc or aligned_alloc
+#define SYSF_REALLOC              0x212  // change size of allocated memory. r0 = address, r1 = new size. returns new address, or 0 if failed
+#define SYSF_ALIGNED_ALLOC        0x213  // allocate aligned memory. r0 = alignment, a power of 2, r1 = size. returns address, or 0 if failed
@@ -0,0 +1,102 @@
+/****************************  compare_swap.as  *****************************
+* Stress test and benchmark of compare_swap with several threads.
+* Run with option -maxthreads=4.
+* Two threads increment an aligned int32 counter, and two threads increment
+* the upper half of an unaligned int64 that overlaps the same counter, with a
+* compare_swap loop each. The aligned operand uses a host atomic instruction
+* and the unaligned operand does not, so the test fails with lost updates if
+* the two are not atomic with respect to each other.
+* The program exits with 0 if the counter is right, 1 if updates were lost,
+* and 2 if a thread could not be started.
+*****************************************************************************/
+
+bss section datap uninitialized read write
+counters: int64 0, 0, 0, 0
+bss end
+
+code section execute
+
+__entry_point function public
+_main function public
+int64 r0 = address([aligned_worker])
+int64 r1 = 0
+int64 r6 = 0x100000030                 // thread_create
+int64 sys_call(r0, r1, r6)
+int64 r20 = r0
+int64 r0 = address([unaligned_worker])
+int64 r6 = 0x100000030
+int64 sys_call(r0, r1, r6)
+int64 r21 = r0
+int64 r0 = address([unaligned_worker])
+int64 r6 = 0x100000030
+int64 sys_call(r0, r1, r6)
+int64 r22 = r0
+call aligned_worker                    // the main thread works too
+int64 r0 = r20
+int64 r6 = 0x100000031                 // thread_join
+int64 sys_call(r0, r1, r6)
+int64 r23 = r0
+int64 r0 = r21
+int64 r6 = 0x100000031
+int64 sys_call(r0, r1, r6)
+int64 r23 |= r0
+int64 r0 = r22
+int64 r6 = 0x100000031
+int64 sys_call(r0, r1, r6)
+int64 r23 |= r0
+int64 r0 = 2
+if (int64 r23 != 0) {jump DONE}       // thread not started or not joined
+int64 r1 = address([counters])
+int32 r2 = [r1+8]                      // counter
+int32 r3 = [r1+4]                      // lower half of unaligned operand must be untouched
+int64 r0 = 1
+if (int32 r3 != 0) {jump DONE}
+if (int32 r2 != 40000) {jump DONE}
+int64 r0 = 0
+DONE:
+int64 r6 = 0x100000010                 // exit
+int64 sys_call(r0, r1, r6)
+return
+_main end
+
+// increment aligned int32 at counters+8 10000 times. returns 0
+aligned_worker function public
+int64 r1 = address([counters])
+int64 r10 = 0
+A1:
+int32 r2 = [r1+8]
+A2:
+int32 r3 = r2 + 1
+int32 r4 = r2
+int32 r4 = compare_swap(r4, r3, [r1+8])
+int32 r5 = r2
+int32 r2 = r4
+if (int32 r4 != r5) {jump A2}           // another thread came first. try again
+int64 r10 = r10 + 1
+if (int64 r10 < 10000) {jump A1}
+int64 r0 = 0
+return
+aligned_worker end
+
+// add 1 to the upper half of the unaligned int64 at counters+4 10000 times. returns 0
+unaligned_worker function public
+int64 r1 = address([counters])
+int64 r9 = 1
+int64 r9 = r9 << 32
+int64 r10 = 0
+U1:
+int64 r2 = [r1+4]
+U2:
+int64 r3 = r2 + r9
+int64 r4 = r2
+int64 r4 = compare_swap(r4, r3, [r1+4])
+int64 r5 = r2
+int64 r2 = r4
+if (int64 r4 != r5) {jump U2}
+int64 r10 = r10 + 1
+if (int64 r10 < 10000) {jump U1}
+int64 r0 = 0
+return
+unaligned_worker end
+
+code end
@@ -0,0 +1,55 @@
+/****************************  half_conversion.as  **************************
+* Test of conversion from single to half precision with the compress instruction.
+* Rounding carries into the exponent, a value that rounds to more than the
+* largest half precision number gives infinity, and values below 2^-14 give
+* zero because subnormals are not supported.
+* The program exits with 0 if all results are right, otherwise with the
+* number of the first wrong result.
+*****************************************************************************/
+
+const section read ip
+// single precision inputs
+source: int32 0x477FF000          // 65520. rounds to infinity
+        int32 0x477FEFFF          // just below 65520. gives 65504
+        int32 0x44FFFCCD          // 2047.9. rounds to 2048
+        int32 0xC4FFFCCD          // -2047.9. rounds to -2048
+        int32 0x387FFFFF          // just below 2^-14. gives zero
+        int32 0x38000000          // 2^-15. gives zero
+        int32 0x38800000          // 2^-14. smallest normal number
+        int32 0x3F800000          // 1.0
+// expected half precision results
+expect: int16 0x7C00, 0x7BFF, 0x6800, 0xE800, 0x0000, 0x0000, 0x0400, 0x3C00
+const end
+
+bss section datap uninitialized read write
+result: int16 0, 0, 0, 0, 0, 0, 0, 0
+bss end
+
+code section execute
+__entry_point function public
+_main function public
+int64 r1 = address([source])
+int64 r2 = 32                     // length of source vector in bytes
+float v1 = [r1, length=r2]
+float v2 = compress(r2, v1)       // convert to half precision
+int64 r3 = address([result])
+int64 r4 = 16
+int16 [r3, length=r4] = v2
+// compare with expected results
+int64 r5 = address([expect])
+int64 r0 = 0
+for (int64 r7 = 0; r7 < 8; r7++) {
+  int16 r8 = [r3]
+  int16 r9 = [r5]
+  int64 r3 += 2
+  int64 r5 += 2
+  if (int16 r8 != r9) {
+    int64 r0 = r7 + 1
+    break
+  }
+}
+int64 r6 = 0x100000010            // exit with r0
+int64 sys_call(r0, r1, r6)
+return
+_main end
+code end
@@ -0,0 +1,120 @@
+/****************************  heap.as  *************************************
+* Test of the heap allocation functions malloc, free, realloc and
+* aligned_alloc. Run with option -heapsize=N, at least 4 MB.
+* Checks the alignment of small and large blocks, that realloc keeps the
+* contents, and that freed large blocks next to each other are merged and
+* given back to the unused part of the heap.
+* The last test frees a small block twice. This must stop the program with an
+* access violation, so the program exits with 0 only if the second free is
+* caught. Otherwise it exits with the number of the first failed test.
+*****************************************************************************/
+
+code section execute
+
+__entry_point function public
+_main function public
+// test 1: small block is aligned by 16
+int64 r0 = 40
+int64 r6 = 0x100000210                 // malloc
+int64 sys_call(r0, r1, r6)
+int64 r20 = r0
+int64 r1 = r0 & 15
+int64 r0 = 1
+if (int64 r20 == 0) {jump DONE}
+if (int64 r1 != 0) {jump DONE}
+// test 2: realloc to a bigger block keeps the contents
+int64 r1 = 0x12345678
+int64 [r20] = r1
+int64 r0 = r20
+int64 r1 = 1000
+int64 r6 = 0x100000212                 // realloc
+int64 sys_call(r0, r1, r6)
+int64 r20 = r0
+int64 r0 = 2
+if (int64 r20 == 0) {jump DONE}
+int64 r1 = [r20]
+if (int64 r1 != 0x12345678) {jump DONE}
+int64 r0 = r20
+int64 r6 = 0x100000211                 // free
+int64 sys_call(r0, r1, r6)
+// test 3: aligned_alloc of a small block
+int64 r0 = 4096
+int64 r1 = 100
+int64 r6 = 0x100000213                 // aligned_alloc
+int64 sys_call(r0, r1, r6)
+int64 r20 = r0
+int64 r1 = r0 & 4095
+int64 r0 = 3
+if (int64 r20 == 0) {jump DONE}
+if (int64 r1 != 0) {jump DONE}
+int64 r0 = r20
+int64 r6 = 0x100000211
+int64 sys_call(r0, r1, r6)
+// test 4: three large blocks of two spans each. free them in an order that
+// needs merging with the run before and after, then allocate five spans.
+// all six spans are back in the unused part, so the new block starts at the first one
+int64 r0 = 0x18000
+int64 r6 = 0x100000210
+int64 sys_call(r0, r1, r6)
+int64 r20 = r0
+int64 r0 = 0x18000
+int64 r6 = 0x100000210
+int64 sys_call(r0, r1, r6)
+int64 r21 = r0
+int64 r0 = 0x18000
+int64 r6 = 0x100000210
+int64 sys_call(r0, r1, r6)
+int64 r22 = r0
+int64 r0 = 4
+if (int64 r20 == 0) {jump DONE}
+if (int64 r21 == 0) {jump DONE}
+if (int64 r22 == 0) {jump DONE}
+int64 r0 = r20
+int64 r6 = 0x100000211
+int64 sys_call(r0, r1, r6)
+int64 r0 = r22
+int64 r6 = 0x100000211
+int64 sys_call(r0, r1, r6)
+int64 r0 = r21
+int64 r6 = 0x100000211
+int64 sys_call(r0, r1, r6)
+int64 r0 = 0x50000
+int64 r6 = 0x100000210
+int64 sys_call(r0, r1, r6)
+int64 r1 = r0
+int64 r0 = 4
+if (int64 r1 != r20) {jump DONE}
+int64 r0 = r1
+int64 r6 = 0x100000211
+int64 sys_call(r0, r1, r6)
+// test 5: aligned_alloc of a large block with an alignment bigger than a span
+int64 r0 = 0x40000
+int64 r1 = 0x10000
+int64 r6 = 0x100000213
+int64 sys_call(r0, r1, r6)
+int64 r20 = r0
+int64 r1 = r0 & 0x3FFFF
+int64 r0 = 5
+if (int64 r20 == 0) {jump DONE}
+if (int64 r1 != 0) {jump DONE}
+int64 r0 = r20
+int64 r6 = 0x100000211
+int64 sys_call(r0, r1, r6)
+// test 6: second free of a small block must stop the program
+int64 r0 = 24
+int64 r6 = 0x100000210
+int64 sys_call(r0, r1, r6)
+int64 r20 = r0
+int64 r6 = 0x100000211
+int64 sys_call(r0, r1, r6)
+int64 r0 = r20
+int64 r6 = 0x100000211
+int64 sys_call(r0, r1, r6)
+int64 r0 = 6                           // second free was not caught
+DONE:
+int64 r6 = 0x100000010                 // exit
+int64 sys_call(r0, r1, r6)
+return
+_main end
+
+code end